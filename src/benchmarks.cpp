@@ -3,6 +3,11 @@
 #include "optimized.h"
 #include <random>
 #include "lossy.hpp"
+#include "multithreshold.h"
+#include "dispatch.h"
+#include "mvau.h"
+#include "pool.h"
+#include "epilogue.h"
 #include <span>
 #include <immintrin.h>
 
@@ -14,7 +19,7 @@ std::vector<float> base = { 0.5527185,0.39846906, -0.11766014,  0.19299345, -0.3
 std::vector<float> inp;
 std::vector<float> in;
 
-std::vector<float> getBatchInputs(size_t batchSize) {
+std::vector<float> getBatchInputs(size_t batchSize, size_t elemcount = 24) {
 
   std::random_device rndDevice;
   std::mt19937 mersenneEngine{ rndDevice() };  // Generates random integers
@@ -23,7 +28,7 @@ std::vector<float> getBatchInputs(size_t batchSize) {
 
   auto gen = [&dist, &mersenneEngine]() { return dist(mersenneEngine); };
 
-  std::vector<float> ret(24 * batchSize);
+  std::vector<float> ret(elemcount * batchSize);
 
   std::generate(ret.begin(), ret.end(), gen);
 
@@ -48,68 +53,83 @@ constexpr auto table = lossy::_create_lookup_table<int8_t, float, 255, scale, sh
 
 
 
-/**
- * Get the indices of the next eight inputs from the given pointer
- */
-__m256i get_indices(const float *inputs)
-{
-  const __m256 scales = _mm256_set_ps(scale_f, scale_f, scale_f, scale_f, scale_f, scale_f, scale_f, scale_f);
-  const __m256 shifts = _mm256_set_ps(shift_f, shift_f, shift_f, shift_f, shift_f, shift_f, shift_f, shift_f);
-  const __m256 inputs_reg = _mm256_loadu_ps(inputs);
-  auto y = _mm256_fmadd_ps(inputs_reg, scales, shifts);
-  auto x = _mm256_cvtps_epi32(y);
-  //std::cout << "Scales: " << static_cast<float>(scales[0]) << "\nShifts: " << static_cast<float>(shifts[0]) << "\nInputs: " << static_cast<float>(inputs_reg[0]) << "\nFused MADD: " << static_cast<float>(y[0]) << "\nCast res: " << static_cast<float>(x[0]) << std::endl;
-  return x;
-}
-
-/**
- * Do a simd lookup on the given inputs
- */
-template <typename T>
-std::vector<T> simd_lookup(std::vector<float> &inputs) {
-  // Make sure we can easily use simd intrinsics
-  if (inputs.size() % 8 != 0) {
-    throw std::runtime_error("Cannot do simd lookup on non-multiples of 8");
-  }
-
-  // Calculate all indices
-  std::vector<unsigned int> indices(inputs.size(), 1);
-  for (int i = 0; i < inputs.size() / 8; i++) {
-    _mm256_storeu_si256(
-      reinterpret_cast<__m256i_u *>(indices.data() + i * 8), 
-      get_indices(
-        inputs.data() + i * 8
-      )
-    );
-  }
-
-  // Instantiate needed result vectors and constants
-  const T last = table[max_scaled - 1];
-  const T first = table[0];
-  std::vector<T> v(inputs.size(), first); // Pre initialize to table[0], this way we can avoid one more comparison
-
-  // Getting the actual values
-  omp_set_num_threads(threadcount);
-#pragma omp parallel for
-  for (int index = 0; index < inputs.size(); index++) {
-    float i = inputs[index];
-    if (i > max_float) {
-      v[index] = last;
-    } else if (i < min_float) {
-      continue;
-    } else {
-      v[index] = table[indices[i]];
-    }
+// the same table as a deployable SIMD lookup, and a table small enough for a register
+const lossy::GatherLookup<int8_t> gatherTable(table, scale_f, shift_f);
+constexpr unsigned int smallScale = 8;
+constexpr unsigned int smallShift = lossy::_get_shift(smallScale, min_float);
+constexpr unsigned int smallSize = lossy::_get_max_scale(smallScale, float_range);
+constexpr auto smallTable = lossy::_create_lookup_table<int8_t, float, 255, smallScale, smallShift, smallSize>(first_thresholds);
+const lossy::GatherLookup<int8_t> gatherSmallTable(smallTable, static_cast<float>(smallScale), static_cast<float>(smallShift));
+std::vector<int8_t> gatherOut(24 * 4096);
+
+
+
+// ------ WIDE LAYER BENCHS ------
+// 512 channels * 1KB of thresholds no longer fit into L1
+constexpr size_t wideChannels = 512;
+
+std::vector<float> getWideThresholds(size_t channels) {
+  std::mt19937 mersenneEngine{ 1234 };
+  std::uniform_real_distribution<float> dist{ -4.0, 4.0 };
+  std::vector<float> ret(channels * 255);
+  for (size_t c = 0; c < channels; ++c) {
+    std::generate(ret.begin() + c * 255, ret.begin() + (c + 1) * 255, [&]() { return dist(mersenneEngine); });
+    std::sort(ret.begin() + c * 255, ret.begin() + (c + 1) * 255);
   }
-  return v;
+  return ret;
 }
 
+#ifndef THRESHOLDS_NPY
+#define THRESHOLDS_NPY "MultiThreshold_0_param0.npy"
+#endif
+const FinnUtils::ThresholdTable npyTable = FinnUtils::ThresholdTable::fromNpy(THRESHOLDS_NPY);
+
+std::vector<float> wideThresholds = getWideThresholds(wideChannels);
+const optimized::SortedIndex wideSorted(wideThresholds.data(), wideChannels, 255);
+const optimized::ThresholdIndex wideEytzinger(wideThresholds.data(), wideChannels, 255);
+std::vector<float> wideInp;
+
+// ------ SHORT THRESHOLD LIST BENCHS ------
+// 15 thresholds per channel (4 bit activations), every 17th of the shipped table
+std::vector<float> getShortThresholds() {
+  std::vector<float> ret;
+  for (size_t c = 0; c < 24; ++c) {
+    for (size_t k = 0; k < 15; ++k) {
+      ret.emplace_back(thresholds[c * 255 + 17 * k + 8]);
+    }
+  }
+  return ret;
+}
 
+std::vector<float> shortThresholds = getShortThresholds();
+const optimized::ThresholdIndex shortEytzinger(shortThresholds.data(), 24, 15);
+const optimized::ScanIndex shortScan(shortThresholds.data(), 24, 15);
+// ------ GENERIC ENGINE BENCHS ------
+constexpr optimized::MultiThreshold<24, 255> generic255(thresholds);
+const optimized::DynamicMultiThreshold<float, int8_t> dynamic255(thresholds.data(), 24, 255);
+const optimized::DynamicMultiThreshold<float, int8_t> dynamic15(shortThresholds.data(), 24, 15, -8);
+
+std::array<float, 24 * 3> getTernaryThresholds() {
+  std::array<float, 24 * 3> ret;
+  for (size_t c = 0; c < 24; ++c) {
+    for (size_t k = 0; k < 3; ++k) {
+      ret[c * 3 + k] = thresholds[c * 255 + 64 * k + 63];
+    }
+  }
+  return ret;
+}
+const optimized::MultiThreshold<24, 3, float, int8_t, -2> generic3(getTernaryThresholds());
 
+const optimized::ThresholdIndex fullEytzinger(thresholds.data(), 24, 255);
+const optimized::ScanIndex fullScan(thresholds.data(), 24, 255);
+const optimized::RadixIndex fullRadix(thresholds.data(), 24, 255);
+const optimized::RadixIndex wideRadix(wideThresholds.data(), wideChannels, 255);
 
 
 
 
+// Channel 0 tables applied to every channel, only valid because all channels of thresholds.h are identical.
+// The multi-channel lookups below are the general case.
 class LossyFixture : public benchmark::Fixture {
 public:
   LossyFixture() {
@@ -130,9 +150,8 @@ std::vector<int8_t> lossy_constexpr_lookup(std::vector<float> &inputs) {
   int8_t last = table[max_scaled - 1];
   int8_t first = table[0];
   std::vector<int8_t> v(inputs.size(), first); // Pre initialize to table[0], this way we can avoid one more comparison
-  omp_set_num_threads(threadcount);
 
-#pragma omp parallel for
+#pragma omp parallel for num_threads(threadcount)
   for (int index = 0; index < inputs.size(); index++) {
     float i = inputs[index];
     if (i > max_float) {
@@ -218,6 +237,20 @@ void BM_optimizedB1(benchmark::State& state) {
   }
 }
 
+void BM_optimizedSIMDB1(benchmark::State& state) {
+  for (auto _ : state) {
+    auto out = optimized::multithresholdSIMD<24>(in);
+    benchmark::DoNotOptimize(out);
+  }
+}
+
+void BM_optimizedSoAB1(benchmark::State& state) {
+  for (auto _ : state) {
+    auto out = optimized::multithresholdSoA<24>(in);
+    benchmark::DoNotOptimize(out);
+  }
+}
+
 void BM_optimizedLEB1(benchmark::State& state) {
   for (auto _ : state) {
     auto out = optimized::multithresholdLE<24>(in);
@@ -225,6 +258,13 @@ void BM_optimizedLEB1(benchmark::State& state) {
   }
 }
 
+void BM_optimizedLinearPCB1(benchmark::State& state) {
+  for (auto _ : state) {
+    auto out = optimized::multithresholdLinearPerChannel<24>(in);
+    benchmark::DoNotOptimize(out);
+  }
+}
+
 void BM_optimizedLinearPTB1(benchmark::State& state) {
   for (auto _ : state) {
     auto out = optimized::multithresholdLinearPerTensor(in);
@@ -232,6 +272,37 @@ void BM_optimizedLinearPTB1(benchmark::State& state) {
   }
 }
 
+// Same kernels writing into a reused output buffer, no allocation per call
+std::vector<int8_t> outB1(24);
+
+void BM_optimizedSpanB1(benchmark::State& state) {
+  for (auto _ : state) {
+    optimized::multithreshold<24>(in, outB1);
+    benchmark::DoNotOptimize(outB1.data());
+  }
+}
+
+void BM_optimizedSIMDSpanB1(benchmark::State& state) {
+  for (auto _ : state) {
+    optimized::multithresholdSIMD<24>(in, outB1);
+    benchmark::DoNotOptimize(outB1.data());
+  }
+}
+
+void BM_optimizedLinearPTSpanB1(benchmark::State& state) {
+  for (auto _ : state) {
+    optimized::multithresholdLinearPerTensor(in, outB1);
+    benchmark::DoNotOptimize(outB1.data());
+  }
+}
+
+void BM_generic255SpanB1(benchmark::State& state) {
+  for (auto _ : state) {
+    generic255(std::span<const float>(in), std::span<int8_t>(outB1));
+    benchmark::DoNotOptimize(outB1.data());
+  }
+}
+
 BENCHMARK_F(LossyFixture, BM_lossy4096_precision_digits_4)(benchmark::State& state) {
   for (auto _ : state) {
     auto out = lu.thresholds(inp);
@@ -248,11 +319,25 @@ void BM_lossy4096_precision_digits_4_constexpr(benchmark::State& state) {
 
 void BM_lossy4096_precision_digits_4_constexpr_simd(benchmark::State& state) {
   for (auto _ : state) {
-    auto out = simd_lookup<int8_t>(inp);
+    auto out = gatherTable.thresholds(inp);
     benchmark::DoNotOptimize(out);
   }
 }
 
+void BM_lossy4096_gather_span(benchmark::State& state) {
+  for (auto _ : state) {
+    gatherTable.thresholds(inp, gatherOut);
+    benchmark::DoNotOptimize(gatherOut.data());
+  }
+}
+
+void BM_lossy4096_small_table_span(benchmark::State& state) {
+  for (auto _ : state) {
+    gatherSmallTable.thresholds(inp, gatherOut);
+    benchmark::DoNotOptimize(gatherOut.data());
+  }
+}
+
 void BM_lossy4096_precision_digits_4_constexpr_std(benchmark::State& state) {
   for (auto _ : state) {
     auto out = lossy_constexpr_lookup_std(inp);
@@ -267,6 +352,41 @@ void BM_lossy4096_precision_digits_4_constexpr_unparallel(benchmark::State& stat
   }
 }
 
+// per-channel tables within an L2 sized and an L1 sized budget
+const lossy::MultiChannelLossyLookup<int8_t> multiLossyL2(FinnUtils::ThresholdTable(thresholds.data(), 24, 255), 1 << 20);
+const lossy::MultiChannelLossyLookup<int8_t> multiLossyL1(FinnUtils::ThresholdTable(thresholds.data(), 24, 255), 1 << 15);
+// smallest power of two scale with at most 0.1% mismatches on a calibration batch
+const lossy::MultiChannelLossyLookup<int8_t> autoLossy(FinnUtils::ThresholdTable(thresholds.data(), 24, 255), getBatchInputs(256), 0.001);
+std::vector<int8_t> multiLossyOut(24 * 4096);
+
+void BM_lossyMultiChannelL2B4096(benchmark::State& state) {
+  for (auto _ : state) {
+    multiLossyL2.thresholds(inp, multiLossyOut);
+    benchmark::DoNotOptimize(multiLossyOut.data());
+  }
+}
+
+void BM_lossyAutoPrecisionB4096(benchmark::State& state) {
+  for (auto _ : state) {
+    autoLossy.thresholds(inp, multiLossyOut);
+    benchmark::DoNotOptimize(multiLossyOut.data());
+  }
+}
+
+void BM_lossyMultiChannelL1B4096(benchmark::State& state) {
+  for (auto _ : state) {
+    multiLossyL1.thresholds(inp, multiLossyOut);
+    benchmark::DoNotOptimize(multiLossyOut.data());
+  }
+}
+
+void BM_optimizedLinearPCB4096(benchmark::State& state) {
+  for (auto _ : state) {
+    auto out = optimized::multithresholdLinearPerChannel<24>(inp);
+    benchmark::DoNotOptimize(out);
+  }
+}
+
 void BM_optimizedLinearPTB4096(benchmark::State& state) {
   for (auto _ : state) {
     auto out = optimized::multithresholdLinearPerTensor(inp);
@@ -325,6 +445,27 @@ void BM_optimizedB4096(benchmark::State& state) {
   }
 }
 
+void BM_optimizedSIMDB4096(benchmark::State& state) {
+  for (auto _ : state) {
+    auto out = optimized::multithresholdSIMD<24>(inp);
+    benchmark::DoNotOptimize(out);
+  }
+}
+
+void BM_optimizedSoAB4096(benchmark::State& state) {
+  for (auto _ : state) {
+    auto out = optimized::multithresholdSoA<24>(inp);
+    benchmark::DoNotOptimize(out);
+  }
+}
+
+void BM_npySIMDB4096(benchmark::State& state) {
+  for (auto _ : state) {
+    auto out = optimized::multithresholdSIMD(npyTable, inp);
+    benchmark::DoNotOptimize(out);
+  }
+}
+
 void BM_optimizedLEB4096(benchmark::State& state) {
   for (auto _ : state) {
     auto out = optimized::multithresholdLE<24>(inp);
@@ -339,6 +480,617 @@ void BM_optimizedLEMTB4096(benchmark::State& state) {
   }
 }
 
+void BM_sortedIndexWideB256(benchmark::State& state) {
+  for (auto _ : state) {
+    auto out = optimized::multithreshold<wideChannels>(wideInp, wideSorted);
+    benchmark::DoNotOptimize(out);
+  }
+}
+
+void BM_eytzingerIndexWideB256(benchmark::State& state) {
+  for (auto _ : state) {
+    auto out = optimized::multithreshold<wideChannels>(wideInp, wideEytzinger);
+    benchmark::DoNotOptimize(out);
+  }
+}
+
+void BM_sortedIndexLEWideB256(benchmark::State& state) {
+  for (auto _ : state) {
+    auto out = optimized::multithresholdLE<wideChannels>(wideInp, wideSorted);
+    benchmark::DoNotOptimize(out);
+  }
+}
+
+void BM_eytzingerIndexLEWideB256(benchmark::State& state) {
+  for (auto _ : state) {
+    auto out = optimized::multithresholdLE<wideChannels>(wideInp, wideEytzinger);
+    benchmark::DoNotOptimize(out);
+  }
+}
+
+void BM_eytzingerIndexB4096(benchmark::State& state) {
+  for (auto _ : state) {
+    auto out = optimized::multithreshold<24>(inp, fullEytzinger);
+    benchmark::DoNotOptimize(out);
+  }
+}
+
+void BM_radixIndexB4096(benchmark::State& state) {
+  for (auto _ : state) {
+    auto out = optimized::multithreshold<24>(inp, fullRadix);
+    benchmark::DoNotOptimize(out);
+  }
+}
+
+void BM_radixIndexWideB256(benchmark::State& state) {
+  for (auto _ : state) {
+    auto out = optimized::multithreshold<wideChannels>(wideInp, wideRadix);
+    benchmark::DoNotOptimize(out);
+  }
+}
+
+void BM_scanIndexB4096(benchmark::State& state) {
+  for (auto _ : state) {
+    auto out = optimized::multithreshold<24>(inp, fullScan);
+    benchmark::DoNotOptimize(out);
+  }
+}
+
+void BM_eytzingerIndexShortB4096(benchmark::State& state) {
+  for (auto _ : state) {
+    auto out = optimized::multithreshold<24>(inp, shortEytzinger);
+    benchmark::DoNotOptimize(out);
+  }
+}
+
+void BM_scanIndexShortB4096(benchmark::State& state) {
+  for (auto _ : state) {
+    auto out = optimized::multithreshold<24>(inp, shortScan);
+    benchmark::DoNotOptimize(out);
+  }
+}
+
+void BM_generic255B4096(benchmark::State& state) {
+  for (auto _ : state) {
+    auto out = generic255(inp);
+    benchmark::DoNotOptimize(out);
+  }
+}
+
+void BM_dynamic255B4096(benchmark::State& state) {
+  for (auto _ : state) {
+    auto out = dynamic255(inp);
+    benchmark::DoNotOptimize(out);
+  }
+}
+
+void BM_dynamic15B4096(benchmark::State& state) {
+  for (auto _ : state) {
+    auto out = dynamic15(inp);
+    benchmark::DoNotOptimize(out);
+  }
+}
+
+void BM_generic3B4096(benchmark::State& state) {
+  for (auto _ : state) {
+    auto out = generic3(inp);
+    benchmark::DoNotOptimize(out);
+  }
+}
+
+void BM_dynamic15PackedB4096(benchmark::State& state) {
+  for (auto _ : state) {
+    auto out = dynamic15.packed(inp);
+    benchmark::DoNotOptimize(out);
+  }
+}
+
+void BM_generic3PackedB4096(benchmark::State& state) {
+  for (auto _ : state) {
+    auto out = generic3.packed(inp);
+    benchmark::DoNotOptimize(out);
+  }
+}
+
+// ------ THREAD POOL ENGINE BENCHS ------
+optimized::MultiThresholdEngine engine;
+std::vector<int8_t> engineOut(24 * 4096);
+
+void BM_engineLEMTB1(benchmark::State& state) {
+  for (auto _ : state) {
+    engine.multithresholdLEMT<24>(in, engineOut);
+    benchmark::DoNotOptimize(engineOut.data());
+  }
+}
+
+void BM_engineLEMTB4096(benchmark::State& state) {
+  for (auto _ : state) {
+    engine.multithresholdLEMT<24>(inp, engineOut);
+    benchmark::DoNotOptimize(engineOut.data());
+  }
+}
+
+void BM_engineSIMDB4096(benchmark::State& state) {
+  for (auto _ : state) {
+    engine.multithresholdSIMD<24>(inp, engineOut);
+    benchmark::DoNotOptimize(engineOut.data());
+  }
+}
+
+void BM_engineLinearPTB4096(benchmark::State& state) {
+  for (auto _ : state) {
+    engine.multithresholdLinearPerTensor(inp, engineOut);
+    benchmark::DoNotOptimize(engineOut.data());
+  }
+}
+
+// ------ CORRELATED INPUT BENCHS ------
+// 4096 rows of 24 channels whose consecutive values per channel are correlated, next to the uniform inp
+std::vector<float> getSortedInputs() {
+  std::vector<float> ret = getBatchInputs(4096);
+  for (size_t c = 0; c < 24; ++c) {
+    std::vector<float> column;
+    for (size_t r = 0; r < 4096; ++r) {
+      column.emplace_back(ret[r * 24 + c]);
+    }
+    std::sort(column.begin(), column.end());
+    for (size_t r = 0; r < 4096; ++r) {
+      ret[r * 24 + c] = column[r];
+    }
+  }
+  return ret;
+}
+
+std::vector<float> getRandomWalkInputs() {
+  std::vector<float> ret(24 * 4096);
+  std::mt19937 engine{ 42 };
+  std::normal_distribution<float> step{ 0.0f, 0.05f };
+  for (size_t i = 0; i < ret.size(); ++i) {
+    ret[i] = (i < 24) ? 0.0f : std::clamp(ret[i - 24] + step(engine), -4.0f, 4.0f);
+  }
+  return ret;
+}
+
+// Smooth 64x64 NHWC feature map, the way a conv layer output is traversed
+std::vector<float> getFeatureMapInputs() {
+  std::vector<float> ret(24 * 4096);
+  for (size_t y = 0; y < 64; ++y) {
+    for (size_t x = 0; x < 64; ++x) {
+      for (size_t c = 0; c < 24; ++c) {
+        ret[(y * 64 + x) * 24 + c] = 2.0f * std::sin(0.11f * x * (c % 5 + 1) + 0.3f * c) * std::cos(0.07f * y + 0.2f * c);
+      }
+    }
+  }
+  return ret;
+}
+
+std::vector<float> sortedInp = getSortedInputs();
+std::vector<float> walkInp = getRandomWalkInputs();
+std::vector<float> featureMapInp = getFeatureMapInputs();
+std::vector<int8_t> correlatedOut(24 * 4096);
+
+// argument 0 is the binary search, 1 the galloping search
+void BM_LEUniformB4096(benchmark::State& state) {
+  for (auto _ : state) {
+    optimized::multithresholdLE<24>(inp, correlatedOut, static_cast<optimized::LESearch>(state.range(0)));
+    benchmark::DoNotOptimize(correlatedOut.data());
+  }
+}
+
+void BM_LESortedB4096(benchmark::State& state) {
+  for (auto _ : state) {
+    optimized::multithresholdLE<24>(sortedInp, correlatedOut, static_cast<optimized::LESearch>(state.range(0)));
+    benchmark::DoNotOptimize(correlatedOut.data());
+  }
+}
+
+void BM_LERandomWalkB4096(benchmark::State& state) {
+  for (auto _ : state) {
+    optimized::multithresholdLE<24>(walkInp, correlatedOut, static_cast<optimized::LESearch>(state.range(0)));
+    benchmark::DoNotOptimize(correlatedOut.data());
+  }
+}
+
+void BM_LEFeatureMapB4096(benchmark::State& state) {
+  for (auto _ : state) {
+    optimized::multithresholdLE<24>(featureMapInp, correlatedOut, static_cast<optimized::LESearch>(state.range(0)));
+    benchmark::DoNotOptimize(correlatedOut.data());
+  }
+}
+
+void BM_SIMDFeatureMapB4096(benchmark::State& state) {
+  for (auto _ : state) {
+    optimized::multithresholdSIMD<24>(featureMapInp, correlatedOut);
+    benchmark::DoNotOptimize(correlatedOut.data());
+  }
+}
+
+// ------ STRONG SCALING BENCHS ------
+// Fixed 64K row batch, the argument is the thread count
+const FinnUtils::ThresholdTable compiledTable(thresholds.data(), 24, 255);
+std::vector<float> scalingInp;
+std::vector<int8_t> scalingOut(24 * 65536);
+
+void BM_sortMergeB65536(benchmark::State& state) {
+  for (auto _ : state) {
+    optimized::multithresholdSortMerge(compiledTable, scalingInp, scalingOut);
+    benchmark::DoNotOptimize(scalingOut.data());
+  }
+}
+
+void BM_sortMergeB4096(benchmark::State& state) {
+  for (auto _ : state) {
+    optimized::multithresholdSortMerge(compiledTable, inp, scalingOut);
+    benchmark::DoNotOptimize(scalingOut.data());
+  }
+}
+
+void BM_SIMDB65536(benchmark::State& state) {
+  for (auto _ : state) {
+    optimized::multithresholdSIMD<24>(scalingInp, scalingOut);
+    benchmark::DoNotOptimize(scalingOut.data());
+  }
+}
+
+// ------ INTEGER KEY BENCHS ------
+const optimized::KeyTable keyTable(compiledTable);
+const lossy::KeyThresholdLookup<int8_t> keyLookup(std::span<const float>(thresholds.data(), 255), 16, -128);
+
+void BM_keysB4096(benchmark::State& state) {
+  for (auto _ : state) {
+    optimized::multithresholdKeys(keyTable, inp, scalingOut);
+    benchmark::DoNotOptimize(scalingOut.data());
+  }
+}
+
+void BM_SIMDSpanB4096(benchmark::State& state) {
+  for (auto _ : state) {
+    optimized::multithresholdSIMD(compiledTable, inp, scalingOut);
+    benchmark::DoNotOptimize(scalingOut.data());
+  }
+}
+
+void BM_keyLookupB4096(benchmark::State& state) {
+  for (auto _ : state) {
+    keyLookup.thresholds(inp, scalingOut);
+    benchmark::DoNotOptimize(scalingOut.data());
+  }
+}
+
+const FinnUtils::QuantizedTable quantizedTable(compiledTable, float_range / 200.0f, 0);
+
+std::vector<int8_t> getQuantizedInputs() {
+  std::vector<int8_t> ret(inp.size());
+  std::transform(inp.begin(), inp.end(), ret.begin(), [](float x) {
+    return static_cast<int8_t>(std::clamp(std::lround(x / quantizedTable.scale), -128l, 127l));
+  });
+  return ret;
+}
+
+std::vector<int8_t> quantizedInp;
+
+void BM_quantizedB4096(benchmark::State& state) {
+  for (auto _ : state) {
+    optimized::multithresholdQuantized(quantizedTable, quantizedInp, scalingOut);
+    benchmark::DoNotOptimize(scalingOut.data());
+  }
+}
+
+// every channel scaled by its own factor, so each one gets its own map
+FinnUtils::QuantizedTable getChannelQuantizedTable() {
+  std::vector<float> scaled(thresholds.begin(), thresholds.end());
+  for (size_t i = 0; i < scaled.size(); ++i) {
+    scaled[i] *= 1.0f + static_cast<float>(i / 255) / 24.0f;
+  }
+  return FinnUtils::QuantizedTable(FinnUtils::ThresholdTable(std::move(scaled), 24, 255), quantizedTable.scale, 0);
+}
+
+const FinnUtils::QuantizedTable channelQuantizedTable = getChannelQuantizedTable();
+
+void BM_quantizedChannelsB4096(benchmark::State& state) {
+  for (auto _ : state) {
+    optimized::multithresholdQuantized(channelQuantizedTable, quantizedInp, scalingOut);
+    benchmark::DoNotOptimize(scalingOut.data());
+  }
+}
+
+// accumulator domain: thresholds and inputs scaled by 1000
+template<typename T>
+FinnUtils::IntegerThresholdTable<T> getAccumulatorThresholds(const std::vector<float>& source, size_t count) {
+  std::vector<T> ret(source.size());
+  std::transform(source.begin(), source.end(), ret.begin(), [](float t) { return static_cast<T>(std::floor(t * 1000.0f)); });
+  return FinnUtils::IntegerThresholdTable<T>(std::move(ret), 24, count);
+}
+
+template<typename T>
+std::vector<T> getAccumulatorInputs() {
+  std::vector<T> ret(inp.size());
+  std::transform(inp.begin(), inp.end(), ret.begin(), [](float x) { return static_cast<T>(std::lround(x * 1000.0f)); });
+  return ret;
+}
+
+const std::vector<float> accumulatorSource(thresholds.begin(), thresholds.end());
+const FinnUtils::IntegerThresholdTable<int16_t> accumulatorThresholds16 = getAccumulatorThresholds<int16_t>(accumulatorSource, 255);
+const optimized::IntegerInterleavedTable<int16_t> accumulatorTable16(accumulatorThresholds16);
+const optimized::IntegerInterleavedTable<int32_t> accumulatorTable32(getAccumulatorThresholds<int32_t>(accumulatorSource, 255));
+const optimized::IntegerInterleavedTable<int16_t> shortAccumulatorTable16(getAccumulatorThresholds<int16_t>(shortThresholds, 15));
+std::vector<int16_t> accumulatorInp16;
+std::vector<int32_t> accumulatorInp32;
+
+void BM_integer16B4096(benchmark::State& state) {
+  for (auto _ : state) {
+    optimized::multithresholdInteger<int16_t>(accumulatorTable16, accumulatorInp16, scalingOut);
+    benchmark::DoNotOptimize(scalingOut.data());
+  }
+}
+
+void BM_integer16ShortB4096(benchmark::State& state) {
+  for (auto _ : state) {
+    optimized::multithresholdInteger<int16_t>(shortAccumulatorTable16, accumulatorInp16, scalingOut);
+    benchmark::DoNotOptimize(scalingOut.data());
+  }
+}
+
+void BM_integer32B4096(benchmark::State& state) {
+  for (auto _ : state) {
+    optimized::multithresholdInteger<int32_t>(accumulatorTable32, accumulatorInp32, scalingOut);
+    benchmark::DoNotOptimize(scalingOut.data());
+  }
+}
+
+// ------ FUSED MVAU BENCHS ------
+// 256 inputs -> 64 thresholded outputs, fused against the product written out and thresholded afterwards
+constexpr size_t mvauIn = 256;
+constexpr size_t mvauOut = 64;
+
+template<typename T>
+std::vector<T> getMVAUWeights() {
+  std::mt19937 mersenneEngine{ 99 };
+  std::uniform_real_distribution<float> dist{ -1.0f, 1.0f };
+  std::vector<T> ret(mvauIn * mvauOut);
+  std::generate(ret.begin(), ret.end(), [&]() { return std::is_same_v<T, float> ? static_cast<T>(dist(mersenneEngine) / 4.0f) : static_cast<T>(8.0f * dist(mersenneEngine)); });
+  return ret;
+}
+
+std::vector<int8_t> getMVAUIntInputs(size_t rows) {
+  std::mt19937 mersenneEngine{ 5 };
+  std::uniform_int_distribution<int> dist{ -128, 127 };
+  std::vector<int8_t> ret(rows * mvauIn);
+  std::generate(ret.begin(), ret.end(), [&]() { return static_cast<int8_t>(dist(mersenneEngine)); });
+  return ret;
+}
+
+const FinnUtils::ThresholdTable mvauTable(wideThresholds.data(), mvauOut, 255);
+const std::vector<float> mvauIntSource(wideThresholds.begin(), wideThresholds.begin() + mvauOut * 255);
+const FinnUtils::IntegerThresholdTable<int32_t> mvauIntTable = [] {
+  std::vector<int32_t> ret(mvauIntSource.size());
+  std::transform(mvauIntSource.begin(), mvauIntSource.end(), ret.begin(), [](float t) { return static_cast<int32_t>(std::floor(t * 1000.0f)); });
+  return FinnUtils::IntegerThresholdTable<int32_t>(std::move(ret), mvauOut, 255);
+}();
+const optimized::MVAU<float> floatMVAU(getMVAUWeights<float>(), mvauIn, mvauOut, mvauTable);
+const optimized::MVAU<int8_t> intMVAU(getMVAUWeights<int8_t>(), mvauIn, mvauOut, mvauIntTable);
+const optimized::IntegerInterleavedTable<int32_t> mvauInterleaved(mvauIntTable);
+std::vector<float> mvauFloatInp;
+std::vector<int8_t> mvauIntInp;
+std::vector<float> mvauFloatAcc(1024 * mvauOut);
+std::vector<int32_t> mvauIntAcc(1024 * mvauOut);
+std::vector<int8_t> mvauOutput(1024 * mvauOut);
+
+void BM_mvauFloatFusedB1024(benchmark::State& state) {
+  for (auto _ : state) {
+    floatMVAU(mvauFloatInp, mvauOutput);
+    benchmark::DoNotOptimize(mvauOutput.data());
+  }
+}
+
+void BM_mvauFloatUnfusedB1024(benchmark::State& state) {
+  for (auto _ : state) {
+    floatMVAU.accumulate(mvauFloatInp, mvauFloatAcc);
+    optimized::multithresholdSIMD(mvauTable, mvauFloatAcc, mvauOutput);
+    benchmark::DoNotOptimize(mvauOutput.data());
+  }
+}
+
+void BM_mvauIntFusedB1024(benchmark::State& state) {
+  for (auto _ : state) {
+    intMVAU(mvauIntInp, mvauOutput);
+    benchmark::DoNotOptimize(mvauOutput.data());
+  }
+}
+
+void BM_mvauIntUnfusedB1024(benchmark::State& state) {
+  for (auto _ : state) {
+    intMVAU.accumulate(mvauIntInp, mvauIntAcc);
+    optimized::multithresholdInteger<int32_t>(mvauInterleaved, mvauIntAcc, mvauOutput);
+    benchmark::DoNotOptimize(mvauOutput.data());
+  }
+}
+
+// ------ THRESHOLD + MAX POOL BENCHS ------
+// 16 maps of 32x32x64 pooled 2x2 with stride 2, the argument is the optimized::PoolOrder (Auto, PoolFirst, ThresholdFirst)
+const optimized::PoolShape poolShape{ 32, 32, 64, 2, 2 };
+const FinnUtils::ThresholdTable poolTable(wideThresholds.data(), poolShape.channels, 255);
+std::vector<float> poolInp;
+std::vector<int8_t> poolOutput(16 * poolShape.outputSize());
+
+void BM_thresholdPoolB16(benchmark::State& state) {
+  const optimized::ThresholdMaxPool<float> pool(poolTable, poolShape, static_cast<optimized::PoolOrder>(state.range(0)));
+  state.SetLabel(pool.order() == optimized::PoolOrder::PoolFirst ? "pool first" : "threshold first");
+  for (auto _ : state) {
+    pool(poolInp, poolOutput);
+    benchmark::DoNotOptimize(poolOutput.data());
+  }
+}
+
+// ------ EPILOGUE BENCHS ------
+// Per channel out_scale / out_bias to float, from the counts and fused behind LE against a separate dequantize pass
+const optimized::Epilogue<float> floatEpilogue(std::vector<float>(24, 0.25f), std::vector<float>(24, -32.0f));
+std::vector<int8_t> epilogueQuantized(24 * 4096);
+std::vector<float> epilogueOut(24 * 4096);
+
+void BM_epilogueSIMDB4096(benchmark::State& state) {
+  for (auto _ : state) {
+    optimized::multithresholdSIMD(compiledTable, inp, std::span<float>(epilogueOut), floatEpilogue);
+    benchmark::DoNotOptimize(epilogueOut.data());
+  }
+}
+
+void BM_dequantizeSIMDB4096(benchmark::State& state) {
+  for (auto _ : state) {
+    optimized::multithresholdSIMD(compiledTable, inp, epilogueQuantized);
+    floatEpilogue.apply(epilogueQuantized, epilogueOut);
+    benchmark::DoNotOptimize(epilogueOut.data());
+  }
+}
+
+void BM_epilogueLEB4096(benchmark::State& state) {
+  for (auto _ : state) {
+    optimized::multithresholdLE(compiledTable, inp, std::span<float>(epilogueOut), floatEpilogue);
+    benchmark::DoNotOptimize(epilogueOut.data());
+  }
+}
+
+void BM_fusedLEB4096(benchmark::State& state) {
+  for (auto _ : state) {
+    floatEpilogue.fused([](std::span<const float> in, std::span<int8_t> out) { optimized::multithresholdLE(compiledTable, in, out); }, std::span<const float>(inp), std::span<float>(epilogueOut), 24);
+    benchmark::DoNotOptimize(epilogueOut.data());
+  }
+}
+
+void BM_dequantizeLEB4096(benchmark::State& state) {
+  for (auto _ : state) {
+    optimized::multithresholdLE(compiledTable, inp, epilogueQuantized);
+    floatEpilogue.apply(epilogueQuantized, epilogueOut);
+    benchmark::DoNotOptimize(epilogueOut.data());
+  }
+}
+
+// ------ DISPATCH BENCHS ------
+// The argument is the dispatch::Isa of the variant
+void BM_dispatchSIMDB4096(benchmark::State& state) {
+  const auto isa = static_cast<dispatch::Isa>(state.range(0));
+  if (!dispatch::supported(isa)) {
+    state.SkipWithError("variant not supported by this cpu");
+    return;
+  }
+  const dispatch::Kernels& variant = dispatch::kernels(isa);
+  state.SetLabel(variant.name);
+  for (auto _ : state) {
+    variant.multithresholdSIMD(compiledTable, inp, scalingOut);
+    benchmark::DoNotOptimize(scalingOut.data());
+  }
+}
+
+void BM_dispatchLEB4096(benchmark::State& state) {
+  const auto isa = static_cast<dispatch::Isa>(state.range(0));
+  if (!dispatch::supported(isa)) {
+    state.SkipWithError("variant not supported by this cpu");
+    return;
+  }
+  const dispatch::Kernels& variant = dispatch::kernels(isa);
+  state.SetLabel(variant.name);
+  for (auto _ : state) {
+    variant.multithresholdLE(compiledTable, inp, scalingOut);
+    benchmark::DoNotOptimize(scalingOut.data());
+  }
+}
+
+void BM_dispatchQuantizedB4096(benchmark::State& state) {
+  const auto isa = static_cast<dispatch::Isa>(state.range(0));
+  if (!dispatch::supported(isa)) {
+    state.SkipWithError("variant not supported by this cpu");
+    return;
+  }
+  const dispatch::Kernels& variant = dispatch::kernels(isa);
+  state.SetLabel(variant.name);
+  for (auto _ : state) {
+    variant.multithresholdQuantized(quantizedTable, quantizedInp, scalingOut);
+    benchmark::DoNotOptimize(scalingOut.data());
+  }
+}
+
+void BM_dispatchInteger16B4096(benchmark::State& state) {
+  const auto isa = static_cast<dispatch::Isa>(state.range(0));
+  if (!dispatch::supported(isa)) {
+    state.SkipWithError("variant not supported by this cpu");
+    return;
+  }
+  const dispatch::Kernels& variant = dispatch::kernels(isa);
+  state.SetLabel(variant.name);
+  for (auto _ : state) {
+    variant.multithresholdInteger16(accumulatorTable16, accumulatorInp16, scalingOut);
+    benchmark::DoNotOptimize(scalingOut.data());
+  }
+}
+
+// Prepared families come from the factories of the variant, so the layer is built by the code that runs it
+void BM_dispatchMVAUFloatB1024(benchmark::State& state) {
+  const auto isa = static_cast<dispatch::Isa>(state.range(0));
+  if (!dispatch::supported(isa)) {
+    state.SkipWithError("variant not supported by this cpu");
+    return;
+  }
+  const dispatch::Kernels& variant = dispatch::kernels(isa);
+  state.SetLabel(variant.name);
+  const auto mvau = variant.mvauFloat(getMVAUWeights<float>(), mvauIn, mvauOut, mvauTable);
+  for (auto _ : state) {
+    (*mvau)(mvauFloatInp, mvauOutput);
+    benchmark::DoNotOptimize(mvauOutput.data());
+  }
+}
+
+void BM_dispatchPoolB16(benchmark::State& state) {
+  const auto isa = static_cast<dispatch::Isa>(state.range(0));
+  if (!dispatch::supported(isa)) {
+    state.SkipWithError("variant not supported by this cpu");
+    return;
+  }
+  const dispatch::Kernels& variant = dispatch::kernels(isa);
+  state.SetLabel(variant.name);
+  const auto pool = variant.thresholdMaxPool(poolTable, poolShape, optimized::PoolOrder::Auto);
+  for (auto _ : state) {
+    (*pool)(poolInp, poolOutput);
+    benchmark::DoNotOptimize(poolOutput.data());
+  }
+}
+
+void BM_LEMTScalingB65536(benchmark::State& state) {
+  for (auto _ : state) {
+    optimized::multithresholdLEMT(compiledTable, scalingInp, scalingOut);
+    benchmark::DoNotOptimize(scalingOut.data());
+  }
+}
+
+void BM_LEMTTiledScalingB65536(benchmark::State& state) {
+  for (auto _ : state) {
+    optimized::multithresholdLEMTTiled(compiledTable, scalingInp, scalingOut, static_cast<int>(state.range(0)));
+    benchmark::DoNotOptimize(scalingOut.data());
+  }
+}
+
+void BM_engineLEMTScalingB65536(benchmark::State& state) {
+  optimized::MultiThresholdEngine scaled(state.range(0));
+  for (auto _ : state) {
+    scaled.multithresholdLEMT(compiledTable, scalingInp, scalingOut);
+    benchmark::DoNotOptimize(scalingOut.data());
+  }
+}
+
+// 64K rows (6 MiB of input) no longer fit into L2
+void BM_LEB65536(benchmark::State& state) {
+  for (auto _ : state) {
+    optimized::multithresholdLE(compiledTable, scalingInp, scalingOut);
+    benchmark::DoNotOptimize(scalingOut.data());
+  }
+}
+
+void BM_LEBlockedB65536(benchmark::State& state) {
+  for (auto _ : state) {
+    optimized::multithresholdLEBlocked(compiledTable, scalingInp, scalingOut);
+    benchmark::DoNotOptimize(scalingOut.data());
+  }
+}
+
 void BM_intclamp(benchmark::State& state) {
   std::vector<int> inp(1000);
   std::iota(inp.begin(), inp.end(), -5);
@@ -369,20 +1121,93 @@ BENCHMARK(BM_optimizedLEB1)->Iterations(1000);
 BENCHMARK(BM_optimizedLEMTB1)->Iterations(1000);
 BENCHMARK(BM_naiveB1)->Iterations(1000);
 BENCHMARK(BM_optimizedB1)->Iterations(1000);
+BENCHMARK(BM_optimizedSIMDB1)->Iterations(1000);
+BENCHMARK(BM_optimizedSoAB1)->Iterations(1000);
 BENCHMARK(BM_optimizedLinearPTB1)->Iterations(1000);
+BENCHMARK(BM_optimizedLinearPCB1)->Iterations(1000);
 BENCHMARK(BM_optimizedLinearPTOPB1)->Iterations(1000);
+BENCHMARK(BM_optimizedSpanB1)->Iterations(1000);
+BENCHMARK(BM_optimizedSIMDSpanB1)->Iterations(1000);
+BENCHMARK(BM_optimizedLinearPTSpanB1)->Iterations(1000);
+BENCHMARK(BM_generic255SpanB1)->Iterations(1000);
 BENCHMARK(BM_referenceB4096)->Iterations(1000);
 BENCHMARK(BM_lossy4096_precision_digits_4_constexpr)->Iterations(1000);
 BENCHMARK(BM_lossy4096_precision_digits_4_constexpr_simd)->Iterations(1000);
+BENCHMARK(BM_lossy4096_gather_span)->Iterations(1000);
+BENCHMARK(BM_lossy4096_small_table_span)->Iterations(1000);
 BENCHMARK(BM_lossy4096_precision_digits_4_constexpr_std)->Iterations(1000);
 BENCHMARK(BM_lossy4096_precision_digits_4_constexpr_unparallel)->Iterations(1000);
+BENCHMARK(BM_lossyMultiChannelL2B4096)->Iterations(1000);
+BENCHMARK(BM_lossyMultiChannelL1B4096)->Iterations(1000);
+BENCHMARK(BM_lossyAutoPrecisionB4096)->Iterations(1000);
 BENCHMARK(BM_optimizedB4096)->Iterations(1000);
+BENCHMARK(BM_optimizedSIMDB4096)->Iterations(1000);
+BENCHMARK(BM_optimizedSoAB4096)->Iterations(1000);
+BENCHMARK(BM_npySIMDB4096)->Iterations(1000);
 BENCHMARK(BM_naiveB4096)->Iterations(1000);
 BENCHMARK(BM_optimizedLEB4096)->Iterations(1000);
 BENCHMARK(BM_optimizedLEMTB4096)->Iterations(1000);
 BENCHMARK(BM_optimizedLinearPTB4096)->Iterations(1000);
+BENCHMARK(BM_optimizedLinearPCB4096)->Iterations(1000);
 BENCHMARK(BM_optimizedLinearPTOPB4096)->Iterations(1000);
 BENCHMARK(BM_optimizedLinearPTICB4096)->Iterations(1000);
+BENCHMARK(BM_sortedIndexWideB256)->Iterations(100);
+BENCHMARK(BM_eytzingerIndexWideB256)->Iterations(100);
+BENCHMARK(BM_sortedIndexLEWideB256)->Iterations(100);
+BENCHMARK(BM_eytzingerIndexLEWideB256)->Iterations(100);
+BENCHMARK(BM_eytzingerIndexB4096)->Iterations(1000);
+BENCHMARK(BM_scanIndexB4096)->Iterations(1000);
+BENCHMARK(BM_radixIndexB4096)->Iterations(1000);
+BENCHMARK(BM_radixIndexWideB256)->Iterations(100);
+BENCHMARK(BM_eytzingerIndexShortB4096)->Iterations(1000);
+BENCHMARK(BM_scanIndexShortB4096)->Iterations(1000);
+BENCHMARK(BM_generic255B4096)->Iterations(1000);
+BENCHMARK(BM_dynamic255B4096)->Iterations(1000);
+BENCHMARK(BM_dynamic15B4096)->Iterations(1000);
+BENCHMARK(BM_generic3B4096)->Iterations(1000);
+BENCHMARK(BM_dynamic15PackedB4096)->Iterations(1000);
+BENCHMARK(BM_generic3PackedB4096)->Iterations(1000);
+BENCHMARK(BM_engineLEMTB1)->Iterations(1000);
+BENCHMARK(BM_engineLEMTB4096)->Iterations(1000);
+BENCHMARK(BM_engineSIMDB4096)->Iterations(1000);
+BENCHMARK(BM_engineLinearPTB4096)->Iterations(1000);
+BENCHMARK(BM_LEUniformB4096)->Arg(0)->Arg(1)->Iterations(1000);
+BENCHMARK(BM_LESortedB4096)->Arg(0)->Arg(1)->Iterations(1000);
+BENCHMARK(BM_LERandomWalkB4096)->Arg(0)->Arg(1)->Iterations(1000);
+BENCHMARK(BM_LEFeatureMapB4096)->Arg(0)->Arg(1)->Iterations(1000);
+BENCHMARK(BM_SIMDFeatureMapB4096)->Iterations(1000);
+BENCHMARK(BM_LEB65536)->Iterations(20);
+BENCHMARK(BM_LEBlockedB65536)->Iterations(20);
+BENCHMARK(BM_sortMergeB65536)->Iterations(20);
+BENCHMARK(BM_sortMergeB4096)->Iterations(1000);
+BENCHMARK(BM_SIMDB65536)->Iterations(20);
+BENCHMARK(BM_keysB4096)->Iterations(1000);
+BENCHMARK(BM_SIMDSpanB4096)->Iterations(1000);
+BENCHMARK(BM_keyLookupB4096)->Iterations(1000);
+BENCHMARK(BM_dispatchSIMDB4096)->DenseRange(0, 3)->Iterations(1000);
+BENCHMARK(BM_dispatchLEB4096)->DenseRange(0, 3)->Iterations(1000);
+BENCHMARK(BM_quantizedB4096)->Iterations(1000);
+BENCHMARK(BM_quantizedChannelsB4096)->Iterations(1000);
+BENCHMARK(BM_integer16B4096)->Iterations(1000);
+BENCHMARK(BM_integer16ShortB4096)->Iterations(1000);
+BENCHMARK(BM_integer32B4096)->Iterations(1000);
+BENCHMARK(BM_mvauFloatFusedB1024)->Iterations(200);
+BENCHMARK(BM_mvauFloatUnfusedB1024)->Iterations(200);
+BENCHMARK(BM_mvauIntFusedB1024)->Iterations(200);
+BENCHMARK(BM_mvauIntUnfusedB1024)->Iterations(200);
+BENCHMARK(BM_thresholdPoolB16)->DenseRange(0, 2)->Iterations(200);
+BENCHMARK(BM_epilogueSIMDB4096)->Iterations(1000);
+BENCHMARK(BM_dequantizeSIMDB4096)->Iterations(1000);
+BENCHMARK(BM_epilogueLEB4096)->Iterations(1000);
+BENCHMARK(BM_fusedLEB4096)->Iterations(1000);
+BENCHMARK(BM_dequantizeLEB4096)->Iterations(1000);
+BENCHMARK(BM_dispatchQuantizedB4096)->DenseRange(0, 3)->Iterations(1000);
+BENCHMARK(BM_dispatchInteger16B4096)->DenseRange(0, 3)->Iterations(1000);
+BENCHMARK(BM_dispatchMVAUFloatB1024)->DenseRange(0, 3)->Iterations(200);
+BENCHMARK(BM_dispatchPoolB16)->DenseRange(0, 3)->Iterations(200);
+BENCHMARK(BM_LEMTScalingB65536)->Iterations(20);
+BENCHMARK(BM_LEMTTiledScalingB65536)->RangeMultiplier(2)->Range(1, 64)->Iterations(20)->UseRealTime();
+BENCHMARK(BM_engineLEMTScalingB65536)->RangeMultiplier(2)->Range(1, 64)->Iterations(20)->UseRealTime();
 
 BENCHMARK(BM_intclamp)->Iterations(1000);
 BENCHMARK(BM_stdclamp)->Iterations(1000);
@@ -394,9 +1219,17 @@ BENCHMARK(BM_stdclamp)->Iterations(1000);
 int main(int argc, char** argv) {
   in = getBatchInputs(1);
   inp = getBatchInputs(4096);
+  wideInp = getBatchInputs(256, wideChannels);
+  scalingInp = getBatchInputs(65536);
+  quantizedInp = getQuantizedInputs();
+  accumulatorInp16 = getAccumulatorInputs<int16_t>();
+  accumulatorInp32 = getAccumulatorInputs<int32_t>();
+  mvauFloatInp = getBatchInputs(1024, mvauIn);
+  mvauIntInp = getMVAUIntInputs(1024);
+  poolInp = getBatchInputs(16 * poolShape.height * poolShape.width, poolShape.channels);
   
   auto v1 = lossy_constexpr_lookup(in);
-  auto v2 = simd_lookup<int8_t>(in);
+  auto v2 = gatherTable.thresholds(in);
   for (int i = 0; i < v1.size(); i++) {
     if (v1[i] != v2[i]) {
       std::cout << "\n\ninput: " << in[i] << std::endl;
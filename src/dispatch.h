@@ -0,0 +1,240 @@
+#ifndef FINN_DISPATCH
+#define FINN_DISPATCH
+
+#include <span>
+#include <vector>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <cstdint>
+#include <cstdlib>
+#include <stdexcept>
+#include <atomic>
+#include "threshold_table.h"
+
+/**
+ * Runtime selection between kernel variants compiled for different instruction sets. Every variant is a separate
+ * translation unit (src/dispatch/) that compiles the kernels for its target into its own FINN_ISA namespace and fills a
+ * Kernels table. kernels() picks the widest variant the cpu supports on first use, unless the FINN_DISPATCH environment
+ * variable (scalar, avx2, avx512, avx512vbmi) or select() asks for another one. There is no SSE4.2 variant: the kernels
+ * have no SSE4.2 paths, so it would only repeat the scalar (SSE2) code under another name.
+ * Plain table kernels are function pointers, everything that prepares a table or layer first (search indexes, lossy
+ * lookups, MultiThreshold engines, MVAU, ThresholdMaxPool, Epilogue, MultiThresholdEngine) comes from a factory of the
+ * variant behind one of the interfaces below, so preparation and calls run the same variant. The compile time
+ * MultiThreshold<Channels, Count> runs the code of DynamicMultiThreshold, which is the dispatched form of both.
+ * Needs the fastmultithreshold_dispatch library. Kernels used directly from the headers are compiled for the target of
+ * the including translation unit, i.e. their baseline path in portable builds.
+ */
+namespace dispatch {
+
+    enum class Isa { Scalar, AVX2, AVX512, AVX512VBMI };
+
+    using Kernel = void (*)(const FinnUtils::ThresholdTable&, std::span<const float>, std::span<int8_t>);
+    using QuantizedKernel = void (*)(const FinnUtils::QuantizedTable&, std::span<const int8_t>, std::span<int8_t>);
+    template<typename T>
+    using IntegerKernel = void (*)(const FinnUtils::IntegerInterleavedTable<T>&, std::span<const T>, std::span<int8_t>);
+
+    /**
+     * A kernel prepared once for one table or layer by the variant that built it
+     */
+    template<typename In, typename Out = int8_t>
+    class Prepared {
+        public:
+        virtual ~Prepared() = default;
+
+        // Number of outputs for inputs input elements
+        virtual std::size_t outputSize(std::size_t inputs) const = 0;
+        virtual void operator()(std::span<const In> inp, std::span<Out> ret) const = 0;
+
+        std::vector<Out> operator()(const std::vector<In>& inp) const {
+            std::vector<Out> ret(outputSize(inp.size()));
+            (*this)(std::span<const In>(inp), std::span<Out>(ret));
+            return ret;
+        }
+    };
+
+    template<typename In, typename Out = int8_t>
+    using PreparedPtr = std::unique_ptr<const Prepared<In, Out>>;
+
+    /**
+     * optimized::MultiThresholdEngine of one variant
+     */
+    class Engine {
+        public:
+        virtual ~Engine() = default;
+
+        virtual std::size_t threads() const = 0;
+        virtual void multithresholdLinearPerTensor(std::span<const float> inp, std::span<int8_t> ret) = 0;
+        virtual void multithresholdSIMD(const FinnUtils::ThresholdTable& table, std::span<const float> inp, std::span<int8_t> ret) = 0;
+        virtual void multithresholdLEMT(const FinnUtils::ThresholdTable& table, std::span<const float> inp, std::span<int8_t> ret) = 0;
+    };
+
+    /**
+     * optimized::Epilogue of one variant and the kernels that apply it to their counts
+     */
+    template<typename Out>
+    class EpilogueKernels {
+        public:
+        virtual ~EpilogueKernels() = default;
+
+        virtual void apply(std::span<const int8_t> inp, std::span<Out> ret) const = 0;
+        virtual void multithresholdSIMD(const FinnUtils::ThresholdTable& table, std::span<const float> inp, std::span<Out> ret) const = 0;
+        virtual void multithresholdLE(const FinnUtils::ThresholdTable& table, std::span<const float> inp, std::span<Out> ret) const = 0;
+        virtual void multithresholdLEMT(const FinnUtils::ThresholdTable& table, std::span<const float> inp, std::span<Out> ret) const = 0;
+        virtual void multithresholdLinearPerTensor(const FinnUtils::ThresholdTable& table, std::span<const float> inp, std::span<Out> ret) const = 0;
+    };
+
+    template<typename Out>
+    using EpilogueFactory = std::unique_ptr<const EpilogueKernels<Out>> (*)(std::vector<float> scale, std::vector<float> bias);
+
+    // The optimized::SearchIndex backends
+    enum class IndexKind { Sorted, Threshold, Scan, Linear, Radix, Auto };
+
+    /**
+     * Runtime table kernels with their default arguments, and the factories of the prepared kernels
+     */
+    struct Kernels {
+        Isa isa;
+        const char* name;
+        Kernel multithreshold;
+        Kernel multithresholdLE;
+        Kernel multithresholdLEBlocked;
+        Kernel multithresholdLEMT;
+        Kernel multithresholdLEMTTiled;
+        Kernel multithresholdLinearPerTensor;
+        Kernel multithresholdSortMerge;
+        Kernel multithresholdSIMD;
+        QuantizedKernel multithresholdQuantized;
+        // multithresholdInteger, on a table prepared once for all variants
+        IntegerKernel<int16_t> multithresholdInteger16;
+        IntegerKernel<int32_t> multithresholdInteger32;
+
+        // multithresholdSoA, multithresholdKeys and multithresholdLinearPerChannel on their prepared layouts
+        PreparedPtr<float> (*soa)(const FinnUtils::ThresholdTable& table);
+        PreparedPtr<float> (*keys)(const FinnUtils::ThresholdTable& table);
+        PreparedPtr<float> (*linearPerChannel)(const FinnUtils::ThresholdTable& table);
+        // multithreshold with a search backend
+        PreparedPtr<float> (*searchIndex)(const FinnUtils::ThresholdTable& table, IndexKind kind);
+        // lossy::GatherLookup, KeyThresholdLookup and MultiChannelLossyLookup with int8 outputs
+        PreparedPtr<float> (*gatherLookup)(std::span<const int8_t> table, float scale, float shift);
+        PreparedPtr<float> (*keyLookup)(std::span<const float> thresholds, unsigned int bits, int bias);
+        PreparedPtr<float> (*lossyLookup)(const FinnUtils::ThresholdTable& thresholds, std::size_t budgetBytes, int bias, unsigned int maxDigits);
+        // DynamicMultiThreshold<float, int8_t>, plain and packed to its bits()
+        PreparedPtr<float> (*multiThreshold)(const FinnUtils::ThresholdTable& thresholds, int bias);
+        PreparedPtr<float, uint8_t> (*multiThresholdPacked)(const FinnUtils::ThresholdTable& thresholds, int bias);
+        PreparedPtr<float> (*mvauFloat)(std::span<const float> weights, std::size_t inChannels, std::size_t outChannels, const FinnUtils::ThresholdTable& thresholds);
+        PreparedPtr<int8_t> (*mvauInt8)(std::span<const int8_t> weights, std::size_t inChannels, std::size_t outChannels, const FinnUtils::IntegerThresholdTable<int32_t>& thresholds);
+        PreparedPtr<float> (*thresholdMaxPool)(const FinnUtils::ThresholdTable& thresholds, const FinnUtils::PoolShape& shape, FinnUtils::PoolOrder order);
+        PreparedPtr<int16_t> (*thresholdMaxPool16)(const FinnUtils::IntegerThresholdTable<int16_t>& thresholds, const FinnUtils::PoolShape& shape, FinnUtils::PoolOrder order);
+        PreparedPtr<int32_t> (*thresholdMaxPool32)(const FinnUtils::IntegerThresholdTable<int32_t>& thresholds, const FinnUtils::PoolShape& shape, FinnUtils::PoolOrder order);
+        std::unique_ptr<Engine> (*engine)(std::size_t threads, bool pinned, std::size_t minRowsPerThread);
+        EpilogueFactory<float> epilogueFloat;
+        EpilogueFactory<FinnUtils::BFloat16> epilogueBFloat16;
+        EpilogueFactory<int16_t> epilogueInt16;
+    };
+
+    namespace variants {
+        const Kernels& scalar();
+        const Kernels& avx2();
+        const Kernels& avx512();
+        const Kernels& avx512vbmi();
+    }
+
+    inline const char* name(Isa isa) {
+        constexpr const char* names[] = { "scalar", "avx2", "avx512", "avx512vbmi" };
+        return names[static_cast<int>(isa)];
+    }
+
+    inline Isa parse(std::string_view text) {
+        for (Isa isa : { Isa::Scalar, Isa::AVX2, Isa::AVX512, Isa::AVX512VBMI }) {
+            if (text == name(isa)) {
+                return isa;
+            }
+        }
+        throw std::invalid_argument("Unknown kernel variant " + std::string(text));
+    }
+
+    /**
+     * Whether this cpu (and the OS, for the AVX register state) can run the variant, checks every feature of the
+     * FINN_ISA_TARGET string of its translation unit since the compiler may use any of them in any kernel
+     */
+    inline bool supported(Isa isa) {
+        __builtin_cpu_init();
+        switch (isa) {
+            case Isa::Scalar:
+                return true;
+            case Isa::AVX2:
+                return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") && __builtin_cpu_supports("bmi") && __builtin_cpu_supports("bmi2")
+                    && __builtin_cpu_supports("lzcnt") && __builtin_cpu_supports("popcnt") && __builtin_cpu_supports("f16c");
+            case Isa::AVX512:
+                return supported(Isa::AVX2) && __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512dq")
+                    && __builtin_cpu_supports("avx512vl") && __builtin_cpu_supports("avx512cd");
+            case Isa::AVX512VBMI:
+                return supported(Isa::AVX512) && __builtin_cpu_supports("avx512vbmi");
+        }
+        return false;
+    }
+
+    inline Isa widest() {
+        for (Isa isa : { Isa::AVX512VBMI, Isa::AVX512, Isa::AVX2 }) {
+            if (supported(isa)) {
+                return isa;
+            }
+        }
+        return Isa::Scalar;
+    }
+
+    /**
+     * Kernel table of one variant, throws if this cpu can not run it
+     */
+    inline const Kernels& kernels(Isa isa) {
+        if (!supported(isa)) {
+            throw std::runtime_error(std::string("Kernel variant ") + name(isa) + " is not supported by this cpu");
+        }
+        switch (isa) {
+            case Isa::Scalar:
+                return variants::scalar();
+            case Isa::AVX2:
+                return variants::avx2();
+            case Isa::AVX512:
+                return variants::avx512();
+            default:
+                return variants::avx512vbmi();
+        }
+    }
+
+    namespace detail {
+        inline std::atomic<const Kernels*>& active() {
+            static std::atomic<const Kernels*> selected{ nullptr };
+            return selected;
+        }
+    }
+
+    /**
+     * Forces a variant for all later kernels() calls, e.g. to benchmark the narrower paths on a wide machine
+     */
+    inline const Kernels& select(Isa isa) {
+        const Kernels& chosen = kernels(isa);
+        detail::active().store(&chosen, std::memory_order_release);
+        return chosen;
+    }
+
+    /**
+     * The active variant, picked on first use from FINN_DISPATCH or the cpu
+     */
+    inline const Kernels& kernels() {
+        const Kernels* chosen = detail::active().load(std::memory_order_acquire);
+        if (chosen == nullptr) {
+            const char* forced = std::getenv("FINN_DISPATCH");
+            chosen = &kernels((forced != nullptr && *forced != '\0') ? parse(forced) : widest());
+            const Kernels* expected = nullptr;
+            // a concurrent first call may have won, keep its choice
+            if (!detail::active().compare_exchange_strong(expected, chosen, std::memory_order_acq_rel)) {
+                chosen = expected;
+            }
+        }
+        return *chosen;
+    }
+}
+
+#endif // FINN_DISPATCH
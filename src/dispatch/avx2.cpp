@@ -0,0 +1,6 @@
+#define FINN_ISA avx2
+#define FINN_ISA_ENUM dispatch::Isa::AVX2
+// Keep in sync with dispatch::supported
+#define FINN_ISA_TARGET "avx2,fma,bmi,bmi2,lzcnt,popcnt,f16c"
+#define FINN_ISA_LEVEL 1
+#include "../dispatch_kernels.h"
@@ -0,0 +1,6 @@
+#define FINN_ISA avx512
+#define FINN_ISA_ENUM dispatch::Isa::AVX512
+// Keep in sync with dispatch::supported
+#define FINN_ISA_TARGET "avx512f,avx512bw,avx512dq,avx512vl,avx512cd,avx2,fma,bmi,bmi2,lzcnt,popcnt,f16c"
+#define FINN_ISA_LEVEL 2
+#include "../dispatch_kernels.h"
@@ -0,0 +1,6 @@
+#define FINN_ISA avx512vbmi
+#define FINN_ISA_ENUM dispatch::Isa::AVX512VBMI
+// Keep in sync with dispatch::supported
+#define FINN_ISA_TARGET "avx512vbmi,avx512f,avx512bw,avx512dq,avx512vl,avx512cd,avx2,fma,bmi,bmi2,lzcnt,popcnt,f16c"
+#define FINN_ISA_LEVEL 3
+#include "../dispatch_kernels.h"
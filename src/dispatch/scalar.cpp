@@ -0,0 +1,4 @@
+// Baseline x86-64 (SSE2), every SIMD path of the kernels compiled out
+#define FINN_ISA scalar
+#define FINN_ISA_ENUM dispatch::Isa::Scalar
+#include "../dispatch_kernels.h"
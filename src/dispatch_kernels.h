@@ -0,0 +1,249 @@
+/**
+ * Body of one kernel variant, included once by every file in src/dispatch/ after defining
+ * FINN_ISA: namespace of the variant, also the name of its entry in dispatch::variants
+ * FINN_ISA_ENUM: its dispatch::Isa
+ * FINN_ISA_TARGET: GCC target string of the variant, the baseline of the build if undefined
+ * FINN_ISA_LEVEL: 1 avx2, 2 avx512, 3 avx512vbmi, for the feature macros the target region implies
+ * Everything that does not depend on the instruction set is included before the target region, so inline functions
+ * of the standard library and of the shared headers are compiled for the baseline in every variant and the linker can
+ * not pick an AVX-512 copy of them for a machine without AVX-512.
+ */
+#if !defined(FINN_ISA) || !defined(FINN_ISA_ENUM)
+#error "Define FINN_ISA and FINN_ISA_ENUM before including dispatch_kernels.h"
+#endif
+
+#include <vector>
+#include <array>
+#include <span>
+#include <string>
+#include <functional>
+#include <algorithm>
+#include <numeric>
+#include <iostream>
+#include <iterator>
+#include <execution>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <utility>
+#include <type_traits>
+#include <concepts>
+#include <limits>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstddef>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <stdlib.h>
+#include <time.h>
+#include <omp.h>
+#include <immintrin.h>
+#include "thresholds.h"
+#include "threshold_table.h"
+#include "thread_pool.h"
+#include "dispatch.h"
+
+#define FINN_DISPATCH_STRING(x) #x
+#define FINN_DISPATCH_PRAGMA(x) _Pragma(FINN_DISPATCH_STRING(x))
+
+#if defined(FINN_ISA_TARGET)
+#pragma GCC push_options
+FINN_DISPATCH_PRAGMA(GCC target(FINN_ISA_TARGET))
+#endif
+
+// g++ does not define the feature macros of a target pragma in C++, but the kernels pick their paths with them
+#if FINN_ISA_LEVEL >= 1 && !defined(__AVX2__)
+#define __AVX2__ 1
+#define __FMA__ 1
+#endif
+#if FINN_ISA_LEVEL >= 2 && !defined(__AVX512F__)
+#define __AVX512F__ 1
+#define __AVX512BW__ 1
+#define __AVX512DQ__ 1
+#define __AVX512VL__ 1
+#endif
+#if FINN_ISA_LEVEL >= 3 && !defined(__AVX512VBMI__)
+#define __AVX512VBMI__ 1
+#endif
+
+#include "optimized.h"
+#include "multithreshold.h"
+#include "mvau.h"
+#include "pool.h"
+#include "epilogue.h"
+#include "lossy.hpp"
+
+// Per translation unit, every variant has its own adapters around its own kernels
+namespace {
+
+    // A prepared header kernel (state) behind dispatch::Prepared, run(state, inp, ret) and size(state, inputs)
+    template<typename In, typename Out, typename State, typename Run, typename Size>
+    class PreparedKernel final : public dispatch::Prepared<In, Out> {
+        private:
+        State state;
+        Run run;
+        Size size;
+
+        public:
+        PreparedKernel(State&& prepared, Run run, Size size) : state(std::move(prepared)), run(run), size(size) {}
+
+        std::size_t outputSize(std::size_t inputs) const override { return size(state, inputs); }
+        void operator()(std::span<const In> inp, std::span<Out> ret) const override { run(state, inp, ret); }
+    };
+
+    template<typename In, typename Out = int8_t, typename State, typename Run, typename Size>
+    dispatch::PreparedPtr<In, Out> prepare(State state, Run run, Size size) {
+        return std::make_unique<PreparedKernel<In, Out, State, Run, Size>>(std::move(state), run, size);
+    }
+
+    // One output per input
+    template<typename In, typename Out = int8_t, typename State, typename Run>
+    dispatch::PreparedPtr<In, Out> prepare(State state, Run run) {
+        return prepare<In, Out>(std::move(state), run, [](const State&, std::size_t inputs) { return inputs; });
+    }
+
+    // multithreshold of a search backend
+    const auto searchRun = [](const auto& index, std::span<const float> inp, std::span<int8_t> ret) { optimized::multithreshold(index, inp, ret); };
+    // thresholds() of a lossy lookup
+    const auto lookupRun = [](const auto& lookup, std::span<const float> inp, std::span<int8_t> ret) { lookup.thresholds(inp, ret); };
+    // operator() of a layer with its default scratch arena
+    const auto layerRun = [](const auto& layer, auto inp, std::span<int8_t> ret) { layer(inp, ret); };
+
+    class VariantEngine final : public dispatch::Engine {
+        private:
+        optimized::MultiThresholdEngine engine;
+
+        public:
+        VariantEngine(std::size_t threads, bool pinned, std::size_t minRowsPerThread) : engine(threads, pinned, minRowsPerThread) {}
+
+        std::size_t threads() const override { return engine.threads(); }
+
+        void multithresholdLinearPerTensor(std::span<const float> inp, std::span<int8_t> ret) override {
+            engine.multithresholdLinearPerTensor(inp, ret);
+        }
+
+        void multithresholdSIMD(const FinnUtils::ThresholdTable& table, std::span<const float> inp, std::span<int8_t> ret) override {
+            engine.multithresholdSIMD(table, inp, ret);
+        }
+
+        void multithresholdLEMT(const FinnUtils::ThresholdTable& table, std::span<const float> inp, std::span<int8_t> ret) override {
+            engine.multithresholdLEMT(table, inp, ret);
+        }
+    };
+
+    template<typename Out>
+    class VariantEpilogue final : public dispatch::EpilogueKernels<Out> {
+        private:
+        optimized::Epilogue<Out> epilogue;
+
+        public:
+        VariantEpilogue(std::vector<float> scale, std::vector<float> bias) : epilogue(std::move(scale), std::move(bias)) {}
+
+        void apply(std::span<const int8_t> inp, std::span<Out> ret) const override {
+            epilogue.apply(inp, ret);
+        }
+
+        void multithresholdSIMD(const FinnUtils::ThresholdTable& table, std::span<const float> inp, std::span<Out> ret) const override {
+            optimized::multithresholdSIMD(table, inp, ret, epilogue);
+        }
+
+        void multithresholdLE(const FinnUtils::ThresholdTable& table, std::span<const float> inp, std::span<Out> ret) const override {
+            optimized::multithresholdLE(table, inp, ret, epilogue);
+        }
+
+        void multithresholdLEMT(const FinnUtils::ThresholdTable& table, std::span<const float> inp, std::span<Out> ret) const override {
+            optimized::multithresholdLEMT(table, inp, ret, epilogue);
+        }
+
+        void multithresholdLinearPerTensor(const FinnUtils::ThresholdTable& table, std::span<const float> inp, std::span<Out> ret) const override {
+            optimized::multithresholdLinearPerTensor(table, inp, ret, epilogue);
+        }
+
+        static std::unique_ptr<const dispatch::EpilogueKernels<Out>> make(std::vector<float> scale, std::vector<float> bias) {
+            return std::make_unique<VariantEpilogue>(std::move(scale), std::move(bias));
+        }
+    };
+
+    template<typename T>
+    dispatch::PreparedPtr<T> thresholdMaxPool(const typename optimized::ThresholdMaxPool<T>::Table& thresholds, const FinnUtils::PoolShape& shape, FinnUtils::PoolOrder order) {
+        return prepare<T>(optimized::ThresholdMaxPool<T>(thresholds, shape, order), layerRun, [shape](const auto&, std::size_t inputs) { return inputs / shape.inputSize() * shape.outputSize(); });
+    }
+
+    template<typename T>
+    dispatch::PreparedPtr<T> mvau(std::span<const T> weights, std::size_t inChannels, std::size_t outChannels, const typename optimized::MVAU<T>::Table& thresholds) {
+        return prepare<T>(optimized::MVAU<T>(weights, inChannels, outChannels, thresholds), layerRun, [](const auto& layer, std::size_t inputs) { return inputs / layer.inputs() * layer.outputs(); });
+    }
+}
+
+const dispatch::Kernels& dispatch::variants::FINN_ISA() {
+    static const Kernels table = {
+        .isa = FINN_ISA_ENUM,
+        .name = dispatch::name(FINN_ISA_ENUM),
+        .multithreshold = [](const FinnUtils::ThresholdTable& t, std::span<const float> inp, std::span<int8_t> ret) { optimized::multithreshold(t, inp, ret); },
+        .multithresholdLE = [](const FinnUtils::ThresholdTable& t, std::span<const float> inp, std::span<int8_t> ret) { optimized::multithresholdLE(t, inp, ret); },
+        .multithresholdLEBlocked = [](const FinnUtils::ThresholdTable& t, std::span<const float> inp, std::span<int8_t> ret) { optimized::multithresholdLEBlocked(t, inp, ret); },
+        .multithresholdLEMT = [](const FinnUtils::ThresholdTable& t, std::span<const float> inp, std::span<int8_t> ret) { optimized::multithresholdLEMT(t, inp, ret); },
+        .multithresholdLEMTTiled = [](const FinnUtils::ThresholdTable& t, std::span<const float> inp, std::span<int8_t> ret) { optimized::multithresholdLEMTTiled(t, inp, ret); },
+        .multithresholdLinearPerTensor = [](const FinnUtils::ThresholdTable& t, std::span<const float> inp, std::span<int8_t> ret) { optimized::multithresholdLinearPerTensor(t, inp, ret); },
+        .multithresholdSortMerge = [](const FinnUtils::ThresholdTable& t, std::span<const float> inp, std::span<int8_t> ret) { optimized::multithresholdSortMerge(t, inp, ret); },
+        .multithresholdSIMD = [](const FinnUtils::ThresholdTable& t, std::span<const float> inp, std::span<int8_t> ret) { optimized::multithresholdSIMD(t, inp, ret); },
+        .multithresholdQuantized = [](const FinnUtils::QuantizedTable& t, std::span<const int8_t> inp, std::span<int8_t> ret) { optimized::multithresholdQuantized(t, inp, ret); },
+        .multithresholdInteger16 = [](const FinnUtils::IntegerInterleavedTable<int16_t>& t, std::span<const int16_t> inp, std::span<int8_t> ret) { optimized::multithresholdInteger(t, inp, ret); },
+        .multithresholdInteger32 = [](const FinnUtils::IntegerInterleavedTable<int32_t>& t, std::span<const int32_t> inp, std::span<int8_t> ret) { optimized::multithresholdInteger(t, inp, ret); },
+        .soa = [](const FinnUtils::ThresholdTable& t) {
+            return prepare<float>(optimized::InterleavedTable(t), [](const auto& table, std::span<const float> inp, std::span<int8_t> ret) { optimized::multithresholdSoA(table, inp, ret); });
+        },
+        .keys = [](const FinnUtils::ThresholdTable& t) {
+            return prepare<float>(optimized::KeyTable(t), [](const auto& table, std::span<const float> inp, std::span<int8_t> ret) { optimized::multithresholdKeys(table, inp, ret); });
+        },
+        .linearPerChannel = [](const FinnUtils::ThresholdTable& t) {
+            return prepare<float>(optimized::LinearChannelTable(t), [](const auto& table, std::span<const float> inp, std::span<int8_t> ret) { optimized::multithresholdLinearPerChannel(table, inp, ret); });
+        },
+        .searchIndex = [](const FinnUtils::ThresholdTable& t, dispatch::IndexKind kind) {
+            switch (kind) {
+                case dispatch::IndexKind::Sorted:
+                    return prepare<float>(optimized::SortedIndex(t), searchRun);
+                case dispatch::IndexKind::Threshold:
+                    return prepare<float>(optimized::ThresholdIndex(t), searchRun);
+                case dispatch::IndexKind::Scan:
+                    return prepare<float>(optimized::ScanIndex(t), searchRun);
+                case dispatch::IndexKind::Linear:
+                    return prepare<float>(optimized::LinearIndex(t), searchRun);
+                case dispatch::IndexKind::Radix:
+                    return prepare<float>(optimized::RadixIndex(t), searchRun);
+                default:
+                    return prepare<float>(optimized::AutoIndex(t), searchRun);
+            }
+        },
+        .gatherLookup = [](std::span<const int8_t> t, float scale, float shift) { return prepare<float>(lossy::GatherLookup<int8_t>(t, scale, shift), lookupRun); },
+        .keyLookup = [](std::span<const float> t, unsigned int bits, int bias) { return prepare<float>(lossy::KeyThresholdLookup<int8_t>(t, bits, bias), lookupRun); },
+        .lossyLookup = [](const FinnUtils::ThresholdTable& t, std::size_t budgetBytes, int bias, unsigned int maxDigits) {
+            return prepare<float>(lossy::MultiChannelLossyLookup<int8_t>(t, budgetBytes, bias, maxDigits), lookupRun);
+        },
+        .multiThreshold = [](const FinnUtils::ThresholdTable& t, int bias) { return prepare<float>(optimized::DynamicMultiThreshold<float>(t, bias), layerRun); },
+        .multiThresholdPacked = [](const FinnUtils::ThresholdTable& t, int bias) {
+            return prepare<float, uint8_t>(optimized::DynamicMultiThreshold<float>(t, bias), [](const auto& engine, std::span<const float> inp, std::span<uint8_t> ret) { engine.packed(inp, ret); },
+                [](const auto& engine, std::size_t inputs) { return optimized::detail::packedSize(inputs, engine.bits()); });
+        },
+        .mvauFloat = mvau<float>,
+        .mvauInt8 = mvau<int8_t>,
+        .thresholdMaxPool = thresholdMaxPool<float>,
+        .thresholdMaxPool16 = thresholdMaxPool<int16_t>,
+        .thresholdMaxPool32 = thresholdMaxPool<int32_t>,
+        .engine = [](std::size_t threads, bool pinned, std::size_t minRowsPerThread) -> std::unique_ptr<dispatch::Engine> { return std::make_unique<VariantEngine>(threads, pinned, minRowsPerThread); },
+        .epilogueFloat = VariantEpilogue<float>::make,
+        .epilogueBFloat16 = VariantEpilogue<FinnUtils::BFloat16>::make,
+        .epilogueInt16 = VariantEpilogue<int16_t>::make,
+    };
+    return table;
+}
+
+#if defined(FINN_ISA_TARGET)
+#pragma GCC pop_options
+#endif
@@ -0,0 +1,273 @@
+#ifndef EPILOGUE_KERNELS
+#define EPILOGUE_KERNELS
+
+#include <vector>
+#include <span>
+#include <string>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <cmath>
+#include <bit>
+#include <type_traits>
+#include <stdexcept>
+#include <algorithm>
+#include <immintrin.h>
+#include "threshold_table.h"
+#include "optimized.h"
+#include "utils.h"
+
+namespace optimized::inline FINN_ISA {
+
+    /**
+     * FINN MultiThreshold's out_scale and out_bias applied to the threshold count: out = scale * count + bias, per
+     * tensor or per channel (channel = flat index % channels). The int8 kernels are the case scale 1, bias -128.
+     * float outputs are one fused multiply-add of the count, BFloat16 rounds that float to nearest even and int16
+     * rounds it to nearest even and saturates (NaN gives -32768).
+     * The count kernels (multithresholdSIMD, LE, LEMT, LinearPerTensor and the lossy lookups) hand their counts to
+     * sink() while they are still in registers, every other int8 kernel runs through fused(), which converts its
+     * output block by block while the block is in L1.
+     */
+    template<typename Out>
+    class Epilogue {
+        static_assert(std::is_same_v<Out, float> || std::is_same_v<Out, FinnUtils::BFloat16> || std::is_same_v<Out, int16_t>, "Epilogue emits float, BFloat16 or int16_t");
+
+        private:
+        static constexpr size_t lanes = 16;
+        // Output bytes converted per kernel call of fused()
+        static constexpr size_t blockBytes = 16 * 1024;
+
+        std::vector<float> scales;
+        std::vector<float> biases;
+        // scales and biases repeated for lanes more elements, loaded unaligned at flat index % channels
+        std::vector<float> scaleLanes;
+        std::vector<float> biasLanes;
+
+        // Own arena, the kernels run by fused() use the thread arena themselves
+        static FinnUtils::ScratchArena& blockScratch() {
+            thread_local FinnUtils::ScratchArena arena;
+            return arena;
+        }
+
+        static Out convert(float value) {
+            if constexpr (std::is_same_v<Out, float>) {
+                return value;
+            }
+            else if constexpr (std::is_same_v<Out, FinnUtils::BFloat16>) {
+                return FinnUtils::BFloat16::fromFloat(value);
+            }
+            else {
+                const float low = value > -32768.0f ? value : -32768.0f;
+                return static_cast<int16_t>(std::nearbyint(std::min(low, 32767.0f)));
+            }
+        }
+
+        public:
+        Epilogue(float scale, float bias) : Epilogue(std::vector<float>{ scale }, std::vector<float>{ bias }) {}
+
+        Epilogue(std::vector<float> scale, std::vector<float> bias) : scales(std::move(scale)), biases(std::move(bias)) {
+            if (scales.empty() || scales.size() != biases.size()) {
+                throw std::invalid_argument("Expected as many scales as biases, got " + std::to_string(scales.size()) + " and " + std::to_string(biases.size()));
+            }
+            scaleLanes.resize(scales.size() + lanes);
+            biasLanes.resize(scales.size() + lanes);
+            for (size_t k = 0; k < scaleLanes.size(); ++k) {
+                scaleLanes[k] = scales[k % scales.size()];
+                biasLanes[k] = biases[k % scales.size()];
+            }
+        }
+
+        // 1 for a per tensor epilogue
+        size_t channels() const { return scales.size(); }
+
+        Out operator()(int count, size_t channel) const {
+            return convert(std::fma(scales[channel], static_cast<float>(count), biases[channel]));
+        }
+
+#if defined(__AVX512F__)
+        // Stores the outputs of 16 counts of the elements from flat index i on
+        void store(__m512i counts, size_t i, Out* ret) const {
+            const size_t c = i % channels();
+            const __m512 value = _mm512_fmadd_ps(_mm512_loadu_ps(scaleLanes.data() + c), _mm512_cvtepi32_ps(counts), _mm512_loadu_ps(biasLanes.data() + c));
+            if constexpr (std::is_same_v<Out, float>) {
+                _mm512_storeu_ps(ret, value);
+            }
+            else if constexpr (std::is_same_v<Out, FinnUtils::BFloat16>) {
+                const __m512i word = _mm512_castps_si512(value);
+                const __m512i rounded = _mm512_srli_epi32(_mm512_add_epi32(word, _mm512_add_epi32(_mm512_set1_epi32(0x7fff), _mm512_and_si512(_mm512_srli_epi32(word, 16), _mm512_set1_epi32(1)))), 16);
+                const __m512i quiet = _mm512_or_si512(_mm512_srli_epi32(word, 16), _mm512_set1_epi32(0x40));
+                const __m512i bits = _mm512_mask_blend_epi32(_mm512_cmp_ps_mask(value, value, _CMP_UNORD_Q), rounded, quiet);
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(ret), _mm512_cvtepi32_epi16(bits));
+            }
+            else {
+                const __m512 clamped = _mm512_min_ps(_mm512_max_ps(value, _mm512_set1_ps(-32768.0f)), _mm512_set1_ps(32767.0f));
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(ret), _mm512_cvtsepi32_epi16(_mm512_cvtps_epi32(clamped)));
+            }
+        }
+#endif
+#if defined(__AVX2__) && defined(__FMA__)
+        // Stores the outputs of 8 counts of the elements from flat index i on
+        void store(__m256i counts, size_t i, Out* ret) const {
+            const size_t c = i % channels();
+            const __m256 value = _mm256_fmadd_ps(_mm256_loadu_ps(scaleLanes.data() + c), _mm256_cvtepi32_ps(counts), _mm256_loadu_ps(biasLanes.data() + c));
+            if constexpr (std::is_same_v<Out, float>) {
+                _mm256_storeu_ps(ret, value);
+            }
+            else if constexpr (std::is_same_v<Out, FinnUtils::BFloat16>) {
+                const __m256i word = _mm256_castps_si256(value);
+                const __m256i rounded = _mm256_srli_epi32(_mm256_add_epi32(word, _mm256_add_epi32(_mm256_set1_epi32(0x7fff), _mm256_and_si256(_mm256_srli_epi32(word, 16), _mm256_set1_epi32(1)))), 16);
+                const __m256i quiet = _mm256_or_si256(_mm256_srli_epi32(word, 16), _mm256_set1_epi32(0x40));
+                const __m256i bits = _mm256_blendv_epi8(rounded, quiet, _mm256_castps_si256(_mm256_cmp_ps(value, value, _CMP_UNORD_Q)));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(ret), _mm_packus_epi32(_mm256_castsi256_si128(bits), _mm256_extracti128_si256(bits, 1)));
+            }
+            else {
+                const __m256 clamped = _mm256_min_ps(_mm256_max_ps(value, _mm256_set1_ps(-32768.0f)), _mm256_set1_ps(32767.0f));
+                const __m256i words = _mm256_cvtps_epi32(clamped);
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(ret), _mm_packs_epi32(_mm256_castsi256_si128(words), _mm256_extracti128_si256(words, 1)));
+            }
+        }
+#endif
+
+        /**
+         * Callback for the count kernels storing the outputs of count + offset at flat index i of ret, offset 128 turns
+         * int8 kernel outputs back into counts. Takes the __m512i / __m256i counts of the vector paths or an int.
+         */
+        auto sink(std::span<Out> ret, int offset = 0) const {
+            return [this, ret, offset](size_t i, auto counts) {
+                if constexpr (std::is_same_v<decltype(counts), int>) {
+                    ret[i] = (*this)(counts + offset, channels() == 1 ? 0 : i % channels());
+                }
+#if defined(__AVX512F__)
+                else if constexpr (sizeof(counts) == 64) {
+                    store(_mm512_add_epi32(counts, _mm512_set1_epi32(offset)), i, ret.data() + i);
+                }
+#endif
+#if defined(__AVX2__) && defined(__FMA__)
+                else if constexpr (sizeof(counts) == 32) {
+                    store(_mm256_add_epi32(counts, _mm256_set1_epi32(offset)), i, ret.data() + i);
+                }
+#endif
+                else {
+                    // AVX2 without FMA, the lanes go through the scalar epilogue to keep the single rounding
+                    alignas(32) int lanes[sizeof(counts) / sizeof(int)];
+                    std::memcpy(lanes, &counts, sizeof(counts));
+                    for (size_t lane = 0; lane < std::size(lanes); ++lane) {
+                        ret[i + lane] = (*this)(lanes[lane] + offset, (i + lane) % channels());
+                    }
+                }
+            };
+        }
+
+        /**
+         * Converts int8 kernel outputs (count - 128) whose first element has flat index first
+         */
+        void apply(std::span<const int8_t> inp, std::span<Out> ret, size_t first = 0) const {
+            ret = FinnUtils::outputFor(inp, ret);
+            const size_t size = inp.size();
+            size_t i = 0;
+#if defined(__AVX512F__)
+            for (; i + 16 <= size; i += 16) {
+                const __m512i counts = _mm512_add_epi32(_mm512_cvtepi8_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(inp.data() + i))), _mm512_set1_epi32(128));
+                store(counts, first + i, ret.data() + i);
+            }
+#endif
+#if defined(__AVX2__) && defined(__FMA__)
+            for (; i + 8 <= size; i += 8) {
+                const __m256i counts = _mm256_add_epi32(_mm256_cvtepi8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(inp.data() + i))), _mm256_set1_epi32(128));
+                store(counts, first + i, ret.data() + i);
+            }
+#endif
+            for (; i < size; ++i) {
+                ret[i] = (*this)(inp[i] + 128, (first + i) % channels());
+            }
+        }
+
+        std::vector<Out> apply(const std::vector<int8_t>& inp) const {
+            std::vector<Out> ret(inp.size());
+            apply(std::span<const int8_t>(inp), std::span<Out>(ret));
+            return ret;
+        }
+
+        /**
+         * Runs kernel(inp block, int8 block) over blocks of whole rows of rowLength elements and converts every block
+         * right after the kernel wrote it. blockRows = 0 sizes the blocks for L1, multi-threaded kernels want larger
+         * blocks.
+         */
+        template<typename In, typename Kernel>
+        void fused(Kernel&& kernel, std::span<const In> inp, std::span<Out> ret, size_t rowLength, size_t blockRows = 0) const {
+            ret = FinnUtils::outputFor(inp, ret);
+            if (rowLength == 0 || inp.size() % rowLength != 0) {
+                throw std::invalid_argument("Input of " + std::to_string(inp.size()) + " elements is not a batch of " + std::to_string(rowLength) + " element rows");
+            }
+            if (blockRows == 0) {
+                blockRows = std::max<size_t>(blockBytes / (rowLength * sizeof(Out)), 1);
+            }
+            const size_t block = blockRows * rowLength;
+            const std::span<int8_t> activations = blockScratch().get<int8_t>(std::min(block, inp.size()));
+            for (size_t i = 0; i < inp.size(); i += block) {
+                const size_t n = std::min(block, inp.size() - i);
+                kernel(inp.subspan(i, n), activations.first(n));
+                apply(activations.first(n), ret.subspan(i, n), i);
+            }
+        }
+    };
+
+    /**
+     * multithresholdSIMD with the epilogue applied to the counts in registers
+     */
+    template<typename Out>
+    void multithresholdSIMD(const FinnUtils::ThresholdTable& table, std::span<const float> inp, std::span<Out> ret, const Epilogue<Out>& epilogue) {
+        ret = FinnUtils::outputFor(inp, ret);
+        multithresholdSIMDCounts(table, inp, epilogue.sink(ret));
+    }
+
+    template<typename Out>
+    std::vector<Out> multithresholdSIMD(const FinnUtils::ThresholdTable& table, const std::vector<float>& inp, const Epilogue<Out>& epilogue) {
+        std::vector<Out> ret(inp.size());
+        multithresholdSIMD(table, std::span<const float>(inp), std::span<Out>(ret), epilogue);
+        return ret;
+    }
+
+    // Elements past the last full row count zero thresholds, as in the int8 kernels
+    template<typename Out>
+    void fillPartialRow(const FinnUtils::ThresholdTable& table, std::span<Out> ret, const Epilogue<Out>& epilogue) {
+        for (size_t i = ret.size() / table.channels() * table.channels(); i < ret.size(); ++i) {
+            ret[i] = epilogue(0, i % epilogue.channels());
+        }
+    }
+
+    /**
+     * multithresholdLE, multithresholdLEMT and multithresholdLinearPerTensor with the epilogue applied to their counts
+     */
+    template<typename Out>
+    void multithresholdLE(const FinnUtils::ThresholdTable& table, std::span<const float> inp, std::span<Out> ret, const Epilogue<Out>& epilogue, LESearch search = LESearch::Binary) {
+        ret = FinnUtils::outputFor(inp, ret);
+        multithresholdLECounts(table, inp, epilogue.sink(ret), search);
+        fillPartialRow(table, ret, epilogue);
+    }
+
+    template<typename Out>
+    void multithresholdLEMT(const FinnUtils::ThresholdTable& table, std::span<const float> inp, std::span<Out> ret, const Epilogue<Out>& epilogue, LESearch search = LESearch::Binary) {
+        ret = FinnUtils::outputFor(inp, ret);
+        multithresholdLEMTCounts(table, inp, epilogue.sink(ret), search);
+        fillPartialRow(table, ret, epilogue);
+    }
+
+    template<typename Out>
+    void multithresholdLinearPerTensor(const FinnUtils::ThresholdTable& table, std::span<const float> inp, std::span<Out> ret, const Epilogue<Out>& epilogue) {
+        ret = FinnUtils::outputFor(inp, ret);
+        multithresholdLinearPerTensorCounts(table, inp, epilogue.sink(ret));
+    }
+
+    /**
+     * A lossy lookup with int8 outputs (bias -128, lossy::GatherLookup, KeyThresholdLookup, MultiChannelLossyLookup)
+     * with the epilogue applied to the looked up values in registers
+     */
+    template<typename Lookup, typename Out>
+    void lookupThresholds(const Lookup& lookup, std::span<const float> inp, std::span<Out> ret, const Epilogue<Out>& epilogue) {
+        ret = FinnUtils::outputFor(inp, ret);
+        lookup.values(inp, epilogue.sink(ret, 128));
+    }
+}
+
+#endif // EPILOGUE_KERNELS
@@ -9,6 +9,12 @@
 #include <chrono>
 #include <vector>
 #include <time.h>
+#include <span>
+#include <stdexcept>
+#include <cstdint>
+#include <immintrin.h>
+#include "utils.h"
+#include "threshold_table.h"
 
 /**
  * In this namespace the template parameters usually mean the follwing:
@@ -19,7 +25,7 @@
  * Shift: How much all values need to be shifted (as large integers), if the lower bound is a negative number. (E.g. -3.0 becomes -30, then Shift needs to be 30 so index 0 comes out)
  * TableSize: The max size of the resulting lookup table. Can be calculated by _get_max_scale()
  */
-namespace lossy {
+namespace lossy::inline FINN_ISA {
     template<typename T, typename F, unsigned int Scale>
     constexpr unsigned int _lookup_index(F value, const unsigned int shift) {
         return static_cast<T>(value * Scale + shift);
@@ -100,7 +106,12 @@ namespace lossy {
 
         public:
         LossyThresholdLookup() {}
-        LossyThresholdLookup(const std::array<F, N> &thresholds, unsigned int precision_digits) {
+        LossyThresholdLookup(const std::array<F, N> &thresholds, unsigned int precision_digits) : LossyThresholdLookup(std::span<const F>(thresholds), precision_digits) {}
+
+        /**
+         * Build from any contiguous range, e.g. one channel of a runtime FinnUtils::ThresholdTable
+         */
+        LossyThresholdLookup(std::span<const F> thresholds, unsigned int precision_digits) {
             min = *std::min_element(thresholds.begin(), thresholds.end());            
             max = *std::max_element(thresholds.begin(), thresholds.end());            
             scale = static_cast<unsigned int>(std::pow(10, precision_digits));
@@ -149,9 +160,511 @@ namespace lossy {
 
         void thresholds(std::vector<F> &inputs, std::vector<T> &out) {
             if (out.size() < inputs.size()) {
-                out.reserve(inputs.size());
+                out.resize(inputs.size());
+            }
+            std::transform(std::execution::par_unseq, inputs.begin(), inputs.end(), out.begin(), [this](F i){return threshold(i);});
+        }
+
+        /**
+         * Allocation free variant, out must hold at least inputs.size() elements
+         */
+        void thresholds(std::span<const F> inputs, std::span<T> out) {
+            if (out.size() < inputs.size()) {
+                throw std::invalid_argument("Output buffer too small for the inputs");
             }
             std::transform(std::execution::par_unseq, inputs.begin(), inputs.end(), out.begin(), [this](F i){return threshold(i);});
         }
     };
+
+    /**
+     * Deployable form of the scaled lookup (table[input * Scale + Shift], e.g. a table from _create_lookup_table). The
+     * index is computed for 16 (AVX-512) or 8 (AVX2) inputs at a time and clamped to the table without branches, then
+     * all results are fetched with one gather from a copy of the table widened to 32 bit. One byte tables of up to 64
+     * entries are held in a register and permuted with vpermb instead when AVX512VBMI is available.
+     * Inputs below the table (and NaN) get the first entry, inputs above it the last one, like lossy_constexpr_lookup.
+     */
+    template<typename T>
+    class GatherLookup {
+        // the table is gathered as int32 and narrowed to T, only integer tables of up to 4 bytes survive that
+        static_assert(std::is_integral_v<T> && sizeof(T) <= 4, "GatherLookup needs an integral T of at most 4 bytes");
+
+        private:
+        FinnUtils::AlignedVector<int32_t> widened;
+        FinnUtils::AlignedVector<T> narrow;
+        float scale;
+        float shift;
+        float last;
+
+        public:
+        GatherLookup(std::span<const T> table, float scale, float shift) : widened(table.begin(), table.end()), narrow(std::max<std::size_t>(table.size(), 64 / sizeof(T))), scale(scale), shift(shift), last(static_cast<float>(table.size() - 1)) {
+            if (table.empty()) {
+                throw std::invalid_argument("GatherLookup needs a non-empty table");
+            }
+            std::copy(table.begin(), table.end(), narrow.begin());
+        }
+
+        std::size_t size() const { return widened.size(); }
+
+        T threshold(float input) const {
+            // std::max(0, NaN) is 0, the clamp happens before the conversion so it can not overflow
+            return static_cast<T>(widened[static_cast<std::size_t>(std::min(std::max(0.0f, std::fma(input, scale, shift)), last))]);
+        }
+
+        void thresholds(std::span<const float> inputs, std::span<T> out) const {
+            if (out.size() < inputs.size()) {
+                throw std::invalid_argument("Output buffer too small for the inputs");
+            }
+            std::size_t i = 0;
+#if defined(__AVX512F__)
+            const __m512 scales = _mm512_set1_ps(scale);
+            const __m512 shifts = _mm512_set1_ps(shift);
+            const __m512 lasts = _mm512_set1_ps(last);
+            const __m512 zero = _mm512_setzero_ps();
+            // max_ps returns the second operand for NaN
+            auto indices = [&](const float* x) { return _mm512_cvttps_epi32(_mm512_min_ps(_mm512_max_ps(_mm512_fmadd_ps(_mm512_loadu_ps(x), scales, shifts), zero), lasts)); };
+#if defined(__AVX512VBMI__)
+            if constexpr (sizeof(T) == 1) {
+                if (widened.size() <= 64) {
+                    const __m512i values = _mm512_loadu_si512(narrow.data());
+                    for (; i + 16 <= inputs.size(); i += 16) {
+                        const __m512i bytes = _mm512_castsi128_si512(_mm512_cvtepi32_epi8(indices(inputs.data() + i)));
+                        _mm_storeu_si128(reinterpret_cast<__m128i*>(out.data() + i), _mm512_castsi512_si128(_mm512_permutexvar_epi8(bytes, values)));
+                    }
+                }
+            }
+#endif
+            for (; i + 16 <= inputs.size(); i += 16) {
+                const __m512i values = _mm512_i32gather_epi32(indices(inputs.data() + i), widened.data(), 4);
+                if constexpr (sizeof(T) == 1) {
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(out.data() + i), _mm512_cvtepi32_epi8(values));
+                }
+                else if constexpr (sizeof(T) == 2) {
+                    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out.data() + i), _mm512_cvtepi32_epi16(values));
+                }
+                else {
+                    _mm512_storeu_si512(out.data() + i, values);
+                }
+            }
+#elif defined(__AVX2__) && defined(__FMA__)
+            const __m256 scales = _mm256_set1_ps(scale);
+            const __m256 shifts = _mm256_set1_ps(shift);
+            const __m256 lasts = _mm256_set1_ps(last);
+            const __m256 zero = _mm256_setzero_ps();
+            for (; i + 8 <= inputs.size(); i += 8) {
+                // max_ps returns the second operand for NaN
+                const __m256i index = _mm256_cvttps_epi32(_mm256_min_ps(_mm256_max_ps(_mm256_fmadd_ps(_mm256_loadu_ps(inputs.data() + i), scales, shifts), zero), lasts));
+                const __m256i values = _mm256_i32gather_epi32(widened.data(), index, 4);
+                if constexpr (sizeof(T) == 1) {
+                    const __m256i low = _mm256_and_si256(values, _mm256_set1_epi32(0xFF));
+                    const __m128i words = _mm_packus_epi32(_mm256_castsi256_si128(low), _mm256_extracti128_si256(low, 1));
+                    _mm_storel_epi64(reinterpret_cast<__m128i*>(out.data() + i), _mm_packus_epi16(words, words));
+                }
+                else if constexpr (sizeof(T) == 2) {
+                    const __m256i low = _mm256_and_si256(values, _mm256_set1_epi32(0xFFFF));
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(out.data() + i), _mm_packus_epi32(_mm256_castsi256_si128(low), _mm256_extracti128_si256(low, 1)));
+                }
+                else {
+                    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out.data() + i), values);
+                }
+            }
+#endif
+            for (; i < inputs.size(); ++i) {
+                out[i] = threshold(inputs[i]);
+            }
+        }
+
+        std::vector<T> thresholds(const std::vector<float>& inputs) const {
+            std::vector<T> ret(inputs.size());
+            thresholds(inputs, ret);
+            return ret;
+        }
+
+        /**
+         * The looked up values as int32, handed to emit(i, values) like optimized::multithresholdSIMDCounts: an __m512i
+         * of 16 or an __m256i of 8 values starting at inputs[i], or an int for the scalar tail
+         */
+        template<typename Emit>
+        void values(std::span<const float> inputs, Emit&& emit) const {
+            std::size_t i = 0;
+#if defined(__AVX512F__)
+            for (; i + 16 <= inputs.size(); i += 16) {
+                const __m512i index = _mm512_cvttps_epi32(_mm512_min_ps(_mm512_max_ps(_mm512_fmadd_ps(_mm512_loadu_ps(inputs.data() + i), _mm512_set1_ps(scale), _mm512_set1_ps(shift)), _mm512_setzero_ps()), _mm512_set1_ps(last)));
+                emit(i, _mm512_i32gather_epi32(index, widened.data(), 4));
+            }
+#elif defined(__AVX2__) && defined(__FMA__)
+            for (; i + 8 <= inputs.size(); i += 8) {
+                const __m256i index = _mm256_cvttps_epi32(_mm256_min_ps(_mm256_max_ps(_mm256_fmadd_ps(_mm256_loadu_ps(inputs.data() + i), _mm256_set1_ps(scale), _mm256_set1_ps(shift)), _mm256_setzero_ps()), _mm256_set1_ps(last)));
+                emit(i, _mm256_i32gather_epi32(widened.data(), index, 4));
+            }
+#endif
+            for (; i < inputs.size(); ++i) {
+                emit(i, static_cast<int>(threshold(inputs[i])));
+            }
+        }
+    };
+
+    /**
+     * Lossy lookup for a whole FinnUtils::ThresholdTable, one table per distinct channel (identical channels share one).
+     * The precision of every table is 10^digits slots per unit like LossyThresholdLookup, but chosen per table under a
+     * global memory budget: all tables start at 0 digits and the table with the largest error gets one more digit
+     * while the total still fits. Slot s >= 1 covers [origin + (s - 1) / scale, origin + s / scale) and holds bias plus
+     * the number of thresholds below it, slot 0 (inputs below the first threshold and NaN) and the last slot (inputs
+     * past the last threshold) are exact. The result is never above the exact one and at most maxError(channel) below.
+     * Instead of a budget the tables can also be sized for an accuracy target on a calibration sample, see Scaling.
+     */
+    template<typename T = int8_t>
+    class MultiChannelLossyLookup {
+        private:
+        struct Table {
+            float origin;
+            float scale;
+            std::size_t maxError;
+            std::vector<T> values;
+        };
+
+        // what a lookup needs of a channel, the values of all tables are packed into one buffer
+        struct View {
+            float origin;
+            float scale;
+            float last;
+            std::size_t offset;
+        };
+
+        std::size_t channelCount;
+        std::vector<std::size_t> channelTable;
+        std::vector<Table> tables;
+        std::vector<View> views;
+        std::vector<T> storage;
+
+        static float slot(float input, float origin, float scale, float last) {
+            const float f = std::floor((input - origin) * scale) + 1.0f;
+            // std::max(0, NaN) is 0, so NaN ends up in slot 0
+            return std::min(std::max(0.0f, f), last);
+        }
+
+        static std::size_t slots(std::span<const float> thresholds, float scale) {
+            return static_cast<std::size_t>(std::floor((thresholds.back() - thresholds.front()) * scale) + 1.0f) + 2;
+        }
+
+        static Table build(std::span<const float> thresholds, float scale, int bias) {
+            Table t{ thresholds.front(), scale, 0, {} };
+            const std::size_t size = slots(thresholds, scale);
+            t.values = std::vector<T>(size);
+            std::vector<std::size_t> inSlot(size, 0);
+            for (auto&& threshold : thresholds) {
+                ++inSlot[static_cast<std::size_t>(slot(threshold, t.origin, t.scale, static_cast<float>(size - 1)))];
+            }
+            std::size_t below = 0;
+            for (std::size_t s = 0; s < size; ++s) {
+                t.values[s] = static_cast<T>(static_cast<int>(below) + bias);
+                t.maxError = std::max(t.maxError, inSlot[s]);
+                below += inSlot[s];
+            }
+            return t;
+        }
+
+        // Maps every channel to the first channel with the same thresholds, returns the first channel of every table
+        std::vector<std::size_t> share(const FinnUtils::ThresholdTable& thresholds) {
+            std::vector<std::size_t> firstChannel;
+            for (std::size_t c = 0; c < channelCount; ++c) {
+                const auto match = std::find_if(firstChannel.begin(), firstChannel.end(), [&](std::size_t other) {
+                    return std::ranges::equal(thresholds.channel(c), thresholds.channel(other));
+                });
+                channelTable[c] = std::distance(firstChannel.begin(), match);
+                if (match == firstChannel.end()) {
+                    firstChannel.push_back(c);
+                }
+            }
+            return firstChannel;
+        }
+
+        void pack() {
+            std::vector<std::size_t> offsets;
+            for (auto&& t : tables) {
+                offsets.push_back(storage.size());
+                storage.insert(storage.end(), t.values.begin(), t.values.end());
+            }
+            for (std::size_t c = 0; c < channelCount; ++c) {
+                const Table& t = tables[channelTable[c]];
+                views.push_back({ t.origin, t.scale, static_cast<float>(t.values.size() - 1), offsets[channelTable[c]] });
+            }
+        }
+
+        public:
+        /**
+         * Decimal scales are 10^digits like LossyThresholdLookup. Binary scales are powers of two, the multiplication
+         * by them is exact, so every slot boundary is exactly origin + s / scale and they grow in finer steps.
+         */
+        enum class Scaling { Decimal, Binary };
+
+        /**
+         * budgetBytes: Upper bound for all tables together, e.g. the L2 size
+         * bias: Added to every count (-128 gives the output of the optimized kernels)
+         * maxDigits: Upper bound for the precision of a single table
+         */
+        MultiChannelLossyLookup(const FinnUtils::ThresholdTable& thresholds, std::size_t budgetBytes = 1 << 20, int bias = -128, unsigned int maxDigits = 6) : channelCount(thresholds.channels()), channelTable(thresholds.channels()) {
+            const std::vector<std::size_t> firstChannel = share(thresholds);
+            for (auto&& c : firstChannel) {
+                tables.push_back(build(thresholds.channel(c), 1.0f, bias));
+            }
+            if (bytes() > budgetBytes) {
+                throw std::invalid_argument("Memory budget too small for the lossy tables");
+            }
+            const float maxScale = static_cast<float>(std::pow(10, maxDigits));
+            // an error of one threshold per slot is the floor, a threshold always splits its slot
+            while (true) {
+                std::size_t best = tables.size();
+                for (std::size_t i = 0; i < tables.size(); ++i) {
+                    const std::size_t grown = slots(thresholds.channel(firstChannel[i]), tables[i].scale * 10.0f) * sizeof(T);
+                    if (tables[i].scale < maxScale && tables[i].maxError > 1 && (best == tables.size() || tables[i].maxError > tables[best].maxError)
+                        && bytes() - tables[i].values.size() * sizeof(T) + grown <= budgetBytes) {
+                        best = i;
+                    }
+                }
+                if (best == tables.size()) {
+                    break;
+                }
+                tables[best] = build(thresholds.channel(firstChannel[best]), tables[best].scale * 10.0f, bias);
+            }
+            pack();
+        }
+
+        /**
+         * Picks the smallest scale per table whose lookup differs from the exact count on at most maxMismatchRate of
+         * the sample values of its channels. With a zero target the search starts at the first scale whose slots are
+         * narrower than the smallest gap between two thresholds: coarser tables are wrong between two thresholds in
+         * one slot, whether or not the sample happens to hit that.
+         * sample: Channel-minor calibration rows like the inputs of thresholds()
+         * budgetBytes: Throws if the tables meeting the target do not fit
+         */
+        MultiChannelLossyLookup(const FinnUtils::ThresholdTable& thresholds, std::span<const float> sample, double maxMismatchRate, Scaling scaling = Scaling::Binary, std::size_t budgetBytes = 1 << 20, int bias = -128) : channelCount(thresholds.channels()), channelTable(thresholds.channels()) {
+            const std::vector<std::size_t> firstChannel = share(thresholds);
+            const float step = (scaling == Scaling::Binary) ? 2.0f : 10.0f;
+            std::size_t used = 0;
+            for (std::size_t i = 0; i < firstChannel.size(); ++i) {
+                const auto channel = thresholds.channel(firstChannel[i]);
+                std::vector<float> values;
+                for (std::size_t c = 0; c < channelCount; ++c) {
+                    if (channelTable[c] != i) {
+                        continue;
+                    }
+                    for (std::size_t row = 0; row < sample.size() / channelCount; ++row) {
+                        values.push_back(sample[row * channelCount + c]);
+                    }
+                }
+                std::vector<T> exact(values.size());
+                std::transform(values.begin(), values.end(), exact.begin(), [&](float x) {
+                    return static_cast<T>(static_cast<int>(std::distance(channel.begin(), std::lower_bound(channel.begin(), channel.end(), x))) + bias);
+                });
+                const auto allowed = static_cast<std::size_t>(maxMismatchRate * static_cast<double>(values.size()));
+                float gap = std::numeric_limits<float>::infinity();
+                for (std::size_t k = 1; k < channel.size(); ++k) {
+                    gap = std::min(gap, channel[k] - channel[k - 1]);
+                }
+                const float coarsest = (maxMismatchRate > 0.0 || !(gap > 0.0f)) ? 1.0f / std::max(channel.back() - channel.front(), std::numeric_limits<float>::min()) : 1.0f / gap;
+                float scale = std::pow(step, std::ceil(std::log(coarsest) / std::log(step)));
+                while (true) {
+                    // the first check keeps the slot count from overflowing
+                    if (!((channel.back() - channel.front()) * scale < static_cast<float>(budgetBytes)) || used + slots(channel, scale) * sizeof(T) > budgetBytes) {
+                        throw std::invalid_argument("No lossy table within the memory budget meets the accuracy target");
+                    }
+                    Table t = build(channel, scale, bias);
+                    std::size_t mismatches = 0;
+                    for (std::size_t k = 0; k < values.size(); ++k) {
+                        mismatches += t.values[static_cast<std::size_t>(slot(values[k], t.origin, t.scale, static_cast<float>(t.values.size() - 1)))] != exact[k];
+                    }
+                    if (mismatches <= allowed) {
+                        used += t.values.size() * sizeof(T);
+                        tables.push_back(std::move(t));
+                        break;
+                    }
+                    scale *= step;
+                }
+            }
+            pack();
+        }
+
+        std::size_t channels() const { return channelCount; }
+        std::size_t uniqueTables() const { return tables.size(); }
+        float scale(std::size_t channel) const { return tables[channelTable[channel]].scale; }
+        // Decimal digits of the slot width, exact for Scaling::Decimal
+        unsigned int precisionDigits(std::size_t channel) const { return static_cast<unsigned int>(std::max(0.0f, std::round(std::log10(scale(channel))))); }
+        // Largest number of output levels the result can be below the exact one
+        std::size_t maxError(std::size_t channel) const { return tables[channelTable[channel]].maxError; }
+        std::size_t bytes() const {
+            std::size_t total = 0;
+            for (auto&& t : tables) {
+                total += t.values.size() * sizeof(T);
+            }
+            return total;
+        }
+
+        T threshold(std::size_t channel, float input) const {
+            const View& v = views[channel];
+            return storage[v.offset + static_cast<std::size_t>(slot(input, v.origin, v.scale, v.last))];
+        }
+
+        /**
+         * Channel-minor input like the optimized kernels, only full rows are written
+         */
+        void thresholds(std::span<const float> inputs, std::span<T> out) const {
+            if (out.size() < inputs.size()) {
+                throw std::invalid_argument("Output buffer too small for the inputs");
+            }
+            const std::size_t rows = inputs.size() / channelCount;
+            const std::size_t stride = channelCount;
+            // channel by channel with the parameters in registers, byte stores could alias a shared View
+            for (std::size_t c = 0; c < stride; ++c) {
+                const View v = views[c];
+                const T* values = storage.data() + v.offset;
+                const float* in = inputs.data() + c;
+                T* o = out.data() + c;
+                for (std::size_t row = 0; row < rows; ++row) {
+                    o[row * stride] = values[static_cast<std::size_t>(slot(in[row * stride], v.origin, v.scale, v.last))];
+                }
+            }
+        }
+
+        std::vector<T> thresholds(const std::vector<float>& inputs) const {
+            std::vector<T> ret(inputs.size());
+            thresholds(inputs, ret);
+            return ret;
+        }
+
+        /**
+         * thresholds() handing every value of the full rows to emit(i, value) as an int instead of storing it
+         */
+        template<typename Emit>
+        void values(std::span<const float> inputs, Emit&& emit) const {
+            const std::size_t rows = inputs.size() / channelCount;
+            const std::size_t stride = channelCount;
+            for (std::size_t c = 0; c < stride; ++c) {
+                const View v = views[c];
+                const T* values = storage.data() + v.offset;
+                for (std::size_t row = 0; row < rows; ++row) {
+                    emit(row * stride + c, static_cast<int>(values[static_cast<std::size_t>(slot(inputs[row * stride + c], v.origin, v.scale, v.last))]));
+                }
+            }
+        }
+    };
+
+    /**
+     * Lookup indexed by the high bits of the order-preserving FinnUtils::floatKey instead of a scaled float. The index
+     * is an integer max, subtract, min and shift (no FMA or float to int conversion as in get_indices), and -0.0, inf
+     * and NaN need no special casing. Bucket b holds bias plus the number of thresholds whose key lies below the first
+     * key of the bucket, so the result is exact outside of buckets that contain thresholds and at most maxError() too
+     * low inside them. Inputs below the first threshold land in bucket 0, inputs above the last in the final bucket.
+     */
+    template<typename T = uint8_t>
+    class KeyThresholdLookup {
+        private:
+        int32_t first;
+        uint32_t limit;
+        unsigned int shift;
+        std::vector<T> table;
+        std::size_t worst = 0;
+
+        uint32_t bucket(int32_t key) const {
+            const uint32_t offset = static_cast<uint32_t>(std::max(key, first)) - static_cast<uint32_t>(first);
+            return std::min(offset, limit) >> shift;
+        }
+
+        public:
+        /**
+         * thresholds: Ascending thresholds of one channel
+         * bits: The table has at most 2^bits entries
+         * bias: Added to every count (e.g. -128 for the int8 layers in thresholds.h)
+         */
+        KeyThresholdLookup(std::span<const float> thresholds, unsigned int bits, int bias = 0) {
+            first = FinnUtils::floatKey(thresholds.front());
+            const uint64_t range = static_cast<uint32_t>(FinnUtils::floatKey(thresholds.back())) - static_cast<uint32_t>(first);
+            shift = 0;
+            while ((range >> shift) + 2 > (uint64_t{ 1 } << bits)) {
+                ++shift;
+            }
+            limit = static_cast<uint32_t>(std::min<uint64_t>(((range >> shift) + 1) << shift, std::numeric_limits<uint32_t>::max()));
+            // 3 bytes of padding, the SIMD path gathers 4 bytes per lane
+            table = std::vector<T>((range >> shift) + 2 + 3);
+            std::vector<std::size_t> inBucket(table.size(), 0);
+            std::size_t passed = 0;
+            for (std::size_t b = 0; b + 3 < table.size(); ++b) {
+                const uint64_t lower = uint64_t{ b } << shift;
+                while (passed < thresholds.size() && static_cast<uint32_t>(FinnUtils::floatKey(thresholds[passed])) - static_cast<uint32_t>(first) < lower) {
+                    ++passed;
+                }
+                table[b] = static_cast<T>(static_cast<int>(passed) + bias);
+            }
+            for (auto&& t : thresholds) {
+                ++inBucket[bucket(FinnUtils::floatKey(t))];
+            }
+            worst = *std::max_element(inBucket.begin(), inBucket.end());
+        }
+
+        std::size_t size() const { return table.size() - 3; }
+        std::size_t maxError() const { return worst; }
+
+        T threshold(float input) const {
+            return table[bucket(FinnUtils::floatKey(input))];
+        }
+
+        void thresholds(std::span<const float> inputs, std::span<T> out) const {
+            if (out.size() < inputs.size()) {
+                throw std::invalid_argument("Output buffer too small for the inputs");
+            }
+            std::size_t i = 0;
+#if defined(__AVX2__)
+            if constexpr (sizeof(T) == 1) {
+                const __m256i firstKey = _mm256_set1_epi32(first);
+                const __m256i last = _mm256_set1_epi32(static_cast<int32_t>(limit));
+                const __m128i count = _mm_cvtsi32_si128(static_cast<int>(shift));
+                const int* base = reinterpret_cast<const int*>(table.data());
+                for (; i + 8 <= inputs.size(); i += 8) {
+                    const __m256i key = FinnUtils::floatKeys(_mm256_loadu_ps(inputs.data() + i));
+                    const __m256i offset = _mm256_sub_epi32(_mm256_max_epi32(key, firstKey), firstKey);
+                    const __m256i index = _mm256_srl_epi32(_mm256_min_epu32(offset, last), count);
+                    const __m256i value = _mm256_and_si256(_mm256_i32gather_epi32(base, index, 1), _mm256_set1_epi32(0xFF));
+                    const __m128i words = _mm_packus_epi32(_mm256_castsi256_si128(value), _mm256_extracti128_si256(value, 1));
+                    _mm_storel_epi64(reinterpret_cast<__m128i*>(out.data() + i), _mm_packus_epi16(words, words));
+                }
+            }
+#endif
+            for (; i < inputs.size(); ++i) {
+                out[i] = threshold(inputs[i]);
+            }
+        }
+
+        std::vector<T> thresholds(const std::vector<float>& inputs) const {
+            std::vector<T> ret(inputs.size());
+            thresholds(inputs, ret);
+            return ret;
+        }
+
+        /**
+         * The looked up values as int32, handed to emit(i, values) as an __m256i of 8 values starting at inputs[i]
+         * (AVX2, one byte tables) or as an int
+         */
+        template<typename Emit>
+        void values(std::span<const float> inputs, Emit&& emit) const {
+            std::size_t i = 0;
+#if defined(__AVX2__)
+            if constexpr (sizeof(T) == 1) {
+                const __m256i firstKey = _mm256_set1_epi32(first);
+                const __m256i last = _mm256_set1_epi32(static_cast<int32_t>(limit));
+                const __m128i count = _mm_cvtsi32_si128(static_cast<int>(shift));
+                const int* base = reinterpret_cast<const int*>(table.data());
+                for (; i + 8 <= inputs.size(); i += 8) {
+                    const __m256i key = FinnUtils::floatKeys(_mm256_loadu_ps(inputs.data() + i));
+                    const __m256i offset = _mm256_sub_epi32(_mm256_max_epi32(key, firstKey), firstKey);
+                    const __m256i index = _mm256_srl_epi32(_mm256_min_epu32(offset, last), count);
+                    // the byte moves to the top and back, which extends it with the signedness of T
+                    const __m256i top = _mm256_slli_epi32(_mm256_i32gather_epi32(base, index, 1), 24);
+                    emit(i, std::is_signed_v<T> ? _mm256_srai_epi32(top, 24) : _mm256_srli_epi32(top, 24));
+                }
+            }
+#endif
+            for (; i < inputs.size(); ++i) {
+                emit(i, static_cast<int>(threshold(inputs[i])));
+            }
+        }
+    };
 }
\ No newline at end of file
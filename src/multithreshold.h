@@ -0,0 +1,340 @@
+#ifndef MULTITHRESHOLD
+#define MULTITHRESHOLD
+
+#include <vector>
+#include <array>
+#include <span>
+#include <string>
+#include <cstdint>
+#include <limits>
+#include <bit>
+#include <type_traits>
+#include <stdexcept>
+#include <algorithm>
+#include <cstring>
+#include <immintrin.h>
+#include "threshold_table.h"
+#include "threshold_index.h"
+#include "utils.h"
+
+/**
+ * Generic MultiThreshold engine. The template parameters usually mean the following:
+ *
+ * Channels: Number of channels, i.e. the innermost dimension of the input
+ * Count: Number of thresholds per channel (1, 3, 15, 255, ... for 1, 2, 4, 8 bit activations)
+ * In: Input and threshold type
+ * Out: Output type
+ * Bias: Added to the number of thresholds passed (FINN's out_bias, -128 for the int8 layers in thresholds.h)
+ *
+ * Every channel is padded with the largest In value to 2^k - 1 thresholds, so the branchless search runs exactly k steps
+ * with no bounds checks: 8 steps for 255 thresholds, 4 for 15 and 2 for 3. Padding never counts as smaller than an input.
+ */
+namespace optimized::inline FINN_ISA {
+
+    namespace detail {
+        template<typename In>
+        constexpr In padValue() {
+            if constexpr (std::numeric_limits<In>::has_infinity) {
+                return std::numeric_limits<In>::infinity();
+            }
+            else {
+                return std::numeric_limits<In>::max();
+            }
+        }
+
+        constexpr std::size_t paddedCount(std::size_t count) {
+            return std::bit_ceil(count + 1) - 1;
+        }
+
+        // Number of thresholds strictly smaller than value, t holds paddedCount thresholds
+        template<typename In>
+        inline int search(const In* t, std::size_t padded, In value) {
+            int pos = 0;
+            for (int step = static_cast<int>((padded + 1) >> 1); step > 0; step >>= 1) {
+                pos += (t[pos + step - 1] < value) * step;
+            }
+            return pos;
+        }
+
+        /**
+         * Gather based vertical search over a flattened batch, see multithresholdSIMD. first is the flattened position of
+         * inp[0]. Writes the number of thresholds passed per element into counts and returns how many elements were
+         * handled, the caller finishes the tail.
+         */
+        inline std::size_t searchFloat(const float* table, std::size_t padded, const int* offsets, std::size_t channels, std::size_t first, const float* inp, std::size_t size, int32_t* counts) {
+            std::size_t i = 0;
+            // only the vector paths use it
+            [[maybe_unused]] const int firstStep = static_cast<int>((padded + 1) >> 1);
+#if defined(__AVX512F__)
+            for (; i + 16 <= size; i += 16) {
+                const __m512i base = _mm512_loadu_si512(offsets + (first + i) % channels);
+                const __m512 x = _mm512_loadu_ps(inp + i);
+                __m512i pos = _mm512_setzero_si512();
+                for (int step = firstStep; step > 0; step >>= 1) {
+                    const __m512i probe = _mm512_add_epi32(base, _mm512_add_epi32(pos, _mm512_set1_epi32(step - 1)));
+                    const __mmask16 lt = _mm512_cmp_ps_mask(_mm512_i32gather_ps(probe, table, 4), x, _CMP_LT_OQ);
+                    pos = _mm512_mask_add_epi32(pos, lt, pos, _mm512_set1_epi32(step));
+                }
+                _mm512_storeu_si512(counts + i, pos);
+            }
+#endif
+#if defined(__AVX2__)
+            for (; i + 8 <= size; i += 8) {
+                const __m256i base = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(offsets + (first + i) % channels));
+                const __m256 x = _mm256_loadu_ps(inp + i);
+                __m256i pos = _mm256_setzero_si256();
+                for (int step = firstStep; step > 0; step >>= 1) {
+                    const __m256i probe = _mm256_add_epi32(base, _mm256_add_epi32(pos, _mm256_set1_epi32(step - 1)));
+                    const __m256i lt = _mm256_castps_si256(_mm256_cmp_ps(_mm256_i32gather_ps(table, probe, 4), x, _CMP_LT_OQ));
+                    pos = _mm256_add_epi32(pos, _mm256_and_si256(lt, _mm256_set1_epi32(step)));
+                }
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(counts + i), pos);
+            }
+#endif
+            return i;
+        }
+
+        /**
+         * Shared batch loop of both engines. Offsets holds the table offset of every row position, repeated for 16 extra
+         * lanes so vector loads at any row position work. The number of thresholds passed is computed for chunks of
+         * 1024 elements and handed to emit(begin, counts, length), which writes the chunk in the requested output format.
+         */
+        template<typename In, typename Emit>
+        void run(const In* table, std::size_t padded, const int* offsets, std::size_t channels, const In* inp, std::size_t size, Emit&& emit) {
+            constexpr std::size_t chunk = 1024;
+            alignas(64) int32_t counts[chunk];
+            for (std::size_t begin = 0; begin < size; begin += chunk) {
+                const std::size_t length = std::min(chunk, size - begin);
+                std::size_t i = 0;
+                if constexpr (std::is_same_v<In, float>) {
+                    i = searchFloat(table, padded, offsets, channels, begin, inp + begin, length, counts);
+                }
+                for (std::size_t k = i; k < length; ++k) {
+                    counts[k] = search(table + offsets[(begin + k) % channels], padded, inp[begin + k]);
+                }
+                emit(begin, counts, length);
+            }
+        }
+
+        template<typename Out>
+        void store(const int32_t* counts, std::size_t length, int bias, Out* out) {
+#pragma omp simd
+            for (std::size_t k = 0; k < length; ++k) {
+                out[k] = static_cast<Out>(counts[k] + bias);
+            }
+        }
+
+        /**
+         * Packs (count + bias) truncated to Bits into bytes, element i goes to bits (i % (8 / Bits)) * Bits of byte
+         * i / (8 / Bits), i.e. the first element is in the least significant bits. Signed activations end up in two's
+         * complement. length has to be a multiple of 8 / Bits except for the very last call.
+         */
+        template<unsigned int Bits>
+        void pack(const int32_t* counts, std::size_t length, int bias, uint8_t* out) {
+            static_assert(Bits == 1 || Bits == 2 || Bits == 4 || Bits == 8, "Packing supports 1, 2, 4 and 8 bits");
+            constexpr unsigned int perByte = 8 / Bits;
+            constexpr int mask = (1 << Bits) - 1;
+            std::size_t i = 0;
+#if defined(__AVX2__)
+            const __m256i biasVec = _mm256_set1_epi32(bias);
+            const __m256i maskVec = _mm256_set1_epi32(mask);
+            for (; i + 32 <= length; i += 32) {
+                __m256i c[4];
+                for (int r = 0; r < 4; ++r) {
+                    c[r] = _mm256_and_si256(_mm256_add_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(counts + i + 8 * r)), biasVec), maskVec);
+                }
+                // 32 codes as bytes, packs interleave the 128 bit lanes, the permute restores element order
+                const __m256i bytes = _mm256_permutevar8x32_epi32(_mm256_packus_epi16(_mm256_packus_epi32(c[0], c[1]), _mm256_packus_epi32(c[2], c[3])), _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7));
+                uint8_t* dst = out + i / perByte;
+                if constexpr (Bits == 1) {
+                    const uint32_t bits = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_slli_epi16(bytes, 7)));
+                    std::memcpy(dst, &bits, 4);
+                }
+                else if constexpr (Bits == 2) {
+                    // pairs of bytes into 4 bit nibbles, pairs of nibbles into one byte per dword
+                    const __m256i nibbles = _mm256_maddubs_epi16(bytes, _mm256_set1_epi16(0x0401));
+                    const __m256i packed = _mm256_madd_epi16(nibbles, _mm256_set1_epi32(0x00100001));
+                    const __m256i gathered = _mm256_shuffle_epi8(packed, _mm256_setr_epi8(0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1));
+                    const uint32_t low = static_cast<uint32_t>(_mm_cvtsi128_si32(_mm256_castsi256_si128(gathered)));
+                    const uint32_t high = static_cast<uint32_t>(_mm_cvtsi128_si32(_mm256_extracti128_si256(gathered, 1)));
+                    std::memcpy(dst, &low, 4);
+                    std::memcpy(dst + 4, &high, 4);
+                }
+                else if constexpr (Bits == 4) {
+                    const __m256i words = _mm256_maddubs_epi16(bytes, _mm256_set1_epi16(0x1001));
+                    const __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(words, words), 0b1000);
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), _mm256_castsi256_si128(packed));
+                }
+                else {
+                    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst), bytes);
+                }
+            }
+#endif
+            for (; i < length; i += perByte) {
+                uint8_t byte = 0;
+                for (unsigned int k = 0; k < perByte && i + k < length; ++k) {
+                    byte |= static_cast<uint8_t>(((counts[i + k] + bias) & mask) << (k * Bits));
+                }
+                out[i / perByte] = byte;
+            }
+        }
+
+        // Smallest of 1, 2, 4, 8 bits that holds Count + 1 activation levels
+        constexpr unsigned int packedBits(std::size_t count) {
+            return std::bit_ceil(static_cast<unsigned int>(std::bit_width(count)));
+        }
+
+        // Bytes needed for size packed elements
+        constexpr std::size_t packedSize(std::size_t size, unsigned int bits) {
+            return (size * bits + 7) / 8;
+        }
+
+        inline void checkPacked(std::size_t size, unsigned int bits, std::size_t available) {
+            if (available < packedSize(size, bits)) {
+                throw std::invalid_argument("Packed output buffer holds " + std::to_string(available) + " bytes, " + std::to_string(packedSize(size, bits)) + " needed");
+            }
+        }
+    }
+
+    /**
+     * Fixed shape engine, constexpr constructible from a compiled in table such as thresholds
+     */
+    template<std::size_t Channels, std::size_t Count, typename In = float, typename Out = int8_t, int Bias = -128>
+    class MultiThreshold {
+        static_assert(Count > 0, "At least one threshold per channel");
+        static_assert(Bias >= std::numeric_limits<Out>::min() && Bias + static_cast<long long>(Count) <= std::numeric_limits<Out>::max(), "Out cannot hold Bias + Count");
+
+        public:
+        static constexpr std::size_t channels = Channels;
+        static constexpr std::size_t count = Count;
+        static constexpr std::size_t padded = detail::paddedCount(Count);
+        static constexpr int bias = Bias;
+        static constexpr unsigned int bits = detail::packedBits(Count);
+
+        private:
+        alignas(64) std::array<In, Channels * padded> table;
+        std::array<int, Channels + 16> offsets;
+
+        public:
+        constexpr explicit MultiThreshold(const std::array<In, Channels * Count>& thresholds) : table(), offsets() {
+            for (std::size_t c = 0; c < Channels; ++c) {
+                for (std::size_t k = 0; k < padded; ++k) {
+                    table[c * padded + k] = (k < Count) ? thresholds[c * Count + k] : detail::padValue<In>();
+                }
+            }
+            for (std::size_t k = 0; k < offsets.size(); ++k) {
+                offsets[k] = static_cast<int>((k % Channels) * padded);
+            }
+        }
+
+        Out operator()(std::size_t channel, In value) const {
+            return static_cast<Out>(detail::search(table.data() + channel * padded, padded, value) + Bias);
+        }
+
+        void operator()(std::span<const In> inp, std::span<Out> out) const {
+            out = FinnUtils::outputFor(inp, out);
+            detail::run(table.data(), padded, offsets.data(), Channels, inp.data(), inp.size(), [&](std::size_t begin, const int32_t* counts, std::size_t length) {
+                detail::store(counts, length, Bias, out.data() + begin);
+            });
+        }
+
+        std::vector<Out> operator()(const std::vector<In>& inp) const {
+            std::vector<Out> ret(inp.size());
+            (*this)(std::span<const In>(inp), std::span<Out>(ret));
+            return ret;
+        }
+
+        /**
+         * Activations packed to bits per element, see detail::pack for the bit order
+         */
+        void packed(std::span<const In> inp, std::span<uint8_t> out) const {
+            detail::checkPacked(inp.size(), bits, out.size());
+            detail::run(table.data(), padded, offsets.data(), Channels, inp.data(), inp.size(), [&](std::size_t begin, const int32_t* counts, std::size_t length) {
+                detail::pack<bits>(counts, length, Bias, out.data() + begin * bits / 8);
+            });
+        }
+
+        std::vector<uint8_t> packed(const std::vector<In>& inp) const {
+            std::vector<uint8_t> ret(detail::packedSize(inp.size(), bits));
+            packed(std::span<const In>(inp), std::span<uint8_t>(ret));
+            return ret;
+        }
+    };
+
+    /**
+     * Runtime shape engine, for tables loaded with FinnUtils::ThresholdTable or shapes not known at compile time
+     */
+    template<typename In = float, typename Out = int8_t>
+    class DynamicMultiThreshold {
+        private:
+        std::size_t channelCount;
+        std::size_t thresholdCount;
+        std::size_t padded;
+        int bias;
+        FinnUtils::AlignedVector<In> table;
+        std::vector<int> offsets;
+
+        public:
+        DynamicMultiThreshold(const In* thresholds, std::size_t channels, std::size_t count, int outBias = -128) : channelCount(channels), thresholdCount(count), padded(detail::paddedCount(count)), bias(outBias), table(channels * padded, detail::padValue<In>()), offsets(channels + 16) {
+            if (count == 0 || outBias < std::numeric_limits<Out>::min() || outBias + static_cast<long long>(count) > std::numeric_limits<Out>::max()) {
+                throw std::invalid_argument("Output type cannot hold bias + threshold count");
+            }
+            for (std::size_t c = 0; c < channels; ++c) {
+                std::copy(thresholds + c * count, thresholds + (c + 1) * count, table.begin() + c * padded);
+            }
+            for (std::size_t k = 0; k < offsets.size(); ++k) {
+                offsets[k] = static_cast<int>((k % channels) * padded);
+            }
+        }
+
+        template<typename T = In, typename = std::enable_if_t<std::is_same_v<T, float>>>
+        explicit DynamicMultiThreshold(const FinnUtils::ThresholdTable& thresholds, int outBias = -128) : DynamicMultiThreshold(thresholds.data(), thresholds.channels(), thresholds.count(), outBias) {}
+
+        std::size_t channels() const { return channelCount; }
+        std::size_t count() const { return thresholdCount; }
+
+        Out operator()(std::size_t channel, In value) const {
+            return static_cast<Out>(detail::search(table.data() + channel * padded, padded, value) + bias);
+        }
+
+        void operator()(std::span<const In> inp, std::span<Out> out) const {
+            out = FinnUtils::outputFor(inp, out);
+            detail::run(table.data(), padded, offsets.data(), channelCount, inp.data(), inp.size(), [&](std::size_t begin, const int32_t* counts, std::size_t length) {
+                detail::store(counts, length, bias, out.data() + begin);
+            });
+        }
+
+        std::vector<Out> operator()(const std::vector<In>& inp) const {
+            std::vector<Out> ret(inp.size());
+            (*this)(std::span<const In>(inp), std::span<Out>(ret));
+            return ret;
+        }
+
+        unsigned int bits() const { return detail::packedBits(thresholdCount); }
+
+        /**
+         * Activations packed to bits() per element, see detail::pack for the bit order
+         */
+        void packed(std::span<const In> inp, std::span<uint8_t> out) const {
+            const unsigned int width = bits();
+            detail::checkPacked(inp.size(), width, out.size());
+            detail::run(table.data(), padded, offsets.data(), channelCount, inp.data(), inp.size(), [&](std::size_t begin, const int32_t* counts, std::size_t length) {
+                uint8_t* dest = out.data() + begin * width / 8;
+                switch (width) {
+                case 1: detail::pack<1>(counts, length, bias, dest); break;
+                case 2: detail::pack<2>(counts, length, bias, dest); break;
+                case 4: detail::pack<4>(counts, length, bias, dest); break;
+                default: detail::pack<8>(counts, length, bias, dest); break;
+                }
+            });
+        }
+
+        std::vector<uint8_t> packed(const std::vector<In>& inp) const {
+            std::vector<uint8_t> ret(detail::packedSize(inp.size(), bits()));
+            packed(std::span<const In>(inp), std::span<uint8_t>(ret));
+            return ret;
+        }
+    };
+};
+
+#endif // MULTITHRESHOLD
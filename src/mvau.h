@@ -0,0 +1,394 @@
+#ifndef MVAU_KERNELS
+#define MVAU_KERNELS
+
+#include <vector>
+#include <span>
+#include <string>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <limits>
+#include <bit>
+#include <type_traits>
+#include <stdexcept>
+#include <algorithm>
+#include <immintrin.h>
+#include "threshold_table.h"
+#include "utils.h"
+
+namespace optimized::inline FINN_ISA {
+
+    /**
+     * Output channels per vector register of the MVAU tiles
+     */
+#if defined(__AVX512F__) && defined(__AVX512BW__) && defined(__AVX512VL__)
+    constexpr size_t mvauWidth = 16;
+#else
+    constexpr size_t mvauWidth = 8;
+#endif
+
+    template<typename T>
+    struct MVAUTraits;
+
+    template<>
+    struct MVAUTraits<float> {
+        using Acc = float;
+        using Table = FinnUtils::ThresholdTable;
+        using Packed = float;
+    };
+
+    // int8 weights are widened to int16 pairs of consecutive input channels for vpmaddwd
+    template<>
+    struct MVAUTraits<int8_t> {
+        using Acc = int32_t;
+        using Table = FinnUtils::IntegerThresholdTable<int32_t>;
+        using Packed = int16_t;
+    };
+
+    /**
+     * Fused MatMul + MultiThreshold (FINN's MVAU): out[b, n] = -128 + #{ t in thresholds[n] : t < sum_k inp[b, k] * weights[k, n] }
+     * for float inputs and weights (float accumulators, float thresholds) or int8 inputs and weights (int32 accumulators,
+     * int32 thresholds). A tile of rowTile rows times mvauWidth output channels is accumulated in vector registers and
+     * thresholded there with the branchless gather search, so only the int8 activations are written.
+     * Float accumulation runs in input channel order with fused multiply-adds, the same as a loop of std::fma.
+     */
+    template<typename T>
+    class MVAU {
+        public:
+        using Acc = typename MVAUTraits<T>::Acc;
+        using Table = typename MVAUTraits<T>::Table;
+
+        static constexpr size_t rowTile = 8;
+
+        private:
+        using Packed = typename MVAUTraits<T>::Packed;
+        static constexpr size_t width = mvauWidth;
+        static constexpr size_t pairs = std::is_same_v<T, int8_t> ? 2 : 1;
+        // int8 rows are prepared once per tile as int32 words holding two consecutive inputs (one per 16 bit half),
+        // broadcast against the int16 weight pairs
+        using Row = std::conditional_t<std::is_same_v<T, int8_t>, int32_t, T>;
+
+        size_t inChannels;
+        size_t outChannels;
+        size_t steps;
+        size_t blocks;
+        size_t count;
+        int firstStep;
+        // [block][step][lane][pair], zero padded to whole blocks and steps
+        FinnUtils::AlignedVector<Packed> packed;
+        // channel-major thresholds of the padded output channels
+        FinnUtils::AlignedVector<Acc> levels;
+
+        // input channel k of a prepared row
+        static Acc input(const Row* row, size_t k) {
+            if constexpr (std::is_same_v<T, float>) {
+                return row[k];
+            }
+            else {
+                return static_cast<int16_t>(static_cast<uint32_t>(row[k / 2]) >> (16 * (k % 2)));
+            }
+        }
+
+        static Acc mac(Acc acc, Acc x, Packed w) {
+            if constexpr (std::is_same_v<T, float>) {
+                return std::fma(x, w, acc);
+            }
+            else {
+                return acc + x * static_cast<int32_t>(w);
+            }
+        }
+
+        int8_t thresholdScalar(size_t n, Acc acc) const {
+            const Acc* t = levels.data() + n * count;
+            const size_t below = std::lower_bound(t, t + count, acc) - t;
+            return static_cast<int8_t>(std::min<size_t>(below, 255) - 128);
+        }
+
+        template<size_t R, bool Fused>
+        void tileScalar(const Row* rows, size_t b, int8_t* out, Acc* accOut) const {
+            const size_t lanes = std::min(width, outChannels - b * width);
+            const Packed* w = packed.data() + b * steps * width * pairs;
+            for (size_t r = 0; r < R; ++r) {
+                for (size_t lane = 0; lane < lanes; ++lane) {
+                    Acc acc{};
+                    for (size_t k = 0; k < inChannels; ++k) {
+                        acc = mac(acc, input(rows + r * steps, k), w[((k / pairs) * width + lane) * pairs + k % pairs]);
+                    }
+                    if constexpr (Fused) {
+                        out[r * outChannels + b * width + lane] = thresholdScalar(b * width + lane, acc);
+                    }
+                    else {
+                        accOut[r * outChannels + b * width + lane] = acc;
+                    }
+                }
+            }
+        }
+
+#if defined(__AVX512F__) && defined(__AVX512BW__) && defined(__AVX512VL__)
+        template<size_t R, typename V>
+        void thresholdTile(const V (&acc)[R], size_t b, __m128i (&result)[R]) const {
+            const __m512i base = _mm512_add_epi32(_mm512_set1_epi32(static_cast<int>(b * width * count)), _mm512_mullo_epi32(_mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15), _mm512_set1_epi32(static_cast<int>(count))));
+            const __m512i last = _mm512_set1_epi32(static_cast<int>(count) - 1);
+            __m512i pos[R];
+            for (size_t r = 0; r < R; ++r) {
+                pos[r] = _mm512_setzero_si512();
+            }
+            // Steps outer, rows inner: the R gathers of one step are independent
+            for (int step = firstStep; step > 0; step >>= 1) {
+                const __m512i offset = _mm512_set1_epi32(step - 1);
+                for (size_t r = 0; r < R; ++r) {
+                    const __m512i probe = _mm512_add_epi32(pos[r], offset);
+                    const __mmask16 valid = _mm512_cmple_epi32_mask(probe, last);
+                    const __m512i index = _mm512_add_epi32(base, _mm512_min_epi32(probe, last));
+                    __mmask16 lt;
+                    if constexpr (std::is_same_v<T, float>) {
+                        lt = _mm512_mask_cmp_ps_mask(valid, _mm512_i32gather_ps(index, levels.data(), 4), acc[r], _CMP_LT_OQ);
+                    }
+                    else {
+                        lt = _mm512_mask_cmplt_epi32_mask(valid, _mm512_i32gather_epi32(index, levels.data(), 4), acc[r]);
+                    }
+                    pos[r] = _mm512_mask_add_epi32(pos[r], lt, pos[r], _mm512_set1_epi32(step));
+                }
+            }
+            for (size_t r = 0; r < R; ++r) {
+                result[r] = _mm512_cvtsepi32_epi8(_mm512_sub_epi32(pos[r], _mm512_set1_epi32(128)));
+            }
+        }
+
+        template<size_t R, bool Fused>
+        void tile(const Row* rows, size_t b, int8_t* out, Acc* accOut) const {
+            const size_t lanes = std::min(width, outChannels - b * width);
+            const __mmask16 active = static_cast<__mmask16>((1u << lanes) - 1);
+            const Packed* w = packed.data() + b * steps * width * pairs;
+            if constexpr (std::is_same_v<T, float>) {
+                __m512 acc[R];
+                for (size_t r = 0; r < R; ++r) {
+                    acc[r] = _mm512_setzero_ps();
+                }
+                for (size_t k = 0; k < inChannels; ++k) {
+                    const __m512 weight = _mm512_load_ps(w + k * width);
+                    for (size_t r = 0; r < R; ++r) {
+                        acc[r] = _mm512_fmadd_ps(_mm512_set1_ps(rows[r * steps + k]), weight, acc[r]);
+                    }
+                }
+                if constexpr (Fused) {
+                    __m128i result[R];
+                    thresholdTile(acc, b, result);
+                    for (size_t r = 0; r < R; ++r) {
+                        _mm_mask_storeu_epi8(out + r * outChannels + b * width, active, result[r]);
+                    }
+                }
+                else {
+                    for (size_t r = 0; r < R; ++r) {
+                        _mm512_mask_storeu_ps(accOut + r * outChannels + b * width, active, acc[r]);
+                    }
+                }
+            }
+            else {
+                __m512i acc[R];
+                for (size_t r = 0; r < R; ++r) {
+                    acc[r] = _mm512_setzero_si512();
+                }
+                for (size_t s = 0; s < steps; ++s) {
+                    const __m512i weight = _mm512_load_si512(w + s * width * 2);
+                    for (size_t r = 0; r < R; ++r) {
+#if defined(__AVX512VNNI__)
+                        acc[r] = _mm512_dpwssd_epi32(acc[r], _mm512_set1_epi32(rows[r * steps + s]), weight);
+#else
+                        acc[r] = _mm512_add_epi32(acc[r], _mm512_madd_epi16(_mm512_set1_epi32(rows[r * steps + s]), weight));
+#endif
+                    }
+                }
+                if constexpr (Fused) {
+                    __m128i result[R];
+                    thresholdTile(acc, b, result);
+                    for (size_t r = 0; r < R; ++r) {
+                        _mm_mask_storeu_epi8(out + r * outChannels + b * width, active, result[r]);
+                    }
+                }
+                else {
+                    for (size_t r = 0; r < R; ++r) {
+                        _mm512_mask_storeu_epi32(accOut + r * outChannels + b * width, active, acc[r]);
+                    }
+                }
+            }
+        }
+#elif defined(__AVX2__) && defined(__FMA__)
+        template<size_t R, typename V>
+        void thresholdTile(const V (&acc)[R], size_t b, __m128i (&result)[R]) const {
+            const __m256i base = _mm256_add_epi32(_mm256_set1_epi32(static_cast<int>(b * width * count)), _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(static_cast<int>(count))));
+            const __m256i last = _mm256_set1_epi32(static_cast<int>(count) - 1);
+            const __m256i bound = _mm256_set1_epi32(static_cast<int>(count));
+            __m256i pos[R];
+            for (size_t r = 0; r < R; ++r) {
+                pos[r] = _mm256_setzero_si256();
+            }
+            for (int step = firstStep; step > 0; step >>= 1) {
+                const __m256i offset = _mm256_set1_epi32(step - 1);
+                for (size_t r = 0; r < R; ++r) {
+                    const __m256i probe = _mm256_add_epi32(pos[r], offset);
+                    const __m256i valid = _mm256_cmpgt_epi32(bound, probe);
+                    const __m256i index = _mm256_add_epi32(base, _mm256_min_epi32(probe, last));
+                    __m256i lt;
+                    if constexpr (std::is_same_v<T, float>) {
+                        lt = _mm256_castps_si256(_mm256_cmp_ps(_mm256_i32gather_ps(levels.data(), index, 4), _mm256_castsi256_ps(acc[r]), _CMP_LT_OQ));
+                    }
+                    else {
+                        lt = _mm256_cmpgt_epi32(acc[r], _mm256_i32gather_epi32(levels.data(), index, 4));
+                    }
+                    pos[r] = _mm256_add_epi32(pos[r], _mm256_and_si256(_mm256_and_si256(valid, lt), _mm256_set1_epi32(step)));
+                }
+            }
+            for (size_t r = 0; r < R; ++r) {
+                const __m256i val = _mm256_sub_epi32(pos[r], _mm256_set1_epi32(128));
+                const __m128i words = _mm_packs_epi32(_mm256_castsi256_si128(val), _mm256_extracti128_si256(val, 1));
+                result[r] = _mm_packs_epi16(words, words);
+            }
+        }
+
+        template<size_t R, bool Fused>
+        void tile(const Row* rows, size_t b, int8_t* out, Acc* accOut) const {
+            const size_t lanes = std::min(width, outChannels - b * width);
+            const Packed* w = packed.data() + b * steps * width * pairs;
+            __m256i acc[R];
+            for (size_t r = 0; r < R; ++r) {
+                acc[r] = _mm256_setzero_si256();
+            }
+            if constexpr (std::is_same_v<T, float>) {
+                for (size_t k = 0; k < inChannels; ++k) {
+                    const __m256 weight = _mm256_load_ps(w + k * width);
+                    for (size_t r = 0; r < R; ++r) {
+                        acc[r] = _mm256_castps_si256(_mm256_fmadd_ps(_mm256_set1_ps(rows[r * steps + k]), weight, _mm256_castsi256_ps(acc[r])));
+                    }
+                }
+            }
+            else {
+                for (size_t s = 0; s < steps; ++s) {
+                    const __m256i weight = _mm256_load_si256(reinterpret_cast<const __m256i*>(w + s * width * 2));
+                    for (size_t r = 0; r < R; ++r) {
+                        acc[r] = _mm256_add_epi32(acc[r], _mm256_madd_epi16(_mm256_set1_epi32(rows[r * steps + s]), weight));
+                    }
+                }
+            }
+            if constexpr (Fused) {
+                __m128i result[R];
+                thresholdTile(acc, b, result);
+                for (size_t r = 0; r < R; ++r) {
+                    if (lanes == width) {
+                        _mm_storel_epi64(reinterpret_cast<__m128i*>(out + r * outChannels + b * width), result[r]);
+                    }
+                    else {
+                        alignas(16) int8_t partial[16];
+                        _mm_store_si128(reinterpret_cast<__m128i*>(partial), result[r]);
+                        std::copy_n(partial, lanes, out + r * outChannels + b * width);
+                    }
+                }
+            }
+            else {
+                for (size_t r = 0; r < R; ++r) {
+                    alignas(32) Acc partial[width];
+                    _mm256_store_si256(reinterpret_cast<__m256i*>(partial), acc[r]);
+                    std::copy_n(partial, lanes, accOut + r * outChannels + b * width);
+                }
+            }
+        }
+#else
+        template<size_t R, bool Fused>
+        void tile(const Row* rows, size_t b, int8_t* out, Acc* accOut) const {
+            tileScalar<R, Fused>(rows, b, out, accOut);
+        }
+#endif
+
+        template<bool Fused>
+        void run(std::span<const T> inp, int8_t* out, Acc* accOut, FinnUtils::ScratchArena& scratch) const {
+            const size_t batch = inp.size() / inChannels;
+            const std::span<Row> prepared = scratch.get<Row>(std::is_same_v<T, int8_t> ? rowTile * steps : 0);
+            // a tile of rows as the kernels read it, in place for float
+            const auto rowsAt = [&](size_t row, size_t rows) -> const Row* {
+                if constexpr (std::is_same_v<T, float>) {
+                    return inp.data() + row * inChannels;
+                }
+                else {
+                    for (size_t r = 0; r < rows; ++r) {
+                        const int8_t* x = inp.data() + (row + r) * inChannels;
+                        for (size_t s = 0; s < steps; ++s) {
+                            const uint32_t high = (2 * s + 1 < inChannels) ? static_cast<uint16_t>(int16_t{ x[2 * s + 1] }) : 0u;
+                            prepared[r * steps + s] = static_cast<int32_t>(static_cast<uint16_t>(int16_t{ x[2 * s] }) | (high << 16));
+                        }
+                    }
+                    return prepared.data();
+                }
+            };
+            // only one of the outputs exists
+            const auto at = [this](auto* base, size_t row) { return base == nullptr ? base : base + row * outChannels; };
+            size_t row = 0;
+            for (; row + rowTile <= batch; row += rowTile) {
+                const Row* rows = rowsAt(row, rowTile);
+                for (size_t b = 0; b < blocks; ++b) {
+                    tile<rowTile, Fused>(rows, b, at(out, row), at(accOut, row));
+                }
+            }
+            for (; row < batch; ++row) {
+                const Row* rows = rowsAt(row, 1);
+                for (size_t b = 0; b < blocks; ++b) {
+                    tile<1, Fused>(rows, b, at(out, row), at(accOut, row));
+                }
+            }
+        }
+
+        void checkOutput(std::span<const T> inp, size_t size) const {
+            const size_t needed = inp.size() / inChannels * outChannels;
+            if (size < needed) {
+                throw std::invalid_argument("Output buffer holds " + std::to_string(size) + " elements, " + std::to_string(needed) + " needed");
+            }
+        }
+
+        public:
+        /**
+         * weights: [inChannels, outChannels] row-major (the MatMul initializer), thresholds: one channel per output channel
+         */
+        MVAU(std::span<const T> weights, size_t inChannels, size_t outChannels, const Table& thresholds) : inChannels(inChannels), outChannels(outChannels),
+            steps((inChannels + pairs - 1) / pairs), blocks((outChannels + width - 1) / width), count(thresholds.count()), firstStep(static_cast<int>(std::bit_floor(thresholds.count()))),
+            packed(blocks * steps * width * pairs, Packed{}), levels(blocks * width * thresholds.count(), std::numeric_limits<Acc>::max()) {
+            if (inChannels == 0 || weights.size() != inChannels * outChannels) {
+                throw std::invalid_argument("Expected " + std::to_string(inChannels) + "x" + std::to_string(outChannels) + " weights, got " + std::to_string(weights.size()));
+            }
+            if (thresholds.channels() != outChannels) {
+                throw std::invalid_argument("Expected thresholds for " + std::to_string(outChannels) + " output channels, got " + std::to_string(thresholds.channels()));
+            }
+            for (size_t k = 0; k < inChannels; ++k) {
+                for (size_t n = 0; n < outChannels; ++n) {
+                    packed[(((n / width) * steps + k / pairs) * width + n % width) * pairs + k % pairs] = weights[k * outChannels + n];
+                }
+            }
+            for (size_t n = 0; n < outChannels; ++n) {
+                std::copy(thresholds.channel(n).begin(), thresholds.channel(n).end(), levels.begin() + n * count);
+            }
+        }
+
+        size_t inputs() const { return inChannels; }
+        size_t outputs() const { return outChannels; }
+
+        void operator()(std::span<const T> inp, std::span<int8_t> ret, FinnUtils::ScratchArena& scratch = FinnUtils::threadScratch()) const {
+            checkOutput(inp, ret.size());
+            run<true>(inp, ret.data(), nullptr, scratch);
+        }
+
+        std::vector<int8_t> operator()(const std::vector<T>& inp) const {
+            std::vector<int8_t> ret(inp.size() / inChannels * outChannels);
+            (*this)(std::span<const T>(inp), ret);
+            return ret;
+        }
+
+        /**
+         * The product alone with the same tiles, for layers whose accumulators are needed (and to compare against the
+         * unfused pair MatMul, multithreshold)
+         */
+        void accumulate(std::span<const T> inp, std::span<Acc> ret, FinnUtils::ScratchArena& scratch = FinnUtils::threadScratch()) const {
+            checkOutput(inp, ret.size());
+            run<false>(inp, nullptr, ret.data(), scratch);
+        }
+    };
+}
+
+#endif // MVAU_KERNELS
@@ -5,6 +5,7 @@
 #include <functional>
 #include <cstdint>
 #include "thresholds.h"
+#include "threshold_table.h"
 #include <iostream>
 
 int referenceInner(const int nf, const float& accu) {
@@ -48,5 +49,45 @@ std::vector<int8_t> multithreshold(const std::vector<float>& inp) {
     return ret;
 }
 
+inline int referenceInner(const FinnUtils::ThresholdTable& table, const int nf, const float& accu) {
+    int result = -128;
+    for (size_t i = 0; i < table.count(); i++) {
+        result += std::less<float>()(table(nf, i), accu);
+    }
+    return result;
+}
+
+inline std::vector<int8_t> referenceOuter(const FinnUtils::ThresholdTable& table, const std::vector<float>& inp) {
+    const size_t elemcount = table.channels();
+    std::vector<int8_t> ret;
+    ret.reserve(inp.size());
+    for (size_t batchindex = 0; batchindex < inp.size() / elemcount; ++batchindex) {
+        for (size_t elemindex = 0; elemindex < elemcount; ++elemindex) {
+            ret.emplace_back(referenceInner(table, elemindex, inp[batchindex * elemcount + elemindex]));
+        }
+    }
+    return ret;
+}
+
+inline std::vector<int8_t> multithreshold(const FinnUtils::ThresholdTable& table, const std::vector<float>& inp) {
+    const size_t elemcount = table.channels();
+    std::vector<int8_t> ret;
+    ret.reserve(inp.size());
+    for (size_t batchindex = 0; batchindex < inp.size() / elemcount; ++batchindex) {
+        for (size_t elemindex = 0; elemindex < elemcount; ++elemindex) {
+            // inputs above every threshold pass all of them
+            int result = -128 + static_cast<int>(table.count());
+            for (size_t i = 0; i < table.count(); ++i) {
+                if (table(elemindex, i) >= inp[batchindex * elemcount + elemindex]) {
+                    result = -128 + static_cast<int>(i);
+                    break;
+                }
+            }
+            ret.emplace_back(result);
+        }
+    }
+    return ret;
+}
+
 
 #endif // NAIVE
@@ -2,17 +2,28 @@
 #define OPTIMIZED
 
 #include <vector>
+#include <span>
 #include <functional>
 #include <cstdint>
 #include "thresholds.h"
+#include "threshold_index.h"
+#include "threshold_table.h"
+#include "utils.h"
+#include "thread_pool.h"
 #include <iostream>
 #include <algorithm>
 #include <omp.h>
 #include <bit>
 #include <limits>
 #include <cmath>
+#include <chrono>
+#include <random>
+#include <array>
+#include <utility>
+#include <type_traits>
+#include <immintrin.h>
 
-namespace FinnUtils {
+namespace FinnUtils::inline FINN_ISA {
     template<typename T>
     inline constexpr T fastLog2(T value)
     {
@@ -30,16 +41,52 @@ namespace FinnUtils {
             return static_cast<int>(static_cast<unsigned>(temp + lowerTimes2 + std::abs(temp - lowerTimes2)) >> 2);
         }
     }
+
+    /**
+     * Reorders a channel-major threshold table so that threshold k of the channels c..c+width-1 are adjacent,
+     * i.e. element (c, k) ends up at (c / width) * count * width + k * width + c % width. Channels are padded
+     * to a multiple of width with +inf, which never counts as smaller than an input.
+     */
+    template<size_t channels, size_t count, size_t width>
+    constexpr std::array<float, (channels + width - 1) / width * width * count> interleave(const std::array<float, channels * count>& table) {
+        std::array<float, (channels + width - 1) / width * width * count> ret;
+        ret.fill(std::numeric_limits<float>::infinity());
+        for (size_t c = 0; c < channels; ++c) {
+            for (size_t k = 0; k < count; ++k) {
+                ret[(c / width) * count * width + k * width + c % width] = table[c * count + k];
+            }
+        }
+        return ret;
+    }
+
+    /**
+     * Runtime counterpart of interleave for loaded tables
+     */
+    template<size_t width>
+    AlignedVector<float> interleave(const ThresholdTable& table) {
+        const size_t count = table.count();
+        AlignedVector<float> ret((table.channels() + width - 1) / width * width * count, std::numeric_limits<float>::infinity());
+        for (size_t c = 0; c < table.channels(); ++c) {
+            for (size_t k = 0; k < count; ++k) {
+                ret[(c / width) * count * width + k * width + c % width] = table(c, k);
+            }
+        }
+        return ret;
+    }
 }
 
-namespace optimized {
+namespace optimized::inline FINN_ISA {
 
     constinit float a = 255 / (thresholds[254] - thresholds[0]);
 
-    std::vector<int8_t> multithresholdLinearPerTensor(const std::vector<float>& inp) {
+    constexpr size_t soaWidth = 8;
+    alignas(32) constexpr auto thresholdsSoA = FinnUtils::interleave<thresholds.size() / 255, 255, soaWidth>(thresholds);
+
+    void multithresholdLinearPerTensor(std::span<const float> inp, std::span<int8_t> ret, FinnUtils::ScratchArena& scratch = FinnUtils::threadScratch()) {
         const size_t size = inp.size();
-        std::vector<int8_t> ret(size, -128);
-        std::vector<int> protoRet(size);
+        ret = FinnUtils::outputFor(inp, ret);
+        std::fill(ret.begin(), ret.end(), int8_t{ -128 });
+        const std::span<int> protoRet = scratch.get<int>(size);
 #pragma omp simd
         for (size_t i = 0; i < size; ++i) {
             protoRet[i] = std::clamp(static_cast<int>((inp[i] - thresholds[0]) * a), 0, 254);
@@ -49,18 +96,23 @@ namespace optimized {
             const int val = protoRet[i];
             ret[i] += static_cast<int>(inp[i] - thresholds[val] + 1.0f) + val;
         }
+    }
+
+    std::vector<int8_t> multithresholdLinearPerTensor(const std::vector<float>& inp) {
+        std::vector<int8_t> ret(inp.size());
+        multithresholdLinearPerTensor(inp, ret);
         return ret;
     }
 
-    std::vector<int8_t> multithresholdLinearPerTensorOP(const std::vector<float>& inp) {
+    void multithresholdLinearPerTensorOP(std::span<const float> inp, std::span<int8_t> ret, FinnUtils::ScratchArena& scratch = FinnUtils::threadScratch()) {
         const size_t size = inp.size();
         constexpr size_t padding = 4;
         //False sharing? Padding von protoRet und evtl. ret als abhilfe?
-        std::vector<int8_t> ret(size, -128);
-        std::vector<int> protoRet(size);
-        std::size_t threadcount = std::min({ 24ul ,static_cast<std::size_t>(omp_get_num_procs()), FinnUtils::fastLog2(inp.size() >> 4) });
-        omp_set_num_threads(threadcount);
-#pragma omp for simd
+        ret = FinnUtils::outputFor(inp, ret);
+        std::fill(ret.begin(), ret.end(), int8_t{ -128 });
+        const std::span<int> protoRet = scratch.get<int>(size);
+        const int threadcount = static_cast<int>(std::max<std::size_t>(std::min({ 24ul ,static_cast<std::size_t>(omp_get_num_procs()), FinnUtils::fastLog2(inp.size() >> 4) }), 1));
+#pragma omp parallel for simd num_threads(threadcount)
         for (size_t i = 0; i < size; ++i) {
             protoRet[i] = std::clamp(static_cast<int>((inp[i] - thresholds[0]) * a), 0, 254);
         }
@@ -69,15 +121,20 @@ namespace optimized {
             const int val = protoRet[i];
             ret[i] += static_cast<int>(inp[i] - thresholds[val] + 1.0f) + val;
         }
+    }
+
+    std::vector<int8_t> multithresholdLinearPerTensorOP(const std::vector<float>& inp) {
+        std::vector<int8_t> ret(inp.size());
+        multithresholdLinearPerTensorOP(inp, ret);
         return ret;
     }
 
-    std::vector<int8_t> multithresholdLinearPerTensorIC(const std::vector<float>& inp) {
-        std::vector<int8_t> ret(inp.size(), -128);
-        std::vector<int> protoRet(inp.size());
-        std::size_t threadcount = std::min({ 24ul ,static_cast<std::size_t>(omp_get_num_procs()), FinnUtils::fastLog2(inp.size() >> 4) });
-        omp_set_num_threads(threadcount);
-#pragma omp for simd
+    void multithresholdLinearPerTensorIC(std::span<const float> inp, std::span<int8_t> ret, FinnUtils::ScratchArena& scratch = FinnUtils::threadScratch()) {
+        ret = FinnUtils::outputFor(inp, ret);
+        std::fill(ret.begin(), ret.end(), int8_t{ -128 });
+        const std::span<int> protoRet = scratch.get<int>(inp.size());
+        const int threadcount = static_cast<int>(std::max<std::size_t>(std::min({ 24ul ,static_cast<std::size_t>(omp_get_num_procs()), FinnUtils::fastLog2(inp.size() >> 4) }), 1));
+#pragma omp parallel for simd num_threads(threadcount)
         for (size_t i = 0; i < inp.size(); ++i) {
             protoRet[i] = std::clamp(static_cast<int>((inp[i] - thresholds[0]) * a), 0, 254);
         }
@@ -86,26 +143,134 @@ namespace optimized {
             const int val = protoRet[i];
             ret[i] += static_cast<int>(inp[i] - thresholds[val] + 1.0f) + val;
         }
+    }
+
+    std::vector<int8_t> multithresholdLinearPerTensorIC(const std::vector<float>& inp) {
+        std::vector<int8_t> ret(inp.size());
+        multithresholdLinearPerTensorIC(inp, ret);
         return ret;
     }
 
     template<size_t elemcount>
-    std::vector<int8_t> multithreshold(const std::vector<float>& inp) {
-        std::vector<int8_t> ret;
-        ret.reserve(inp.size());
+    void multithreshold(std::span<const float> inp, std::span<int8_t> ret) {
+        ret = FinnUtils::outputFor(inp, ret);
         for (size_t batchindex = 0; batchindex < inp.size() / elemcount; ++batchindex) {
             for (int elemindex = 0; elemindex < elemcount; ++elemindex) {
                 int result = -128;
                 result += std::distance(thresholds.begin() + elemindex * 255, std::upper_bound(thresholds.begin() + elemindex * 255, thresholds.begin() + (elemindex + 1) * 255, inp[batchindex * elemcount + elemindex]));
-                ret.emplace_back(result);
+                ret[batchindex * elemcount + elemindex] = result;
             }
         }
+    }
+
+    template<size_t elemcount>
+    std::vector<int8_t> multithreshold(const std::vector<float>& inp) {
+        std::vector<int8_t> ret(inp.size());
+        multithreshold<elemcount>(inp, ret);
         return ret;
     }
 
+    /**
+     * Search used by the LE kernels after the first value. Binary searches the whole range on the side of the previous
+     * index, Gallop probes 1, 2, 4, ... slots away from the previous index first and then binary searches only the last
+     * gap, which wins when consecutive values of a channel are correlated. Both give the same result.
+     */
+    enum class LESearch { Binary, Gallop };
+
+    // Number of thresholds <= value, known to be at least from
+    inline size_t gallopUp(std::span<const float> channel, size_t from, float value) {
+        const size_t n = channel.size();
+        size_t lo = from;
+        size_t hi = from;
+        for (size_t step = 1; hi < n && !(value < channel[hi]); step <<= 1) {
+            lo = hi + 1;
+            hi += step;
+        }
+        hi = std::min(hi, n);
+        return std::distance(channel.begin(), std::upper_bound(channel.begin() + lo, channel.begin() + hi, value));
+    }
+
+    // Number of thresholds <= value, known to be at most to
+    inline size_t gallopDown(std::span<const float> channel, size_t to, float value) {
+        size_t lo = 0;
+        size_t hi = to;
+        for (size_t step = 1; step <= hi; step <<= 1) {
+            if (!(value < channel[hi - step])) {
+                lo = hi - step + 1;
+                break;
+            }
+            hi -= step;
+        }
+        return std::distance(channel.begin(), std::upper_bound(channel.begin() + lo, channel.begin() + hi, value));
+    }
+
+    /**
+     * LE walk over n values of one channel, read with stride inStride, handing the count of value i to emit(i, count),
+     * searching with Search. last and indexLast carry the warm start in and out. NaN has no order, so it (and the value after it)
+     * gets a full search, which makes the result independent of where a walk starts and lets callers split freely.
+     */
+    template<LESearch Search = LESearch::Binary, typename Emit>
+    void leWalkCounts(std::span<const float> channel, const float* inp, size_t inStride, size_t n, float& last, size_t& indexLast, Emit&& emit) {
+        for (size_t i = 0; i < n; ++i) {
+            float curr = inp[i * inStride];
+            std::size_t indexCurr = 0;
+            if (curr == last) {
+                indexCurr = indexLast;
+            }
+            else if (curr > last) {
+                // search [last+1, end)
+                if constexpr (Search == LESearch::Gallop) {
+                    indexCurr = gallopUp(channel, indexLast, curr);
+                }
+                else {
+                    indexCurr = std::distance(channel.begin(), std::upper_bound(channel.begin() + indexLast, channel.end(), curr));
+                }
+            }
+            else if (curr < last) {
+                // search [begin, last)
+                if constexpr (Search == LESearch::Gallop) {
+                    indexCurr = gallopDown(channel, indexLast, curr);
+                }
+                else {
+                    indexCurr = std::distance(channel.begin(), std::upper_bound(channel.begin(), channel.begin() + indexLast, curr));
+                }
+            }
+            else {
+                indexCurr = std::distance(channel.begin(), std::upper_bound(channel.begin(), channel.end(), curr));
+            }
+            emit(i, static_cast<int>(indexCurr));
+            last = curr;
+            indexLast = indexCurr;
+        }
+    }
+
+    /**
+     * leWalkCounts writing -128 + count with stride outStride
+     */
+    template<LESearch Search = LESearch::Binary>
+    void leWalk(std::span<const float> channel, const float* inp, size_t inStride, int8_t* ret, size_t outStride, size_t n, float& last, size_t& indexLast) {
+        leWalkCounts<Search>(channel, inp, inStride, n, last, indexLast, [&](size_t i, int count) { ret[i * outStride] = static_cast<int8_t>(-128 + count); });
+    }
+
+    /**
+     * LE walk down one channel over the rows [rowBegin, rowEnd), warm started at the bottom of the channel
+     */
+    inline void multithresholdLEChannel(const FinnUtils::ThresholdTable& table, std::span<const float> inp, std::span<int8_t> ret, size_t elemindex, size_t rowBegin = 0, size_t rowEnd = std::numeric_limits<size_t>::max(), LESearch search = LESearch::Binary) {
+        const size_t elemcount = table.channels();
+        float last = std::numeric_limits<float>::lowest();
+        std::size_t indexLast = 0;
+        rowEnd = std::min(rowEnd, inp.size() / elemcount);
+        if (rowBegin < rowEnd) {
+            const size_t first = rowBegin * elemcount + elemindex;
+            const auto walk = (search == LESearch::Gallop) ? leWalk<LESearch::Gallop> : leWalk<LESearch::Binary>;
+            walk(table.channel(elemindex), inp.data() + first, elemcount, ret.data() + first, elemcount, rowEnd - rowBegin, last, indexLast);
+        }
+    }
+
     template<size_t elemcount>
-    std::vector<int8_t> multithresholdLE(const std::vector<float>& inp) {
-        std::vector<int8_t> ret(inp.size(), -128);
+    void multithresholdLE(std::span<const float> inp, std::span<int8_t> ret, LESearch search = LESearch::Binary) {
+        ret = FinnUtils::outputFor(inp, ret);
+        std::fill(ret.begin(), ret.end(), int8_t{ -128 });
         if (inp.size() == elemcount) {
             for (size_t batchindex = 0; batchindex < inp.size() / elemcount; ++batchindex) {
                 for (int elemindex = 0; elemindex < elemcount; ++elemindex) {
@@ -114,35 +279,241 @@ namespace optimized {
             }
         }
         else {
-            for (int elemindex = 0; elemindex < elemcount; ++elemindex) {
-                float last = std::numeric_limits<float>::lowest();
-                std::size_t indexLast = 0;
-                for (size_t batchindex = 0; batchindex < inp.size() / elemcount; ++batchindex) {
-                    float curr = inp[batchindex * elemcount + elemindex];
-                    std::size_t indexCurr = 0;
-                    if (curr == last) {
-                        indexCurr = indexLast;
-                    }
-                    else if (curr > last) {
-                        // search [last+1, end)
-                        indexCurr = std::distance(thresholds.begin() + elemindex * 255 + indexLast, std::upper_bound(thresholds.begin() + elemindex * 255 + indexLast, thresholds.begin() + (elemindex + 1) * 255, curr));
-                    }
-                    else {
-                        // search [begin, last)
-                        indexCurr = std::distance(thresholds.begin() + elemindex * 255, std::upper_bound(thresholds.begin() + elemindex * 255, thresholds.begin() + (elemindex + 1) * 255 - (255 - indexLast), curr));
-                    }
-                    ret[batchindex * elemcount + elemindex] += indexCurr;
+            const FinnUtils::ThresholdTable table(thresholds.data(), elemcount, 255);
+            for (size_t elemindex = 0; elemindex < elemcount; ++elemindex) {
+                multithresholdLEChannel(table, inp, ret, elemindex, 0, inp.size() / elemcount, search);
+            }
+        }
+    }
+
+    template<size_t elemcount>
+    std::vector<int8_t> multithresholdLE(const std::vector<float>& inp) {
+        std::vector<int8_t> ret(inp.size());
+        multithresholdLE<elemcount>(inp, ret);
+        return ret;
+    }
+
+    /**
+     * Same traversal as multithreshold, but with a pluggable search backend (SortedIndex, ThresholdIndex). The backends
+     * count thresholds strictly smaller than the input (referenceInner, the SIMD kernels), while multithreshold above
+     * uses upper_bound and also counts thresholds equal to it, so the two differ on ties.
+     */
+    template<size_t elemcount, SearchIndex Index>
+    void multithreshold(std::span<const float> inp, std::span<int8_t> ret, const Index& index) {
+        ret = FinnUtils::outputFor(inp, ret);
+        for (size_t batchindex = 0; batchindex < inp.size() / elemcount; ++batchindex) {
+            for (size_t elemindex = 0; elemindex < elemcount; ++elemindex) {
+                ret[batchindex * elemcount + elemindex] = -128 + static_cast<int>(index.search(elemindex, inp[batchindex * elemcount + elemindex]));
+            }
+        }
+    }
+
+    template<size_t elemcount, SearchIndex Index>
+    std::vector<int8_t> multithreshold(const std::vector<float>& inp, const Index& index) {
+        std::vector<int8_t> ret(inp.size());
+        multithreshold<elemcount>(inp, ret, index);
+        return ret;
+    }
+
+    /**
+     * The same with the channel count of the backend, for tables loaded at runtime
+     */
+    template<SearchIndex Index>
+    void multithreshold(const Index& index, std::span<const float> inp, std::span<int8_t> ret) {
+        ret = FinnUtils::outputFor(inp, ret);
+        const size_t elemcount = index.channels();
+        for (size_t batchindex = 0; batchindex < inp.size() / elemcount; ++batchindex) {
+            for (size_t elemindex = 0; elemindex < elemcount; ++elemindex) {
+                ret[batchindex * elemcount + elemindex] = -128 + static_cast<int>(index.search(elemindex, inp[batchindex * elemcount + elemindex]));
+            }
+        }
+    }
+
+    template<SearchIndex Index>
+    std::vector<int8_t> multithreshold(const Index& index, const std::vector<float>& inp) {
+        std::vector<int8_t> ret(inp.size());
+        multithreshold(index, std::span<const float>(inp), std::span<int8_t>(ret));
+        return ret;
+    }
+
+    /**
+     * Same traversal as multithresholdLE, but with a pluggable search backend. The backend searches the whole channel,
+     * so only the repeated value shortcut carries over.
+     */
+    template<size_t elemcount, SearchIndex Index>
+    void multithresholdLE(std::span<const float> inp, std::span<int8_t> ret, const Index& index) {
+        ret = FinnUtils::outputFor(inp, ret);
+        std::fill(ret.begin(), ret.end(), int8_t{ -128 });
+        for (size_t elemindex = 0; elemindex < elemcount; ++elemindex) {
+            float last = std::numeric_limits<float>::quiet_NaN();
+            std::size_t indexLast = 0;
+            for (size_t batchindex = 0; batchindex < inp.size() / elemcount; ++batchindex) {
+                const float curr = inp[batchindex * elemcount + elemindex];
+                if (curr != last) {
+                    indexLast = index.search(elemindex, curr);
                     last = curr;
-                    indexLast = indexCurr;
                 }
+                ret[batchindex * elemcount + elemindex] += indexLast;
             }
         }
+    }
+
+    template<size_t elemcount, SearchIndex Index>
+    std::vector<int8_t> multithresholdLE(const std::vector<float>& inp, const Index& index) {
+        std::vector<int8_t> ret(inp.size());
+        multithresholdLE<elemcount>(inp, ret, index);
         return ret;
     }
 
+    /**
+     * LinearIndex with the per-channel parameters of multithresholdLinearPerChannel repeated for every position of a row,
+     * so a vector load at any row position works. Built once per table for channel counts only known at runtime.
+     */
+    struct LinearChannelTable {
+        static constexpr size_t lanes = 16;
+
+        LinearIndex index;
+        std::vector<float> origin;
+        std::vector<float> inverseStep;
+        std::vector<int> offset;
+        // bit l is set when the channel of row position c + l needs the search
+        std::vector<uint32_t> fallback;
+
+        explicit LinearChannelTable(const LinearIndex& linear) : index(linear), origin(linear.channels() + lanes), inverseStep(linear.channels() + lanes), offset(linear.channels() + lanes), fallback(linear.channels()) {
+            fill(index, index.channels(), origin.data(), inverseStep.data(), offset.data(), fallback.data());
+        }
+        explicit LinearChannelTable(const FinnUtils::ThresholdTable& table) : LinearChannelTable(LinearIndex(table)) {}
+
+        // Parameters of elemcount channels into arrays of elemcount + lanes entries, fallback holds elemcount zeros
+        static void fill(const LinearIndex& index, size_t elemcount, float* origin, float* inverseStep, int* offset, uint32_t* fallback) {
+            for (size_t k = 0; k < elemcount + lanes; ++k) {
+                const size_t c = k % elemcount;
+                origin[k] = index.origin(c);
+                inverseStep[k] = index.inverseStep(c);
+                offset[k] = static_cast<int>(index.padded(c) - index.padded(0));
+            }
+            for (size_t c = 0; c < elemcount; ++c) {
+                for (size_t l = 0; l < lanes; ++l) {
+                    fallback[c] |= static_cast<uint32_t>(!index.linear((c + l) % elemcount)) << l;
+                }
+            }
+        }
+    };
+
+    /**
+     * Exact per-channel counterpart of multithresholdLinearPerTensor. Channels that are not uniform enough run through
+     * the closed form as well, their lanes are then overwritten with a search, so one skewed channel does not move the
+     * whole batch off the vector path. elemcount is a std::integral_constant for compiled in channel counts.
+     */
+    template<typename Channels>
+    void multithresholdLinearPerChannel(const LinearIndex& index, Channels elemcount, const float* origin, const float* inverseStep, const int* offset, const uint32_t* fallback,
+        std::span<const float> inp, std::span<int8_t> ret) {
+        const float* table = index.padded(0);
+        const float last = static_cast<float>(index.count());
+        const size_t size = inp.size();
+        ret = FinnUtils::outputFor(inp, ret);
+        // the closed form of a non-linear channel is clamped into its table, so only the result is wrong, not the gathers
+        auto search = [&](size_t i, uint32_t mask) {
+            for (; mask != 0; mask &= mask - 1) {
+                const size_t l = std::countr_zero(mask);
+                ret[i + l] = static_cast<int8_t>(-128 + static_cast<int>(index.search((i + l) % elemcount, inp[i + l])));
+            }
+        };
+        size_t i = 0;
+#if defined(__AVX512F__)
+        for (; i + 16 <= size; i += 16) {
+            const size_t c = i % elemcount;
+            const __m512 x = _mm512_loadu_ps(inp.data() + i);
+            const __m512 f = _mm512_roundscale_ps(_mm512_mul_ps(_mm512_sub_ps(x, _mm512_loadu_ps(origin + c)), _mm512_loadu_ps(inverseStep + c)), _MM_FROUND_TO_POS_INF | _MM_FROUND_NO_EXC);
+            // max returns the second operand for NaN
+            const __m512i j = _mm512_cvttps_epi32(_mm512_min_ps(_mm512_max_ps(f, _mm512_setzero_ps()), _mm512_set1_ps(last)));
+            const __m512i k = _mm512_add_epi32(_mm512_loadu_si512(offset + c), j);
+            const __mmask16 below = _mm512_cmp_ps_mask(_mm512_i32gather_ps(_mm512_add_epi32(k, _mm512_set1_epi32(1)), table, 4), x, _CMP_LT_OQ);
+            const __mmask16 above = _mm512_cmp_ps_mask(x, _mm512_i32gather_ps(k, table, 4), _CMP_LE_OQ);
+            __m512i val = _mm512_sub_epi32(j, _mm512_set1_epi32(128));
+            val = _mm512_mask_add_epi32(val, below, val, _mm512_set1_epi32(1));
+            val = _mm512_mask_sub_epi32(val, above, val, _mm512_set1_epi32(1));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(ret.data() + i), _mm512_cvtsepi32_epi8(val));
+            search(i, fallback[c] & 0xffff);
+        }
+#endif
+#if defined(__AVX2__)
+        for (; i + 8 <= size; i += 8) {
+            const size_t c = i % elemcount;
+            const __m256 x = _mm256_loadu_ps(inp.data() + i);
+            const __m256 f = _mm256_ceil_ps(_mm256_mul_ps(_mm256_sub_ps(x, _mm256_loadu_ps(origin + c)), _mm256_loadu_ps(inverseStep + c)));
+            // max returns the second operand for NaN
+            const __m256i j = _mm256_cvttps_epi32(_mm256_min_ps(_mm256_max_ps(f, _mm256_setzero_ps()), _mm256_set1_ps(last)));
+            const __m256i k = _mm256_add_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(offset + c)), j);
+            const __m256 below = _mm256_cmp_ps(_mm256_i32gather_ps(table, _mm256_add_epi32(k, _mm256_set1_epi32(1)), 4), x, _CMP_LT_OQ);
+            const __m256 above = _mm256_cmp_ps(x, _mm256_i32gather_ps(table, k, 4), _CMP_LE_OQ);
+            // compare masks are -1 per lane
+            const __m256i val = _mm256_sub_epi32(_mm256_add_epi32(_mm256_sub_epi32(j, _mm256_set1_epi32(128)), _mm256_castps_si256(above)), _mm256_castps_si256(below));
+            const __m128i words = _mm_packs_epi32(_mm256_castsi256_si128(val), _mm256_extracti128_si256(val, 1));
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(ret.data() + i), _mm_packs_epi16(words, words));
+            search(i, fallback[c] & 0xff);
+        }
+#endif
+        for (; i < size; ++i) {
+            const size_t c = i % elemcount;
+            const float x = inp[i];
+            if (fallback[c] & 1) {
+                search(i, 1);
+                continue;
+            }
+            const float f = std::ceil((x - origin[c]) * inverseStep[c]);
+            // argument order makes NaN end up at 0
+            const int j = static_cast<int>(std::min(last, std::max(0.0f, f)));
+            const int k = offset[c] + j;
+            ret[i] = static_cast<int8_t>(j + (table[k + 1] < x) - (x <= table[k]) - 128);
+        }
+    }
+
     template<size_t elemcount>
-    std::vector<int8_t> multithresholdLEMT(const std::vector<float>& inp) {
-        std::vector<int8_t> ret(inp.size(), -128);
+    void multithresholdLinearPerChannel(std::span<const float> inp, std::span<int8_t> ret, const LinearIndex& index) {
+        constexpr size_t lanes = LinearChannelTable::lanes;
+        std::array<float, elemcount + lanes> origin;
+        std::array<float, elemcount + lanes> inverseStep;
+        std::array<int, elemcount + lanes> offset;
+        std::array<uint32_t, elemcount> fallback{};
+        LinearChannelTable::fill(index, elemcount, origin.data(), inverseStep.data(), offset.data(), fallback.data());
+        multithresholdLinearPerChannel(index, std::integral_constant<size_t, elemcount>{}, origin.data(), inverseStep.data(), offset.data(), fallback.data(), inp, ret);
+    }
+
+    inline void multithresholdLinearPerChannel(const LinearChannelTable& table, std::span<const float> inp, std::span<int8_t> ret) {
+        multithresholdLinearPerChannel(table.index, table.index.channels(), table.origin.data(), table.inverseStep.data(), table.offset.data(), table.fallback.data(), inp, ret);
+    }
+
+    inline std::vector<int8_t> multithresholdLinearPerChannel(const LinearChannelTable& table, const std::vector<float>& inp) {
+        std::vector<int8_t> ret(inp.size());
+        multithresholdLinearPerChannel(table, inp, ret);
+        return ret;
+    }
+
+    template<size_t elemcount>
+    std::vector<int8_t> multithresholdLinearPerChannel(const std::vector<float>& inp, const LinearIndex& index) {
+        std::vector<int8_t> ret(inp.size());
+        multithresholdLinearPerChannel<elemcount>(inp, ret, index);
+        return ret;
+    }
+
+    template<size_t elemcount>
+    void multithresholdLinearPerChannel(std::span<const float> inp, std::span<int8_t> ret) {
+        static const LinearIndex index(thresholds.data(), thresholds.size() / 255, 255);
+        multithresholdLinearPerChannel<elemcount>(inp, ret, index);
+    }
+
+    template<size_t elemcount>
+    std::vector<int8_t> multithresholdLinearPerChannel(const std::vector<float>& inp) {
+        std::vector<int8_t> ret(inp.size());
+        multithresholdLinearPerChannel<elemcount>(inp, ret);
+        return ret;
+    }
+
+    template<size_t elemcount>
+    void multithresholdLEMT(std::span<const float> inp, std::span<int8_t> ret, LESearch search = LESearch::Binary) {
+        ret = FinnUtils::outputFor(inp, ret);
+        std::fill(ret.begin(), ret.end(), int8_t{ -128 });
         constexpr auto begin = thresholds.begin();
         if (inp.size() == elemcount) {
             for (int elemindex = 0; elemindex < elemcount; ++elemindex) {
@@ -150,35 +521,1181 @@ namespace optimized {
             }
         }
         else {
-            std::size_t threadcount = std::min({ elemcount ,static_cast<std::size_t>(omp_get_num_procs()), FinnUtils::fastLog2(inp.size() / elemcount) });
-            omp_set_num_threads(threadcount);
-#pragma omp parallel for
-            for (int elemindex = 0; elemindex < elemcount; ++elemindex) {
-                float last = std::numeric_limits<float>::lowest();
-                std::size_t indexLast = 0;
-                for (size_t batchindex = 0; batchindex < inp.size() / elemcount; ++batchindex) {
-                    float curr = inp[batchindex * elemcount + elemindex];
-                    std::size_t indexCurr = 0;
-                    if (curr == last) {
-                        indexCurr = indexLast;
+            const FinnUtils::ThresholdTable table(thresholds.data(), elemcount, 255);
+            const int threadcount = static_cast<int>(std::max<std::size_t>(std::min({ elemcount ,static_cast<std::size_t>(omp_get_num_procs()), FinnUtils::fastLog2(inp.size() / elemcount) }), 1));
+#pragma omp parallel for num_threads(threadcount)
+            for (size_t elemindex = 0; elemindex < elemcount; ++elemindex) {
+                multithresholdLEChannel(table, inp, ret, elemindex, 0, inp.size() / elemcount, search);
+            }
+        }
+    }
+
+    template<size_t elemcount>
+    std::vector<int8_t> multithresholdLEMT(const std::vector<float>& inp) {
+        std::vector<int8_t> ret(inp.size());
+        multithresholdLEMT<elemcount>(inp, ret);
+        return ret;
+    }
+
+    /**
+     * Branchless vertical binary search. Every SIMD lane searches the 255 thresholds of its own channel,
+     * the 8 halving steps are done with a gather and a compare per step. Counts thresholds strictly
+     * smaller than the input, so the result is bit exact to referenceOuter (including ties and NaN).
+     */
+    template<size_t elemcount>
+    void multithresholdSIMD(std::span<const float> inp, std::span<int8_t> ret) {
+        const size_t size = inp.size();
+        ret = FinnUtils::outputFor(inp, ret);
+        // Channel offsets into thresholds for every position of a row, repeated so an unaligned
+        // vector load at any row position yields the offsets of the following lanes
+        constexpr size_t lanes = 16;
+        std::array<int, elemcount + lanes> offsets;
+        for (size_t k = 0; k < offsets.size(); ++k) {
+            offsets[k] = static_cast<int>((k % elemcount) * 255);
+        }
+        size_t i = 0;
+#if defined(__AVX512F__)
+        for (; i + 16 <= size; i += 16) {
+            const __m512i base = _mm512_loadu_si512(offsets.data() + i % elemcount);
+            const __m512 x = _mm512_loadu_ps(inp.data() + i);
+            __m512i pos = _mm512_setzero_si512();
+            for (int step = 128; step > 0; step >>= 1) {
+                const __m512i probe = _mm512_add_epi32(base, _mm512_add_epi32(pos, _mm512_set1_epi32(step - 1)));
+                const __m512 t = _mm512_i32gather_ps(probe, thresholds.data(), 4);
+                const __mmask16 lt = _mm512_cmp_ps_mask(t, x, _CMP_LT_OQ);
+                pos = _mm512_mask_add_epi32(pos, lt, pos, _mm512_set1_epi32(step));
+            }
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(ret.data() + i), _mm512_cvtsepi32_epi8(_mm512_sub_epi32(pos, _mm512_set1_epi32(128))));
+        }
+#endif
+#if defined(__AVX2__)
+        for (; i + 8 <= size; i += 8) {
+            const __m256i base = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(offsets.data() + i % elemcount));
+            const __m256 x = _mm256_loadu_ps(inp.data() + i);
+            __m256i pos = _mm256_setzero_si256();
+            for (int step = 128; step > 0; step >>= 1) {
+                const __m256i probe = _mm256_add_epi32(base, _mm256_add_epi32(pos, _mm256_set1_epi32(step - 1)));
+                const __m256 t = _mm256_i32gather_ps(thresholds.data(), probe, 4);
+                const __m256i lt = _mm256_castps_si256(_mm256_cmp_ps(t, x, _CMP_LT_OQ));
+                pos = _mm256_add_epi32(pos, _mm256_and_si256(lt, _mm256_set1_epi32(step)));
+            }
+            const __m256i val = _mm256_sub_epi32(pos, _mm256_set1_epi32(128));
+            const __m128i words = _mm_packs_epi32(_mm256_castsi256_si128(val), _mm256_extracti128_si256(val, 1));
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(ret.data() + i), _mm_packs_epi16(words, words));
+        }
+#endif
+        for (; i < size; ++i) {
+            const int base = offsets[i % elemcount];
+            int pos = 0;
+            for (int step = 128; step > 0; step >>= 1) {
+                pos += (thresholds[base + pos + step - 1] < inp[i]) * step;
+            }
+            ret[i] = static_cast<int8_t>(pos - 128);
+        }
+    }
+
+    template<size_t elemcount>
+    std::vector<int8_t> multithresholdSIMD(const std::vector<float>& inp) {
+        std::vector<int8_t> ret(inp.size());
+        multithresholdSIMD<elemcount>(inp, ret);
+        return ret;
+    }
+
+    /**
+     * Gather-free kernel on the channel-interleaved thresholdsSoA layout. For each row, soaWidth adjacent channels
+     * share one register and all 255 thresholds are streamed with aligned loads, counting the ones below the input.
+     * A 24 channel row is covered by three AVX2 registers. Bit exact to referenceOuter.
+     */
+    template<size_t elemcount>
+    void multithresholdSoA(std::span<const float> inp, std::span<int8_t> ret) {
+        constexpr size_t groups = elemcount / soaWidth;
+        ret = FinnUtils::outputFor(inp, ret);
+        for (size_t batchindex = 0; batchindex < inp.size() / elemcount; ++batchindex) {
+            const float* row = inp.data() + batchindex * elemcount;
+            int8_t* out = ret.data() + batchindex * elemcount;
+#if defined(__AVX2__)
+            __m256 x[groups];
+            __m256i count[groups];
+            for (size_t g = 0; g < groups; ++g) {
+                x[g] = _mm256_loadu_ps(row + g * soaWidth);
+                count[g] = _mm256_setzero_si256();
+            }
+            for (size_t k = 0; k < 255; ++k) {
+                for (size_t g = 0; g < groups; ++g) {
+                    const __m256 t = _mm256_load_ps(thresholdsSoA.data() + (g * 255 + k) * soaWidth);
+                    // compare mask is -1 per lane, so subtracting it counts
+                    count[g] = _mm256_sub_epi32(count[g], _mm256_castps_si256(_mm256_cmp_ps(t, x[g], _CMP_LT_OQ)));
+                }
+            }
+            for (size_t g = 0; g < groups; ++g) {
+                const __m256i val = _mm256_sub_epi32(count[g], _mm256_set1_epi32(128));
+                const __m128i words = _mm_packs_epi32(_mm256_castsi256_si128(val), _mm256_extracti128_si256(val, 1));
+                _mm_storel_epi64(reinterpret_cast<__m128i*>(out + g * soaWidth), _mm_packs_epi16(words, words));
+            }
+#else
+            for (size_t g = 0; g < groups; ++g) {
+                std::array<int, soaWidth> count{};
+                for (size_t k = 0; k < 255; ++k) {
+                    for (size_t lane = 0; lane < soaWidth; ++lane) {
+                        count[lane] += thresholdsSoA[(g * 255 + k) * soaWidth + lane] < row[g * soaWidth + lane];
                     }
-                    else if (curr > last) {
-                        // search [last+1, end)
-                        indexCurr = std::distance(begin + elemindex * 255 + indexLast, std::upper_bound(begin + elemindex * 255 + indexLast, begin + (elemindex + 1) * 255, curr));
+                }
+                for (size_t lane = 0; lane < soaWidth; ++lane) {
+                    out[g * soaWidth + lane] = static_cast<int8_t>(count[lane] - 128);
+                }
+            }
+#endif
+            // channels not filling a whole register
+            for (size_t c = groups * soaWidth; c < elemcount; ++c) {
+                int count = 0;
+                for (size_t k = 0; k < 255; ++k) {
+                    count += thresholdsSoA[(groups * 255 + k) * soaWidth + c % soaWidth] < row[c];
+                }
+                out[c] = static_cast<int8_t>(count - 128);
+            }
+        }
+    }
+
+    template<size_t elemcount>
+    std::vector<int8_t> multithresholdSoA(const std::vector<float>& inp) {
+        std::vector<int8_t> ret(inp.size());
+        multithresholdSoA<elemcount>(inp, ret);
+        return ret;
+    }
+
+
+    // ------ RUNTIME TABLES ------
+    // Same kernels as above for a ThresholdTable loaded at runtime, the channel count is taken from the table and the
+    // output is -128 plus the number of thresholds passed.
+
+    inline void multithresholdLinearPerTensor(const FinnUtils::ThresholdTable& table, std::span<const float> inp, std::span<int8_t> ret, FinnUtils::ScratchArena& scratch = FinnUtils::threadScratch()) {
+        const size_t size = inp.size();
+        const int last = static_cast<int>(table.count()) - 1;
+        const float* t = table.data();
+        const float scale = table.count() / (t[last] - t[0]);
+        ret = FinnUtils::outputFor(inp, ret);
+        std::fill(ret.begin(), ret.end(), int8_t{ -128 });
+        const std::span<int> protoRet = scratch.get<int>(size);
+#pragma omp simd
+        for (size_t i = 0; i < size; ++i) {
+            protoRet[i] = std::clamp(static_cast<int>((inp[i] - t[0]) * scale), 0, last);
+        }
+#pragma omp simd
+        for (size_t i = 0; i < size; ++i) {
+            const int val = protoRet[i];
+            ret[i] += static_cast<int>(inp[i] - t[val] + 1.0f) + val;
+        }
+    }
+
+    inline std::vector<int8_t> multithresholdLinearPerTensor(const FinnUtils::ThresholdTable& table, const std::vector<float>& inp) {
+        std::vector<int8_t> ret(inp.size());
+        multithresholdLinearPerTensor(table, inp, ret);
+        return ret;
+    }
+
+    /**
+     * multithresholdLinearPerTensor handing its counts to emit(i, counts) like multithresholdSIMDCounts, 16 (AVX-512)
+     * or 8 (AVX2) at a time. The counts wrap to [0, 256) exactly like the int8 output.
+     */
+    template<typename Emit>
+    void multithresholdLinearPerTensorCounts(const FinnUtils::ThresholdTable& table, std::span<const float> inp, Emit&& emit) {
+        const size_t size = inp.size();
+        const int last = static_cast<int>(table.count()) - 1;
+        const float* t = table.data();
+        const float scale = table.count() / (t[last] - t[0]);
+        const auto count = [&](size_t i) {
+            const int val = std::clamp(static_cast<int>((inp[i] - t[0]) * scale), 0, last);
+            return static_cast<int>(static_cast<uint8_t>(static_cast<int>(inp[i] - t[val] + 1.0f) + val));
+        };
+        size_t i = 0;
+#if defined(__AVX512F__)
+        for (; i + 16 <= size; i += 16) {
+            alignas(64) int counts[16];
+#pragma omp simd
+            for (size_t lane = 0; lane < 16; ++lane) {
+                counts[lane] = count(i + lane);
+            }
+            emit(i, _mm512_load_si512(counts));
+        }
+#elif defined(__AVX2__)
+        for (; i + 8 <= size; i += 8) {
+            alignas(32) int counts[8];
+#pragma omp simd
+            for (size_t lane = 0; lane < 8; ++lane) {
+                counts[lane] = count(i + lane);
+            }
+            emit(i, _mm256_load_si256(reinterpret_cast<const __m256i*>(counts)));
+        }
+#endif
+        for (; i < size; ++i) {
+            emit(i, count(i));
+        }
+    }
+
+    inline void multithreshold(const FinnUtils::ThresholdTable& table, std::span<const float> inp, std::span<int8_t> ret) {
+        const size_t elemcount = table.channels();
+        ret = FinnUtils::outputFor(inp, ret);
+        for (size_t batchindex = 0; batchindex < inp.size() / elemcount; ++batchindex) {
+            for (size_t elemindex = 0; elemindex < elemcount; ++elemindex) {
+                const auto channel = table.channel(elemindex);
+                ret[batchindex * elemcount + elemindex] = -128 + std::distance(channel.begin(), std::upper_bound(channel.begin(), channel.end(), inp[batchindex * elemcount + elemindex]));
+            }
+        }
+    }
+
+    inline std::vector<int8_t> multithreshold(const FinnUtils::ThresholdTable& table, const std::vector<float>& inp) {
+        std::vector<int8_t> ret(inp.size());
+        multithreshold(table, inp, ret);
+        return ret;
+    }
+
+    inline void multithresholdLE(const FinnUtils::ThresholdTable& table, std::span<const float> inp, std::span<int8_t> ret, LESearch search = LESearch::Binary) {
+        ret = FinnUtils::outputFor(inp, ret);
+        std::fill(ret.begin(), ret.end(), int8_t{ -128 });
+        for (size_t elemindex = 0; elemindex < table.channels(); ++elemindex) {
+            multithresholdLEChannel(table, inp, ret, elemindex, 0, inp.size() / table.channels(), search);
+        }
+    }
+
+    inline std::vector<int8_t> multithresholdLE(const FinnUtils::ThresholdTable& table, const std::vector<float>& inp) {
+        std::vector<int8_t> ret(inp.size());
+        multithresholdLE(table, inp, ret);
+        return ret;
+    }
+
+    inline void multithresholdLEMT(const FinnUtils::ThresholdTable& table, std::span<const float> inp, std::span<int8_t> ret, LESearch search = LESearch::Binary) {
+        const size_t elemcount = table.channels();
+        ret = FinnUtils::outputFor(inp, ret);
+        std::fill(ret.begin(), ret.end(), int8_t{ -128 });
+        const int threadcount = static_cast<int>(std::min({ elemcount, static_cast<std::size_t>(omp_get_num_procs()), std::max<std::size_t>(FinnUtils::fastLog2(inp.size() / elemcount), 1) }));
+#pragma omp parallel for num_threads(threadcount)
+        for (size_t elemindex = 0; elemindex < elemcount; ++elemindex) {
+            multithresholdLEChannel(table, inp, ret, elemindex, 0, inp.size() / table.channels(), search);
+        }
+    }
+
+    inline std::vector<int8_t> multithresholdLEMT(const FinnUtils::ThresholdTable& table, const std::vector<float>& inp) {
+        std::vector<int8_t> ret(inp.size());
+        multithresholdLEMT(table, inp, ret);
+        return ret;
+    }
+
+    /**
+     * multithresholdLE and multithresholdLEMT with the count of every element of the full rows handed to
+     * emit(i, count), i being the flat index, instead of stored as int8. LEMT calls emit from several threads, but
+     * never twice for the same index.
+     */
+    template<typename Emit>
+    void multithresholdLEChannelCounts(const FinnUtils::ThresholdTable& table, std::span<const float> inp, size_t elemindex, LESearch search, Emit&& emit) {
+        const size_t elemcount = table.channels();
+        float last = std::numeric_limits<float>::lowest();
+        std::size_t indexLast = 0;
+        const auto rowEmit = [&](size_t row, int count) { emit(row * elemcount + elemindex, count); };
+        if (search == LESearch::Gallop) {
+            leWalkCounts<LESearch::Gallop>(table.channel(elemindex), inp.data() + elemindex, elemcount, inp.size() / elemcount, last, indexLast, rowEmit);
+        }
+        else {
+            leWalkCounts<LESearch::Binary>(table.channel(elemindex), inp.data() + elemindex, elemcount, inp.size() / elemcount, last, indexLast, rowEmit);
+        }
+    }
+
+    template<typename Emit>
+    void multithresholdLECounts(const FinnUtils::ThresholdTable& table, std::span<const float> inp, Emit&& emit, LESearch search = LESearch::Binary) {
+        for (size_t elemindex = 0; elemindex < table.channels(); ++elemindex) {
+            multithresholdLEChannelCounts(table, inp, elemindex, search, emit);
+        }
+    }
+
+    template<typename Emit>
+    void multithresholdLEMTCounts(const FinnUtils::ThresholdTable& table, std::span<const float> inp, Emit&& emit, LESearch search = LESearch::Binary) {
+        const size_t elemcount = table.channels();
+        const int threadcount = static_cast<int>(std::min({ elemcount, static_cast<std::size_t>(omp_get_num_procs()), std::max<std::size_t>(FinnUtils::fastLog2(inp.size() / elemcount), 1) }));
+#pragma omp parallel for num_threads(threadcount)
+        for (size_t elemindex = 0; elemindex < elemcount; ++elemindex) {
+            multithresholdLEChannelCounts(table, inp, elemindex, search, emit);
+        }
+    }
+
+    /**
+     * multithresholdLE without the channel strided reads: blocks of rows that fit into L1 are transposed into a
+     * channel-major tile, every channel is then walked on contiguous data and written straight back in row order
+     * (the output block is in L1 as well). The walk state of every channel carries over from block to block, so the
+     * input is streamed once instead of once per channel.
+     */
+    inline void multithresholdLEBlocked(const FinnUtils::ThresholdTable& table, std::span<const float> inp, std::span<int8_t> ret, LESearch search = LESearch::Binary, FinnUtils::ScratchArena& scratch = FinnUtils::threadScratch()) {
+        constexpr size_t tileBytes = 16 * 1024;
+        ret = FinnUtils::outputFor(inp, ret);
+        const size_t elemcount = table.channels();
+        const size_t rows = inp.size() / elemcount;
+        const size_t blockRows = std::max<size_t>(tileBytes / (elemcount * sizeof(float)), 16);
+        // walk state per channel, followed by the tile
+        const std::span<size_t> state = scratch.get<size_t>(elemcount + (elemcount * (blockRows + 1) + 1) / 2);
+        size_t* indexLast = state.data();
+        float* last = reinterpret_cast<float*>(state.data() + elemcount);
+        float* tile = last + elemcount;
+        std::fill(indexLast, indexLast + elemcount, size_t{ 0 });
+        std::fill(last, last + elemcount, std::numeric_limits<float>::lowest());
+        const auto walk = (search == LESearch::Gallop) ? leWalk<LESearch::Gallop> : leWalk<LESearch::Binary>;
+        for (size_t row = 0; row < rows; row += blockRows) {
+            const size_t n = std::min(blockRows, rows - row);
+            const float* block = inp.data() + row * elemcount;
+            for (size_t r = 0; r < n; ++r) {
+                for (size_t c = 0; c < elemcount; ++c) {
+                    tile[c * blockRows + r] = block[r * elemcount + c];
+                }
+            }
+            for (size_t c = 0; c < elemcount; ++c) {
+                walk(table.channel(c), tile + c * blockRows, 1, ret.data() + row * elemcount + c, elemcount, n, last[c], indexLast[c]);
+            }
+        }
+        std::fill(ret.begin() + rows * elemcount, ret.end(), int8_t{ -128 });
+    }
+
+    inline std::vector<int8_t> multithresholdLEBlocked(const FinnUtils::ThresholdTable& table, const std::vector<float>& inp) {
+        std::vector<int8_t> ret(inp.size());
+        multithresholdLEBlocked(table, inp, ret);
+        return ret;
+    }
+
+    template<size_t elemcount>
+    void multithresholdLEBlocked(std::span<const float> inp, std::span<int8_t> ret, LESearch search = LESearch::Binary) {
+        multithresholdLEBlocked(FinnUtils::ThresholdTable(thresholds.data(), elemcount, 255), inp, ret, search);
+    }
+
+    /**
+     * Sort-and-merge counterpart of multithresholdLE for very large batches. Per channel the values are radix sorted
+     * (LSD, 8 bits per pass, passes where all keys share the digit are skipped) together with their row, merged against
+     * the sorted thresholds in O(rows + count) and the results scattered back. Same results as multithresholdLE,
+     * NaN counts every threshold like upper_bound does.
+     */
+    inline void multithresholdSortMerge(const FinnUtils::ThresholdTable& table, std::span<const float> inp, std::span<int8_t> ret, FinnUtils::ScratchArena& scratch = FinnUtils::threadScratch()) {
+        ret = FinnUtils::outputFor(inp, ret);
+        const size_t elemcount = table.channels();
+        const size_t rows = inp.size() / elemcount;
+        const size_t count = table.count();
+        // keys and rows, twice for the ping-pong between passes
+        const std::span<uint32_t> buffer = scratch.get<uint32_t>(4 * rows);
+        uint32_t* keys = buffer.data();
+        uint32_t* order = keys + rows;
+        uint32_t* keysOut = order + rows;
+        uint32_t* orderOut = keysOut + rows;
+        for (size_t c = 0; c < elemcount; ++c) {
+            size_t n = 0;
+            for (size_t r = 0; r < rows; ++r) {
+                const float value = inp[r * elemcount + c];
+                if (std::isnan(value)) {
+                    ret[r * elemcount + c] = static_cast<int8_t>(-128 + static_cast<int>(count));
+                    continue;
+                }
+                keys[n] = FinnUtils::orderedKey(value);
+                order[n] = static_cast<uint32_t>(r);
+                ++n;
+            }
+            uint32_t* k = keys;
+            uint32_t* o = order;
+            uint32_t* kOut = keysOut;
+            uint32_t* oOut = orderOut;
+            for (unsigned int shift = 0; shift < 32; shift += 8) {
+                std::array<size_t, 256> offsets{};
+                for (size_t i = 0; i < n; ++i) {
+                    ++offsets[(k[i] >> shift) & 0xFF];
+                }
+                if (n == 0 || offsets[(k[0] >> shift) & 0xFF] == n) {
+                    continue;
+                }
+                size_t sum = 0;
+                for (auto&& offset : offsets) {
+                    sum += std::exchange(offset, sum);
+                }
+                for (size_t i = 0; i < n; ++i) {
+                    const size_t slot = offsets[(k[i] >> shift) & 0xFF]++;
+                    kOut[slot] = k[i];
+                    oOut[slot] = o[i];
+                }
+                std::swap(k, kOut);
+                std::swap(o, oOut);
+            }
+            const auto channel = table.channel(c);
+            size_t passed = 0;
+            for (size_t i = 0; i < n; ++i) {
+                const float value = FinnUtils::fromOrderedKey(k[i]);
+                while (passed < count && channel[passed] <= value) {
+                    ++passed;
+                }
+                ret[o[i] * elemcount + c] = static_cast<int8_t>(-128 + static_cast<int>(passed));
+            }
+        }
+        std::fill(ret.begin() + rows * elemcount, ret.end(), int8_t{ -128 });
+    }
+
+    inline std::vector<int8_t> multithresholdSortMerge(const FinnUtils::ThresholdTable& table, const std::vector<float>& inp) {
+        std::vector<int8_t> ret(inp.size());
+        multithresholdSortMerge(table, inp, ret);
+        return ret;
+    }
+
+    /**
+     * Picks multithresholdLE or multithresholdSortMerge by batch size. The crossover is measured once at construction
+     * on uniform inputs over the threshold range, sort-and-merge is used from the first calibrated batch size on
+     * where it was faster at that size and at the next one (a single noisy sample does not move the crossover).
+     */
+    class AutoLE {
+        private:
+        FinnUtils::ThresholdTable table;
+        size_t sortRows = std::numeric_limits<size_t>::max();
+
+        template<typename Kernel>
+        static std::chrono::nanoseconds time(Kernel&& kernel, std::span<const float> inp, std::span<int8_t> ret) {
+            // the first round only warms the caches, the best of three is kept against timer noise
+            kernel(inp, ret);
+            auto best = std::chrono::nanoseconds::max();
+            for (int round = 0; round < 3; ++round) {
+                const auto start = std::chrono::steady_clock::now();
+                kernel(inp, ret);
+                best = std::min(best, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start));
+            }
+            return best;
+        }
+
+        public:
+        static constexpr std::array<size_t, 5> calibrationRows = { 64, 256, 1024, 4096, 16384 };
+
+        explicit AutoLE(const FinnUtils::ThresholdTable& thresholds) : table(thresholds) {
+            const auto [lowest, highest] = std::minmax_element(table.data(), table.data() + table.size());
+            const float margin = (*highest - *lowest) * 0.1f;
+            std::mt19937 engine{ 42 };
+            std::uniform_real_distribution<float> dist{ *lowest - margin, *highest + margin };
+            std::vector<float> sample(calibrationRows.back() * table.channels());
+            std::generate(sample.begin(), sample.end(), [&]() { return dist(engine); });
+            std::vector<int8_t> out(sample.size());
+            std::array<bool, calibrationRows.size()> mergeWins{};
+            for (size_t k = 0; k < calibrationRows.size(); ++k) {
+                const std::span<const float> inp(sample.data(), calibrationRows[k] * table.channels());
+                const auto le = time([this](std::span<const float> in, std::span<int8_t> o) { multithresholdLE(table, in, o); }, inp, out);
+                const auto merge = time([this](std::span<const float> in, std::span<int8_t> o) { multithresholdSortMerge(table, in, o); }, inp, out);
+                mergeWins[k] = merge < le;
+            }
+            // the largest size has no next one to confirm it
+            for (size_t k = 0; k < calibrationRows.size(); ++k) {
+                if (mergeWins[k] && (k + 1 == calibrationRows.size() || mergeWins[k + 1])) {
+                    sortRows = calibrationRows[k];
+                    break;
+                }
+            }
+        }
+
+        // Batch size (rows) from which sort-and-merge is used
+        size_t threshold() const { return sortRows; }
+
+        void operator()(std::span<const float> inp, std::span<int8_t> ret) const {
+            if (inp.size() / table.channels() >= sortRows) {
+                multithresholdSortMerge(table, inp, ret);
+            }
+            else {
+                multithresholdLE(table, inp, ret);
+            }
+        }
+
+        std::vector<int8_t> operator()(const std::vector<float>& inp) const {
+            std::vector<int8_t> ret(inp.size());
+            (*this)(std::span<const float>(inp), std::span<int8_t>(ret));
+            return ret;
+        }
+    };
+
+    /**
+     * Tiling of a batch for the LE walk. The batch is cut into blocks of rows whose inputs fit into L2, every block
+     * restarts the walk, and when there are fewer blocks than threads the channels are split into groups as well.
+     * Tile t covers block t / groups and channel group t % groups.
+     */
+    struct LETiling {
+        static constexpr size_t blockBytes = 128 * 1024;
+        static constexpr size_t minRows = 64;
+
+        size_t rows;
+        size_t channels;
+        size_t rowBlock;
+        size_t blocks;
+        size_t groups;
+
+        LETiling(size_t rowCount, size_t channelCount, size_t threads) : rows(rowCount), channels(channelCount) {
+            threads = std::max<size_t>(threads, 1);
+            rowBlock = std::max(blockBytes / (channels * sizeof(float)), minRows);
+            blocks = std::max<size_t>((rows + rowBlock - 1) / rowBlock, 1);
+            // enough blocks to keep every thread busy, as long as blocks keep minRows rows
+            const size_t wanted = std::min(threads, std::max<size_t>(rows / minRows, 1));
+            if (blocks < wanted) {
+                blocks = wanted;
+            }
+            rowBlock = (rows + blocks - 1) / blocks;
+            groups = std::min((threads + blocks - 1) / blocks, channels);
+        }
+
+        size_t tiles() const { return blocks * groups; }
+
+        // Runs the walk of one tile
+        void run(const FinnUtils::ThresholdTable& table, std::span<const float> inp, std::span<int8_t> ret, size_t tile, LESearch search = LESearch::Binary) const {
+            const size_t block = tile / groups;
+            const auto [channelBegin, channelEnd] = FinnUtils::ThreadPool::split(channels, groups, tile % groups);
+            for (size_t elemindex = channelBegin; elemindex < channelEnd; ++elemindex) {
+                multithresholdLEChannel(table, inp, ret, elemindex, block * rowBlock, (block + 1) * rowBlock, search);
+            }
+        }
+    };
+
+    /**
+     * multithresholdLEMT over batch x channel tiles instead of channels only, so the thread count is no longer capped
+     * by the channel count and every thread streams through an L2 sized block of rows
+     */
+    inline void multithresholdLEMTTiled(const FinnUtils::ThresholdTable& table, std::span<const float> inp, std::span<int8_t> ret, int threads = omp_get_max_threads(), LESearch search = LESearch::Binary) {
+        ret = FinnUtils::outputFor(inp, ret);
+        std::fill(ret.begin(), ret.end(), int8_t{ -128 });
+        const LETiling tiling(inp.size() / table.channels(), table.channels(), threads);
+        const int threadcount = static_cast<int>(std::min<size_t>(threads, tiling.tiles()));
+#pragma omp parallel for schedule(dynamic) num_threads(threadcount)
+        for (size_t tile = 0; tile < tiling.tiles(); ++tile) {
+            tiling.run(table, inp, ret, tile, search);
+        }
+    }
+
+    inline std::vector<int8_t> multithresholdLEMTTiled(const FinnUtils::ThresholdTable& table, const std::vector<float>& inp) {
+        std::vector<int8_t> ret(inp.size());
+        multithresholdLEMTTiled(table, inp, ret);
+        return ret;
+    }
+
+    template<size_t elemcount>
+    void multithresholdLEMTTiled(std::span<const float> inp, std::span<int8_t> ret, int threads = omp_get_max_threads(), LESearch search = LESearch::Binary) {
+        multithresholdLEMTTiled(FinnUtils::ThresholdTable(thresholds.data(), elemcount, 255), inp, ret, threads, search);
+    }
+
+    /**
+     * The search of multithresholdSIMD for any threshold count. Probes past the end of a channel are clamped and masked
+     * out. The threshold counts are handed to emit(i, counts) as an __m512i of 16 or an __m256i of 8 elements starting
+     * at inp[i], or as an int for the scalar tail, so epilogues can convert them without going through int8.
+     */
+    template<typename Emit>
+    void multithresholdSIMDCounts(const FinnUtils::ThresholdTable& table, std::span<const float> inp, Emit&& emit) {
+        const size_t elemcount = table.channels();
+        const int count = static_cast<int>(table.count());
+        const int firstStep = static_cast<int>(std::bit_floor(table.count()));
+        const float* t = table.data();
+        const size_t size = inp.size();
+        size_t i = 0;
+#if defined(__AVX2__)
+        // Channel offsets of the lanes, advanced by the vector width modulo the row instead of loaded from a table
+        const int rowEnd = static_cast<int>(elemcount) * count;
+        alignas(64) int first[16];
+        auto offsets = [&](size_t i, int n) {
+            for (int l = 0; l < n; ++l) {
+                first[l] = static_cast<int>((i + l) % elemcount) * count;
+            }
+        };
+#endif
+#if defined(__AVX512F__)
+        offsets(i, 16);
+        __m512i base = _mm512_load_si512(first);
+        const __m512i advance = _mm512_set1_epi32(static_cast<int>(16 % elemcount) * count);
+        for (; i + 16 <= size; i += 16) {
+            const __m512 x = _mm512_loadu_ps(inp.data() + i);
+            __m512i pos = _mm512_setzero_si512();
+            for (int step = firstStep; step > 0; step >>= 1) {
+                const __m512i probe = _mm512_add_epi32(pos, _mm512_set1_epi32(step - 1));
+                const __mmask16 valid = _mm512_cmplt_epi32_mask(probe, _mm512_set1_epi32(count));
+                const __m512 value = _mm512_i32gather_ps(_mm512_add_epi32(base, _mm512_min_epi32(probe, _mm512_set1_epi32(count - 1))), t, 4);
+                const __mmask16 lt = _mm512_mask_cmp_ps_mask(valid, value, x, _CMP_LT_OQ);
+                pos = _mm512_mask_add_epi32(pos, lt, pos, _mm512_set1_epi32(step));
+            }
+            emit(i, pos);
+            base = _mm512_add_epi32(base, advance);
+            base = _mm512_mask_sub_epi32(base, _mm512_cmpge_epi32_mask(base, _mm512_set1_epi32(rowEnd)), base, _mm512_set1_epi32(rowEnd));
+        }
+#endif
+#if defined(__AVX2__)
+        offsets(i, 8);
+        __m256i base8 = _mm256_load_si256(reinterpret_cast<const __m256i*>(first));
+        const __m256i advance8 = _mm256_set1_epi32(static_cast<int>(8 % elemcount) * count);
+        for (; i + 8 <= size; i += 8) {
+            const __m256i base = base8;
+            const __m256 x = _mm256_loadu_ps(inp.data() + i);
+            __m256i pos = _mm256_setzero_si256();
+            for (int step = firstStep; step > 0; step >>= 1) {
+                const __m256i probe = _mm256_add_epi32(pos, _mm256_set1_epi32(step - 1));
+                const __m256i valid = _mm256_cmpgt_epi32(_mm256_set1_epi32(count), probe);
+                const __m256 value = _mm256_i32gather_ps(t, _mm256_add_epi32(base, _mm256_min_epi32(probe, _mm256_set1_epi32(count - 1))), 4);
+                const __m256i lt = _mm256_and_si256(valid, _mm256_castps_si256(_mm256_cmp_ps(value, x, _CMP_LT_OQ)));
+                pos = _mm256_add_epi32(pos, _mm256_and_si256(lt, _mm256_set1_epi32(step)));
+            }
+            emit(i, pos);
+            base8 = _mm256_add_epi32(base8, advance8);
+            base8 = _mm256_sub_epi32(base8, _mm256_andnot_si256(_mm256_cmpgt_epi32(_mm256_set1_epi32(rowEnd), base8), _mm256_set1_epi32(rowEnd)));
+        }
+#endif
+        for (; i < size; ++i) {
+            const int base = static_cast<int>(i % elemcount) * count;
+            int pos = 0;
+            for (int step = firstStep; step > 0; step >>= 1) {
+                const int probe = pos + step - 1;
+                pos += (probe < count && t[base + probe] < inp[i]) * step;
+            }
+            emit(i, pos);
+        }
+    }
+
+    inline void multithresholdSIMD(const FinnUtils::ThresholdTable& table, std::span<const float> inp, std::span<int8_t> ret) {
+        ret = FinnUtils::outputFor(inp, ret);
+        multithresholdSIMDCounts(table, inp, [&](size_t i, auto pos) {
+            if constexpr (std::is_same_v<decltype(pos), int>) {
+                ret[i] = static_cast<int8_t>(pos - 128);
+            }
+#if defined(__AVX512F__)
+            else if constexpr (sizeof(pos) == 64) {
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(ret.data() + i), _mm512_cvtsepi32_epi8(_mm512_sub_epi32(pos, _mm512_set1_epi32(128))));
+            }
+#endif
+#if defined(__AVX2__)
+            else if constexpr (sizeof(pos) == 32) {
+                const __m256i val = _mm256_sub_epi32(pos, _mm256_set1_epi32(128));
+                const __m128i words = _mm_packs_epi32(_mm256_castsi256_si128(val), _mm256_extracti128_si256(val, 1));
+                _mm_storel_epi64(reinterpret_cast<__m128i*>(ret.data() + i), _mm_packs_epi16(words, words));
+            }
+#endif
+        });
+    }
+
+    inline std::vector<int8_t> multithresholdSIMD(const FinnUtils::ThresholdTable& table, const std::vector<float>& inp) {
+        std::vector<int8_t> ret(inp.size());
+        multithresholdSIMD(table, inp, ret);
+        return ret;
+    }
+
+    /**
+     * Threshold table converted once to FinnUtils::floatKey, for the integer compare kernels
+     */
+    struct KeyTable {
+        size_t channels;
+        size_t count;
+        FinnUtils::AlignedVector<int32_t> keys;
+        // Channel offsets into keys for every position of a row, repeated so a 16 lane load at any position works
+        std::vector<int> offsets;
+
+        explicit KeyTable(const FinnUtils::ThresholdTable& table) : channels(table.channels()), count(table.count()), keys(table.size()), offsets(table.channels() + 16) {
+            std::transform(table.data(), table.data() + table.size(), keys.begin(), FinnUtils::floatKey);
+            for (size_t k = 0; k < offsets.size(); ++k) {
+                offsets[k] = static_cast<int>((k % channels) * count);
+            }
+        }
+    };
+
+    /**
+     * multithresholdSIMD in the integer key domain. Inputs are converted to keys on the fly (an add, a shift, two
+     * logic ops and a NaN blend), after that every probe is an integer gather and compare. Bit exact to referenceOuter,
+     * -0.0 and NaN included.
+     */
+    inline void multithresholdKeys(const KeyTable& table, std::span<const float> inp, std::span<int8_t> ret) {
+        ret = FinnUtils::outputFor(inp, ret);
+        const size_t elemcount = table.channels;
+        const int count = static_cast<int>(table.count);
+        const int firstStep = static_cast<int>(std::bit_floor(table.count));
+        const int32_t* t = table.keys.data();
+        const size_t size = inp.size();
+        const std::vector<int>& offsets = table.offsets;
+        size_t i = 0;
+#if defined(__AVX512F__)
+        for (; i + 16 <= size; i += 16) {
+            const __m512i base = _mm512_loadu_si512(offsets.data() + i % elemcount);
+            const __m512i x = FinnUtils::floatKeys(_mm512_loadu_ps(inp.data() + i));
+            __m512i pos = _mm512_setzero_si512();
+            for (int step = firstStep; step > 0; step >>= 1) {
+                const __m512i probe = _mm512_add_epi32(pos, _mm512_set1_epi32(step - 1));
+                const __mmask16 valid = _mm512_cmplt_epi32_mask(probe, _mm512_set1_epi32(count));
+                const __m512i value = _mm512_i32gather_epi32(_mm512_add_epi32(base, _mm512_min_epi32(probe, _mm512_set1_epi32(count - 1))), t, 4);
+                const __mmask16 lt = _mm512_mask_cmplt_epi32_mask(valid, value, x);
+                pos = _mm512_mask_add_epi32(pos, lt, pos, _mm512_set1_epi32(step));
+            }
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(ret.data() + i), _mm512_cvtsepi32_epi8(_mm512_sub_epi32(pos, _mm512_set1_epi32(128))));
+        }
+#endif
+#if defined(__AVX2__)
+        for (; i + 8 <= size; i += 8) {
+            const __m256i base = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(offsets.data() + i % elemcount));
+            const __m256i x = FinnUtils::floatKeys(_mm256_loadu_ps(inp.data() + i));
+            __m256i pos = _mm256_setzero_si256();
+            for (int step = firstStep; step > 0; step >>= 1) {
+                const __m256i probe = _mm256_add_epi32(pos, _mm256_set1_epi32(step - 1));
+                const __m256i valid = _mm256_cmpgt_epi32(_mm256_set1_epi32(count), probe);
+                const __m256i value = _mm256_i32gather_epi32(t, _mm256_add_epi32(base, _mm256_min_epi32(probe, _mm256_set1_epi32(count - 1))), 4);
+                const __m256i lt = _mm256_and_si256(valid, _mm256_cmpgt_epi32(x, value));
+                pos = _mm256_add_epi32(pos, _mm256_and_si256(lt, _mm256_set1_epi32(step)));
+            }
+            const __m256i val = _mm256_sub_epi32(pos, _mm256_set1_epi32(128));
+            const __m128i words = _mm_packs_epi32(_mm256_castsi256_si128(val), _mm256_extracti128_si256(val, 1));
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(ret.data() + i), _mm_packs_epi16(words, words));
+        }
+#endif
+        for (; i < size; ++i) {
+            const int base = offsets[i % elemcount];
+            const int32_t x = FinnUtils::floatKey(inp[i]);
+            int pos = 0;
+            for (int step = firstStep; step > 0; step >>= 1) {
+                const int probe = pos + step - 1;
+                pos += (probe < count && t[base + probe] < x) * step;
+            }
+            ret[i] = static_cast<int8_t>(pos - 128);
+        }
+    }
+
+    inline std::vector<int8_t> multithresholdKeys(const KeyTable& table, const std::vector<float>& inp) {
+        std::vector<int8_t> ret(inp.size());
+        multithresholdKeys(table, inp, ret);
+        return ret;
+    }
+
+    /**
+     * Requantizes int8 inputs through the maps of a QuantizedTable. A uniform table is looked up 64 bytes per step with
+     * two vpermi2b (AVX-512 VBMI) or 32 bytes with 16 nibble vpshufb (AVX2), without a single compare. The channel of
+     * per-channel maps changes from lane to lane, so they are gathered instead: the 32 bit word holding map[c][q] is
+     * gathered for 16 (AVX-512) or 8 (AVX2) lanes and shifted down to the byte of q.
+     */
+    inline void multithresholdQuantizedChannels(const FinnUtils::QuantizedTable& table, std::span<const int8_t> inp, std::span<int8_t> ret) {
+        const size_t elemcount = table.channels;
+        const size_t size = inp.size();
+        size_t i = 0;
+#if defined(__AVX2__)
+        const int* words = reinterpret_cast<const int*>(table.maps.data());
+        // word offsets of the lane maps, advanced by the vector width modulo the row as in multithresholdSIMDCounts
+        const int rowEnd = static_cast<int>(elemcount) * 64;
+        alignas(64) int first[16];
+        auto offsets = [&](size_t i, int n) {
+            for (int l = 0; l < n; ++l) {
+                first[l] = static_cast<int>((i + l) % elemcount) * 64;
+            }
+        };
+#endif
+#if defined(__AVX512F__)
+        offsets(i, 16);
+        __m512i base = _mm512_load_si512(first);
+        const __m512i advance = _mm512_set1_epi32(static_cast<int>(16 % elemcount) * 64);
+        for (; i + 16 <= size; i += 16) {
+            const __m512i q = _mm512_cvtepu8_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(inp.data() + i)));
+            const __m512i word = _mm512_i32gather_epi32(_mm512_add_epi32(base, _mm512_srli_epi32(q, 2)), words, 4);
+            const __m512i value = _mm512_srlv_epi32(word, _mm512_slli_epi32(_mm512_and_si512(q, _mm512_set1_epi32(3)), 3));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(ret.data() + i), _mm512_cvtepi32_epi8(value));
+            base = _mm512_add_epi32(base, advance);
+            base = _mm512_mask_sub_epi32(base, _mm512_cmpge_epi32_mask(base, _mm512_set1_epi32(rowEnd)), base, _mm512_set1_epi32(rowEnd));
+        }
+#endif
+#if defined(__AVX2__)
+        offsets(i, 8);
+        __m256i base8 = _mm256_load_si256(reinterpret_cast<const __m256i*>(first));
+        const __m256i advance8 = _mm256_set1_epi32(static_cast<int>(8 % elemcount) * 64);
+        for (; i + 8 <= size; i += 8) {
+            const __m256i q = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(inp.data() + i)));
+            const __m256i word = _mm256_i32gather_epi32(words, _mm256_add_epi32(base8, _mm256_srli_epi32(q, 2)), 4);
+            const __m256i value = _mm256_and_si256(_mm256_srlv_epi32(word, _mm256_slli_epi32(_mm256_and_si256(q, _mm256_set1_epi32(3)), 3)), _mm256_set1_epi32(0xff));
+            const __m128i shorts = _mm_packus_epi32(_mm256_castsi256_si128(value), _mm256_extracti128_si256(value, 1));
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(ret.data() + i), _mm_packus_epi16(shorts, shorts));
+            base8 = _mm256_add_epi32(base8, advance8);
+            base8 = _mm256_sub_epi32(base8, _mm256_andnot_si256(_mm256_cmpgt_epi32(_mm256_set1_epi32(rowEnd), base8), _mm256_set1_epi32(rowEnd)));
+        }
+#endif
+        for (; i < size; ++i) {
+            ret[i] = table.map(i % elemcount)[static_cast<uint8_t>(inp[i])];
+        }
+    }
+
+    inline void multithresholdQuantized(const FinnUtils::QuantizedTable& table, std::span<const int8_t> inp, std::span<int8_t> ret) {
+        ret = FinnUtils::outputFor(inp, ret);
+        const size_t size = inp.size();
+        if (!table.uniform) {
+            multithresholdQuantizedChannels(table, inp, ret);
+            return;
+        }
+        const int8_t* map = table.map(0);
+        size_t i = 0;
+#if defined(__AVX512VBMI__) && defined(__AVX512BW__)
+        const __m512i low0 = _mm512_loadu_si512(map);
+        const __m512i low1 = _mm512_loadu_si512(map + 64);
+        const __m512i high0 = _mm512_loadu_si512(map + 128);
+        const __m512i high1 = _mm512_loadu_si512(map + 192);
+        for (; i + 64 <= size; i += 64) {
+            const __m512i q = _mm512_loadu_si512(inp.data() + i);
+            const __m512i low = _mm512_permutex2var_epi8(low0, q, low1);
+            const __m512i high = _mm512_permutex2var_epi8(high0, q, high1);
+            _mm512_storeu_si512(ret.data() + i, _mm512_mask_blend_epi8(_mm512_movepi8_mask(q), low, high));
+        }
+#endif
+#if defined(__AVX2__)
+        __m256i nibbles[16];
+        for (size_t k = 0; k < 16; ++k) {
+            nibbles[k] = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(map + 16 * k)));
+        }
+        for (; i + 32 <= size; i += 32) {
+            const __m256i q = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(inp.data() + i));
+            __m256i result = _mm256_setzero_si256();
+            for (int k = 0; k < 16; ++k) {
+                // lanes of another high nibble saturate to >= 0x80, which vpshufb turns into zero
+                const __m256i index = _mm256_adds_epu8(_mm256_xor_si256(q, _mm256_set1_epi8(static_cast<char>(k << 4))), _mm256_set1_epi8(0x70));
+                result = _mm256_or_si256(result, _mm256_shuffle_epi8(nibbles[k], index));
+            }
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(ret.data() + i), result);
+        }
+#endif
+        for (; i < size; ++i) {
+            ret[i] = map[static_cast<uint8_t>(inp[i])];
+        }
+    }
+
+    inline std::vector<int8_t> multithresholdQuantized(const FinnUtils::QuantizedTable& table, const std::vector<int8_t>& inp) {
+        std::vector<int8_t> ret(inp.size());
+        multithresholdQuantized(table, inp, ret);
+        return ret;
+    }
+
+    /**
+     * Runtime interleaved layout for multithresholdSoA, built once per loaded table
+     */
+    struct InterleavedTable {
+        size_t channels;
+        size_t count;
+        FinnUtils::AlignedVector<float> values;
+
+        explicit InterleavedTable(const FinnUtils::ThresholdTable& table) : channels(table.channels()), count(table.count()), values(FinnUtils::interleave<soaWidth>(table)) {}
+    };
+
+    inline void multithresholdSoA(const InterleavedTable& table, std::span<const float> inp, std::span<int8_t> ret) {
+        const size_t elemcount = table.channels;
+        const size_t count = table.count;
+        const size_t groups = (elemcount + soaWidth - 1) / soaWidth;
+        ret = FinnUtils::outputFor(inp, ret);
+        for (size_t batchindex = 0; batchindex < inp.size() / elemcount; ++batchindex) {
+            const float* row = inp.data() + batchindex * elemcount;
+            int8_t* out = ret.data() + batchindex * elemcount;
+            for (size_t g = 0; g < groups; ++g) {
+                const size_t width = std::min(soaWidth, elemcount - g * soaWidth);
+                const float* t = table.values.data() + g * count * soaWidth;
+#if defined(__AVX2__)
+                if (width == soaWidth) {
+                    const __m256 x = _mm256_loadu_ps(row + g * soaWidth);
+                    __m256i counter = _mm256_setzero_si256();
+                    for (size_t k = 0; k < count; ++k) {
+                        counter = _mm256_sub_epi32(counter, _mm256_castps_si256(_mm256_cmp_ps(_mm256_load_ps(t + k * soaWidth), x, _CMP_LT_OQ)));
                     }
-                    else {
-                        // search [begin, last)
-                        indexCurr = std::distance(begin + elemindex * 255, std::upper_bound(begin + elemindex * 255, begin + (elemindex + 1) * 255 - (255 - indexLast), curr));
+                    const __m256i val = _mm256_sub_epi32(counter, _mm256_set1_epi32(128));
+                    const __m128i words = _mm_packs_epi32(_mm256_castsi256_si128(val), _mm256_extracti128_si256(val, 1));
+                    _mm_storel_epi64(reinterpret_cast<__m128i*>(out + g * soaWidth), _mm_packs_epi16(words, words));
+                    continue;
+                }
+#endif
+                for (size_t lane = 0; lane < width; ++lane) {
+                    int counter = 0;
+                    for (size_t k = 0; k < count; ++k) {
+                        counter += t[k * soaWidth + lane] < row[g * soaWidth + lane];
                     }
-                    ret[batchindex * elemcount + elemindex] += indexCurr;
-                    last = curr;
-                    indexLast = indexCurr;
+                    out[g * soaWidth + lane] = static_cast<int8_t>(counter - 128);
                 }
             }
         }
+    }
+
+    inline std::vector<int8_t> multithresholdSoA(const InterleavedTable& table, const std::vector<float>& inp) {
+        std::vector<int8_t> ret(inp.size());
+        multithresholdSoA(table, inp, ret);
         return ret;
     }
 
+    /**
+     * Channels per compare of the integer kernels, a full vector register of T
+     */
+    template<typename T>
+#if defined(__AVX512BW__) && defined(__AVX512VL__)
+    constexpr size_t integerWidth = 64 / sizeof(T);
+#elif defined(__AVX2__)
+    constexpr size_t integerWidth = 32 / sizeof(T);
+#else
+    constexpr size_t integerWidth = 8;
+#endif
+
+    /**
+     * Threshold counts below which multithresholdInteger compares against every threshold instead of searching,
+     * measured on 24 channels (the scan wins longer for int16 since it covers twice the channels per compare)
+     */
+    template<typename T>
+#if defined(__AVX512BW__) && defined(__AVX512VL__)
+    constexpr size_t integerScanLimit = sizeof(T) == 2 ? 64 : 16;
+#elif defined(__AVX2__)
+    constexpr size_t integerScanLimit = sizeof(T) == 2 ? 256 : 128;
+#else
+    constexpr size_t integerScanLimit = 8;
+#endif
+
+    using FinnUtils::IntegerInterleavedTable;
+
+    /**
+     * multithresholdSoA for integer inputs and thresholds (MVAU accumulators), without a conversion to float. Every
+     * threshold is one vpcmpgtw/vpcmpgtd against integerWidth channels of a row, so int16 covers twice the channels of
+     * int32 per compare. Partial channel groups are masked with AVX-512 and copied to a full group with AVX2.
+     */
+    template<typename T>
+    inline void multithresholdIntegerScan(const IntegerInterleavedTable<T>& table, std::span<const T> inp, std::span<int8_t> ret) {
+        constexpr size_t width = integerWidth<T>;
+        constexpr size_t stride = IntegerInterleavedTable<T>::width;
+        const size_t elemcount = table.channels;
+        const size_t count = table.count;
+        const size_t groups = (elemcount + width - 1) / width;
+        ret = FinnUtils::outputFor(inp, ret);
+        for (size_t batchindex = 0; batchindex < inp.size() / elemcount; ++batchindex) {
+            const T* row = inp.data() + batchindex * elemcount;
+            int8_t* out = ret.data() + batchindex * elemcount;
+            for (size_t g = 0; g < groups; ++g) {
+                const size_t lanes = std::min(width, elemcount - g * width);
+                // a vector covers width of the stride channels of a table group
+                const T* t = table.values.get() + (g * width / stride) * count * stride + g * width % stride;
+#if defined(__AVX512BW__) && defined(__AVX512VL__)
+                const uint32_t active = static_cast<uint32_t>((uint64_t{ 1 } << lanes) - 1);
+                if constexpr (sizeof(T) == 2) {
+                    const __m512i x = _mm512_maskz_loadu_epi16(active, row + g * width);
+                    __m512i counter = _mm512_setzero_si512();
+                    for (size_t k = 0; k < count; ++k) {
+                        counter = _mm512_mask_add_epi16(counter, _mm512_cmpgt_epi16_mask(x, _mm512_load_si512(t + k * stride)), counter, _mm512_set1_epi16(1));
+                    }
+                    _mm256_mask_storeu_epi8(out + g * width, active, _mm512_cvtsepi16_epi8(_mm512_sub_epi16(counter, _mm512_set1_epi16(128))));
+                }
+                else {
+                    const __m512i x = _mm512_maskz_loadu_epi32(active, row + g * width);
+                    __m512i counter = _mm512_setzero_si512();
+                    for (size_t k = 0; k < count; ++k) {
+                        counter = _mm512_mask_add_epi32(counter, _mm512_cmpgt_epi32_mask(x, _mm512_load_si512(t + k * stride)), counter, _mm512_set1_epi32(1));
+                    }
+                    _mm_mask_storeu_epi8(out + g * width, active, _mm512_cvtsepi32_epi8(_mm512_sub_epi32(counter, _mm512_set1_epi32(128))));
+                }
+                continue;
+#elif defined(__AVX2__)
+                // a partial group goes through a full width copy, its extra lanes are not stored
+                alignas(32) T partialRow[width] = {};
+                alignas(16) int8_t partialOut[16];
+                const bool full = lanes == width;
+                if (!full) {
+                    std::copy_n(row + g * width, lanes, partialRow);
+                }
+                const __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(full ? row + g * width : partialRow));
+                int8_t* groupOut = full ? out + g * width : partialOut;
+                __m256i counter = _mm256_setzero_si256();
+                if constexpr (sizeof(T) == 2) {
+                    for (size_t k = 0; k < count; ++k) {
+                        counter = _mm256_sub_epi16(counter, _mm256_cmpgt_epi16(x, _mm256_load_si256(reinterpret_cast<const __m256i*>(t + k * stride))));
+                    }
+                    const __m256i val = _mm256_sub_epi16(counter, _mm256_set1_epi16(128));
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(groupOut), _mm_packs_epi16(_mm256_castsi256_si128(val), _mm256_extracti128_si256(val, 1)));
+                }
+                else {
+                    for (size_t k = 0; k < count; ++k) {
+                        counter = _mm256_sub_epi32(counter, _mm256_cmpgt_epi32(x, _mm256_load_si256(reinterpret_cast<const __m256i*>(t + k * stride))));
+                    }
+                    const __m256i val = _mm256_sub_epi32(counter, _mm256_set1_epi32(128));
+                    const __m128i words = _mm_packs_epi32(_mm256_castsi256_si128(val), _mm256_extracti128_si256(val, 1));
+                    _mm_storel_epi64(reinterpret_cast<__m128i*>(groupOut), _mm_packs_epi16(words, words));
+                }
+                if (!full) {
+                    std::copy_n(partialOut, lanes, out + g * width);
+                }
+                continue;
+#endif
+                for (size_t lane = 0; lane < lanes; ++lane) {
+                    int counter = 0;
+                    for (size_t k = 0; k < count; ++k) {
+                        counter += t[k * stride + lane] < row[g * width + lane];
+                    }
+                    out[g * width + lane] = static_cast<int8_t>(std::min(counter, 255) - 128);
+                }
+            }
+        }
+    }
+
+    /**
+     * Branchless binary search per element on the interleaved integer layout, as multithresholdKeys: 16 (AVX-512) or
+     * 8 (AVX2) consecutive elements per gather, int16 thresholds are gathered as 32 bit words and sign extended
+     */
+    template<typename T>
+    inline void multithresholdIntegerSearch(const IntegerInterleavedTable<T>& table, std::span<const T> inp, std::span<int8_t> ret) {
+        constexpr int shift = std::countr_zero(IntegerInterleavedTable<T>::width);
+        ret = FinnUtils::outputFor(inp, ret);
+        const size_t elemcount = table.channels;
+        const int count = static_cast<int>(table.count);
+        const int firstStep = static_cast<int>(std::bit_floor(table.count));
+        const T* t = table.values.get();
+        const size_t size = inp.size();
+        const std::vector<int>& offsets = table.offsets;
+        size_t i = 0;
+#if defined(__AVX512F__)
+        for (; i + 16 <= size; i += 16) {
+            const __m512i base = _mm512_loadu_si512(offsets.data() + i % elemcount);
+            __m512i x;
+            if constexpr (sizeof(T) == 2) {
+                x = _mm512_cvtepi16_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(inp.data() + i)));
+            }
+            else {
+                x = _mm512_loadu_si512(inp.data() + i);
+            }
+            __m512i pos = _mm512_setzero_si512();
+            for (int step = firstStep; step > 0; step >>= 1) {
+                const __m512i probe = _mm512_add_epi32(pos, _mm512_set1_epi32(step - 1));
+                const __mmask16 valid = _mm512_cmplt_epi32_mask(probe, _mm512_set1_epi32(count));
+                const __m512i index = _mm512_add_epi32(base, _mm512_slli_epi32(_mm512_min_epi32(probe, _mm512_set1_epi32(count - 1)), shift));
+                __m512i value = _mm512_i32gather_epi32(index, t, sizeof(T));
+                if constexpr (sizeof(T) == 2) {
+                    value = _mm512_srai_epi32(_mm512_slli_epi32(value, 16), 16);
+                }
+                const __mmask16 lt = _mm512_mask_cmplt_epi32_mask(valid, value, x);
+                pos = _mm512_mask_add_epi32(pos, lt, pos, _mm512_set1_epi32(step));
+            }
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(ret.data() + i), _mm512_cvtsepi32_epi8(_mm512_sub_epi32(pos, _mm512_set1_epi32(128))));
+        }
+#endif
+#if defined(__AVX2__)
+        for (; i + 8 <= size; i += 8) {
+            const __m256i base = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(offsets.data() + i % elemcount));
+            __m256i x;
+            if constexpr (sizeof(T) == 2) {
+                x = _mm256_cvtepi16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(inp.data() + i)));
+            }
+            else {
+                x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(inp.data() + i));
+            }
+            __m256i pos = _mm256_setzero_si256();
+            for (int step = firstStep; step > 0; step >>= 1) {
+                const __m256i probe = _mm256_add_epi32(pos, _mm256_set1_epi32(step - 1));
+                const __m256i valid = _mm256_cmpgt_epi32(_mm256_set1_epi32(count), probe);
+                const __m256i index = _mm256_add_epi32(base, _mm256_slli_epi32(_mm256_min_epi32(probe, _mm256_set1_epi32(count - 1)), shift));
+                __m256i value = _mm256_i32gather_epi32(reinterpret_cast<const int*>(t), index, sizeof(T));
+                if constexpr (sizeof(T) == 2) {
+                    value = _mm256_srai_epi32(_mm256_slli_epi32(value, 16), 16);
+                }
+                const __m256i lt = _mm256_and_si256(valid, _mm256_cmpgt_epi32(x, value));
+                pos = _mm256_add_epi32(pos, _mm256_and_si256(lt, _mm256_set1_epi32(step)));
+            }
+            const __m256i val = _mm256_sub_epi32(pos, _mm256_set1_epi32(128));
+            const __m128i words = _mm_packs_epi32(_mm256_castsi256_si128(val), _mm256_extracti128_si256(val, 1));
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(ret.data() + i), _mm_packs_epi16(words, words));
+        }
+#endif
+        for (; i < size; ++i) {
+            const int base = offsets[i % elemcount];
+            const T x = inp[i];
+            int pos = 0;
+            for (int step = firstStep; step > 0; step >>= 1) {
+                const int probe = pos + step - 1;
+                pos += (probe < count && t[base + (probe << shift)] < x) * step;
+            }
+            ret[i] = static_cast<int8_t>(std::min(pos, 255) - 128);
+        }
+    }
+
+    template<typename T>
+    inline void multithresholdInteger(const IntegerInterleavedTable<T>& table, std::span<const T> inp, std::span<int8_t> ret) {
+        if (table.count < integerScanLimit<T>) {
+            multithresholdIntegerScan(table, inp, ret);
+        }
+        else {
+            multithresholdIntegerSearch(table, inp, ret);
+        }
+    }
+
+    template<typename T>
+    inline std::vector<int8_t> multithresholdInteger(const IntegerInterleavedTable<T>& table, const std::vector<T>& inp) {
+        std::vector<int8_t> ret(inp.size());
+        multithresholdInteger(table, std::span<const T>(inp), ret);
+        return ret;
+    }
+
+
+    // ------ THREAD POOL ENGINE ------
+
+    /**
+     * Runs the kernels above on a persistent, pinned FinnUtils::ThreadPool instead of OpenMP. The team is fixed at
+     * construction, so no call changes global OpenMP state, and small batches that do not give every thread at least
+     * minRows rows use fewer parts (a single part runs on the calling thread without waking the team).
+     */
+    class MultiThresholdEngine {
+        private:
+        FinnUtils::ThreadPool pool;
+        size_t minRows;
+
+        // Number of parts for rows rows that can be split into at most limit pieces
+        size_t parts(size_t rows, size_t limit) const {
+            return std::max<size_t>(std::min({ pool.size(), limit, rows / minRows }), 1);
+        }
+
+        // Splits the batch into row ranges and runs kernel(inpPart, outPart) on each
+        template<typename Kernel>
+        void rows(std::span<const float> inp, std::span<int8_t> ret, size_t elemcount, Kernel&& kernel) {
+            ret = FinnUtils::outputFor(inp, ret);
+            const size_t batch = inp.size() / elemcount;
+            const size_t count = parts(batch, batch);
+            pool.run(count, [&](size_t part) {
+                const auto [begin, end] = FinnUtils::ThreadPool::split(batch, count, part);
+                kernel(inp.subspan(begin * elemcount, (end - begin) * elemcount), ret.subspan(begin * elemcount, (end - begin) * elemcount));
+            });
+        }
+
+        public:
+        explicit MultiThresholdEngine(size_t threads = std::thread::hardware_concurrency(), bool pinned = true, size_t minRowsPerThread = 64) : pool(threads, pinned), minRows(std::max<size_t>(minRowsPerThread, 1)) {}
+
+        size_t threads() const { return pool.size(); }
+        FinnUtils::ThreadPool& threadPool() { return pool; }
+
+        void multithresholdLinearPerTensor(std::span<const float> inp, std::span<int8_t> ret) {
+            // per element kernel, 16 element parts keep the vector loops aligned to the part boundaries
+            rows(inp, ret, 16, [](std::span<const float> in, std::span<int8_t> out) {
+                optimized::multithresholdLinearPerTensor(in, out);
+            });
+            // tail that does not fill 16 elements
+            const size_t done = inp.size() / 16 * 16;
+            optimized::multithresholdLinearPerTensor(inp.subspan(done), ret.subspan(std::min(done, ret.size())));
+        }
+
+        template<size_t elemcount>
+        void multithresholdSIMD(std::span<const float> inp, std::span<int8_t> ret) {
+            rows(inp, ret, elemcount, [](std::span<const float> in, std::span<int8_t> out) {
+                optimized::multithresholdSIMD<elemcount>(in, out);
+            });
+        }
+
+        void multithresholdSIMD(const FinnUtils::ThresholdTable& table, std::span<const float> inp, std::span<int8_t> ret) {
+            rows(inp, ret, table.channels(), [&table](std::span<const float> in, std::span<int8_t> out) {
+                optimized::multithresholdSIMD(table, in, out);
+            });
+        }
+
+        template<size_t elemcount, SearchIndex Index>
+        void multithreshold(std::span<const float> inp, std::span<int8_t> ret, const Index& index) {
+            rows(inp, ret, elemcount, [&index](std::span<const float> in, std::span<int8_t> out) {
+                optimized::multithreshold<elemcount>(in, out, index);
+            });
+        }
+
+        /**
+         * Same batch x channel tiling as multithresholdLEMTTiled, each part takes a contiguous range of tiles
+         */
+        void multithresholdLEMT(const FinnUtils::ThresholdTable& table, std::span<const float> inp, std::span<int8_t> ret, LESearch search = LESearch::Binary) {
+            ret = FinnUtils::outputFor(inp, ret);
+            std::fill(ret.begin(), ret.end(), int8_t{ -128 });
+            const size_t batch = inp.size() / table.channels();
+            const LETiling tiling(batch, table.channels(), parts(batch, pool.size()));
+            const size_t count = std::min(pool.size(), tiling.tiles());
+            pool.run(count, [&](size_t part) {
+                const auto [begin, end] = FinnUtils::ThreadPool::split(tiling.tiles(), count, part);
+                for (size_t tile = begin; tile < end; ++tile) {
+                    tiling.run(table, inp, ret, tile, search);
+                }
+            });
+        }
+
+        template<size_t elemcount>
+        void multithresholdLEMT(std::span<const float> inp, std::span<int8_t> ret, LESearch search = LESearch::Binary) {
+            multithresholdLEMT(FinnUtils::ThresholdTable(thresholds.data(), elemcount, 255), inp, ret, search);
+        }
+    };
 };
 
 #endif // OPTIMIZED
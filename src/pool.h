@@ -0,0 +1,238 @@
+#ifndef POOL_KERNELS
+#define POOL_KERNELS
+
+#include <vector>
+#include <span>
+#include <string>
+#include <cstdint>
+#include <limits>
+#include <chrono>
+#include <random>
+#include <type_traits>
+#include <stdexcept>
+#include <algorithm>
+#include <immintrin.h>
+#include "threshold_table.h"
+#include "optimized.h"
+#include "utils.h"
+
+namespace optimized::inline FINN_ISA {
+
+    using FinnUtils::PoolShape;
+    using FinnUtils::PoolOrder;
+
+    // acc = max(acc, x) elementwise. For float a NaN in x is skipped, the same as thresholding it to -128 first.
+    template<typename T>
+    inline void maxInto(T* acc, const T* x, size_t n) {
+        size_t i = 0;
+#if defined(__AVX512F__) && defined(__AVX512BW__)
+        constexpr size_t lanes = 64 / sizeof(T);
+        for (; i + lanes <= n; i += lanes) {
+            if constexpr (std::is_same_v<T, float>) {
+                _mm512_storeu_ps(acc + i, _mm512_max_ps(_mm512_loadu_ps(x + i), _mm512_loadu_ps(acc + i)));
+            }
+            else {
+                const __m512i a = _mm512_loadu_si512(acc + i);
+                const __m512i b = _mm512_loadu_si512(x + i);
+                if constexpr (sizeof(T) == 1) {
+                    _mm512_storeu_si512(acc + i, _mm512_max_epi8(a, b));
+                }
+                else if constexpr (sizeof(T) == 2) {
+                    _mm512_storeu_si512(acc + i, _mm512_max_epi16(a, b));
+                }
+                else {
+                    _mm512_storeu_si512(acc + i, _mm512_max_epi32(a, b));
+                }
+            }
+        }
+#elif defined(__AVX2__)
+        constexpr size_t lanes = 32 / sizeof(T);
+        for (; i + lanes <= n; i += lanes) {
+            if constexpr (std::is_same_v<T, float>) {
+                _mm256_storeu_ps(acc + i, _mm256_max_ps(_mm256_loadu_ps(x + i), _mm256_loadu_ps(acc + i)));
+            }
+            else {
+                const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(acc + i));
+                const __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(x + i));
+                if constexpr (sizeof(T) == 1) {
+                    _mm256_storeu_si256(reinterpret_cast<__m256i*>(acc + i), _mm256_max_epi8(a, b));
+                }
+                else if constexpr (sizeof(T) == 2) {
+                    _mm256_storeu_si256(reinterpret_cast<__m256i*>(acc + i), _mm256_max_epi16(a, b));
+                }
+                else {
+                    _mm256_storeu_si256(reinterpret_cast<__m256i*>(acc + i), _mm256_max_epi32(a, b));
+                }
+            }
+        }
+#endif
+        for (; i < n; ++i) {
+            acc[i] = x[i] > acc[i] ? x[i] : acc[i];
+        }
+    }
+
+    /**
+     * k x k max pool with stride s over a batch of NHWC maps. Float maps skip NaN (all NaN gives -inf).
+     */
+    template<typename T>
+    void maxPool(const PoolShape& shape, std::span<const T> inp, std::span<T> ret) {
+        shape.validate();
+        const size_t images = inp.size() / shape.inputSize();
+        if (ret.size() < images * shape.outputSize()) {
+            throw std::invalid_argument("Output buffer holds " + std::to_string(ret.size()) + " elements, " + std::to_string(images * shape.outputSize()) + " needed");
+        }
+        const size_t c = shape.channels;
+        const T lowest = std::numeric_limits<T>::has_infinity ? -std::numeric_limits<T>::infinity() : std::numeric_limits<T>::lowest();
+        for (size_t n = 0; n < images; ++n) {
+            const T* image = inp.data() + n * shape.inputSize();
+            T* out = ret.data() + n * shape.outputSize();
+            for (size_t oy = 0; oy < shape.outHeight(); ++oy) {
+                for (size_t ox = 0; ox < shape.outWidth(); ++ox) {
+                    T* acc = out + (oy * shape.outWidth() + ox) * c;
+                    std::fill_n(acc, c, lowest);
+                    for (size_t ky = 0; ky < shape.kernel; ++ky) {
+                        const T* row = image + ((oy * shape.stride + ky) * shape.width + ox * shape.stride) * c;
+                        for (size_t kx = 0; kx < shape.kernel; ++kx) {
+                            maxInto(acc, row + kx * c, c);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    template<typename T>
+    std::vector<T> maxPool(const PoolShape& shape, const std::vector<T>& inp) {
+        std::vector<T> ret(inp.size() / shape.inputSize() * shape.outputSize());
+        maxPool(shape, std::span<const T>(inp), std::span<T>(ret));
+        return ret;
+    }
+
+    template<typename T>
+    struct PoolTraits;
+
+    template<>
+    struct PoolTraits<float> {
+        using Table = FinnUtils::ThresholdTable;
+        using Prepared = FinnUtils::ThresholdTable;
+
+        static void threshold(const Prepared& table, std::span<const float> inp, std::span<int8_t> ret) {
+            multithresholdSIMD(table, inp, ret);
+        }
+    };
+
+    template<typename T>
+        requires std::is_same_v<T, int16_t> || std::is_same_v<T, int32_t>
+    struct PoolTraits<T> {
+        using Table = FinnUtils::IntegerThresholdTable<T>;
+        using Prepared = IntegerInterleavedTable<T>;
+
+        static void threshold(const Prepared& table, std::span<const T> inp, std::span<int8_t> ret) {
+            multithresholdInteger(table, inp, ret);
+        }
+    };
+
+    /**
+     * MultiThreshold followed by a k x k max pool over NHWC maps. Thresholding is monotone per channel, so both orders
+     * give the same int8 output: pooling first searches only the pooled elements, thresholding first pools on int8
+     * with four (float, int32) or two (int16) times the lanes. PoolOrder::Auto times both orders on one image
+     * at construction, the same way AutoLE calibrates, and keeps the faster one.
+     */
+    template<typename T = float>
+    class ThresholdMaxPool {
+        public:
+        using Table = typename PoolTraits<T>::Table;
+
+        private:
+        // Inputs processed per pass through the intermediate buffer, at least one image
+        static constexpr size_t blockBytes = 256 * 1024;
+
+        typename PoolTraits<T>::Prepared table;
+        PoolShape shape;
+        PoolOrder chosen;
+
+        void run(PoolOrder order, std::span<const T> inp, std::span<int8_t> ret, FinnUtils::ScratchArena& scratch) const {
+            const size_t images = inp.size() / shape.inputSize();
+            const size_t chunk = std::max<size_t>(blockBytes / (shape.inputSize() * sizeof(T)), 1);
+            for (size_t n = 0; n < images; n += chunk) {
+                const size_t count = std::min(chunk, images - n);
+                const std::span<const T> in = inp.subspan(n * shape.inputSize(), count * shape.inputSize());
+                const std::span<int8_t> out = ret.subspan(n * shape.outputSize(), count * shape.outputSize());
+                if (order == PoolOrder::PoolFirst) {
+                    const std::span<T> pooled = scratch.get<T>(count * shape.outputSize());
+                    maxPool<T>(shape, in, pooled);
+                    PoolTraits<T>::threshold(table, pooled, out);
+                }
+                else {
+                    const std::span<int8_t> activations = scratch.get<int8_t>(count * shape.inputSize());
+                    PoolTraits<T>::threshold(table, in, activations);
+                    maxPool<int8_t>(shape, activations, out);
+                }
+            }
+        }
+
+        PoolOrder calibrate(const Table& thresholds) const {
+            const auto [lowest, highest] = std::minmax_element(thresholds.data(), thresholds.data() + thresholds.size());
+            std::mt19937 engine{ 42 };
+            std::vector<T> sample(shape.inputSize());
+            if constexpr (std::is_same_v<T, float>) {
+                const float margin = (*highest - *lowest) * 0.1f;
+                std::uniform_real_distribution<float> dist{ *lowest - margin, *highest + margin };
+                std::generate(sample.begin(), sample.end(), [&]() { return dist(engine); });
+            }
+            else {
+                const int64_t margin = (int64_t{ *highest } - *lowest) / 10;
+                std::uniform_int_distribution<int64_t> dist{ std::max<int64_t>(int64_t{ *lowest } - margin, std::numeric_limits<T>::min()),
+                    std::min<int64_t>(int64_t{ *highest } + margin, std::numeric_limits<T>::max()) };
+                std::generate(sample.begin(), sample.end(), [&]() { return static_cast<T>(dist(engine)); });
+            }
+            std::vector<int8_t> out(shape.outputSize());
+            FinnUtils::ScratchArena scratch;
+            const auto time = [&](PoolOrder order) {
+                // the first round only warms the caches, the best of three is kept against timer noise
+                run(order, sample, out, scratch);
+                auto best = std::chrono::nanoseconds::max();
+                for (int round = 0; round < 3; ++round) {
+                    const auto start = std::chrono::steady_clock::now();
+                    run(order, sample, out, scratch);
+                    best = std::min(best, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start));
+                }
+                return best;
+            };
+            return time(PoolOrder::ThresholdFirst) < time(PoolOrder::PoolFirst) ? PoolOrder::ThresholdFirst : PoolOrder::PoolFirst;
+        }
+
+        public:
+        ThresholdMaxPool(const Table& thresholds, const PoolShape& poolShape, PoolOrder order = PoolOrder::Auto) : table(thresholds), shape(poolShape), chosen(order) {
+            shape.validate();
+            if (thresholds.channels() != shape.channels) {
+                throw std::invalid_argument("Expected thresholds for " + std::to_string(shape.channels) + " channels, got " + std::to_string(thresholds.channels()));
+            }
+            if (chosen == PoolOrder::Auto) {
+                chosen = calibrate(thresholds);
+            }
+        }
+
+        // The order operator() runs, never Auto
+        PoolOrder order() const { return chosen; }
+
+        void operator()(std::span<const T> inp, std::span<int8_t> ret, FinnUtils::ScratchArena& scratch = FinnUtils::threadScratch()) const {
+            if (inp.size() % shape.inputSize() != 0) {
+                throw std::invalid_argument("Input of " + std::to_string(inp.size()) + " elements is not a batch of " + std::to_string(shape.inputSize()) + " element maps");
+            }
+            const size_t needed = inp.size() / shape.inputSize() * shape.outputSize();
+            if (ret.size() < needed) {
+                throw std::invalid_argument("Output buffer holds " + std::to_string(ret.size()) + " elements, " + std::to_string(needed) + " needed");
+            }
+            run(chosen, inp, ret, scratch);
+        }
+
+        std::vector<int8_t> operator()(const std::vector<T>& inp) const {
+            std::vector<int8_t> ret(inp.size() / shape.inputSize() * shape.outputSize());
+            (*this)(std::span<const T>(inp), ret);
+            return ret;
+        }
+    };
+}
+
+#endif // POOL_KERNELS
@@ -5,6 +5,68 @@
 #include "join.hpp"
 #include "optimized.h"
 #include "lossy.hpp"
+#include "multithreshold.h"
+#include "dispatch.h"
+#include "mvau.h"
+#include "pool.h"
+#include "epilogue.h"
+#include <random>
+#include <limits>
+#include <fstream>
+#include <filesystem>
+#include <cstring>
+#include <numeric>
+#include <functional>
+#include <tuple>
+
+#ifndef THRESHOLDS_NPY
+#define THRESHOLDS_NPY "MultiThreshold_0_param0.npy"
+#endif
+
+// Scalar reference for the packed sub-byte output, first element in the least significant bits
+template<typename T>
+std::vector<uint8_t> packReference(const std::vector<T>& values, unsigned int bits) {
+    std::vector<uint8_t> ret((values.size() * bits + 7) / 8, 0);
+    for (size_t i = 0; i < values.size(); ++i) {
+        ret[i * bits / 8] |= static_cast<uint8_t>((static_cast<int>(values[i]) & ((1 << bits) - 1)) << (i * bits % 8));
+    }
+    return ret;
+}
+
+// Writes a minimal version 1.0 .npy file
+void writeNpy(const std::string& path, const std::string& descr, size_t channels, size_t count, const void* data, size_t bytes) {
+    std::string header = "{'descr': '" + descr + "', 'fortran_order': False, 'shape': (" + std::to_string(channels) + ", " + std::to_string(count) + "), }";
+    header.append(64 - (10 + header.size() + 1) % 64, ' ');
+    header += '\n';
+    std::ofstream file(path, std::ios::binary);
+    file.write("\x93NUMPY\x01\x00", 8);
+    const uint16_t length = static_cast<uint16_t>(header.size());
+    file.write(reinterpret_cast<const char*>(&length), 2);
+    file << header;
+    file.write(static_cast<const char*>(data), bytes);
+}
+
+// Batch of 24-channel rows covering ties with the thresholds, signed zeros, infinities and NaN,
+// followed by uniform random rows
+std::vector<float> edgeCaseInputs(size_t randomRows) {
+    std::vector<float> ret;
+    for (size_t i = 0; i < 255; ++i) {
+        for (size_t c = 0; c < 24; ++c) {
+            const float t = thresholds[c * 255 + (i + c) % 255];
+            ret.emplace_back((c % 3 == 0) ? t : (c % 3 == 1) ? std::nextafter(t, -10.0f) : std::nextafter(t, 10.0f));
+        }
+    }
+    std::vector<float> special = { 0.0f, -0.0f, std::numeric_limits<float>::infinity(), -std::numeric_limits<float>::infinity(), std::numeric_limits<float>::quiet_NaN(), 100.0f, -100.0f, std::numeric_limits<float>::lowest() };
+    for (size_t c = 0; c < 24; ++c) {
+        ret.emplace_back(special[c % special.size()]);
+    }
+    std::mt19937 engine{ 42 };
+    std::uniform_real_distribution<float> dist{ -4.0, 4.0 };
+    for (size_t i = 0; i < randomRows * 24; ++i) {
+        ret.emplace_back(dist(engine));
+    }
+    return ret;
+}
 
 int main() {
     std::vector<float> inputs = { 0.5527185,0.39846906, -0.11766014,  0.19299345, -0.38549745,  0.08441927
@@ -62,6 +124,679 @@ int main() {
 
     std::cout << std::boolalpha << "Optimized LinearPT equal to expected:    " << (expectedResults == optimized::multithresholdLinearPerTensor(inputs)) << "\n";
     std::cout << std::boolalpha << "B4 Optimized LinearPT equal to expected: " << (expectedResults2 == optimized::multithresholdLinearPerTensor(inputs2)) << "\n";
+    std::cout << std::boolalpha << "Optimized LinearPC equal to expected:    " << (expectedResults == optimized::multithresholdLinearPerChannel<24>(inputs)) << "\n";
+    std::cout << std::boolalpha << "B4 Optimized LinearPC equal to expected: " << (expectedResults2 == optimized::multithresholdLinearPerChannel<24>(inputs2)) << "\n";
+
+    std::cout << std::boolalpha << "Optimized SIMD equal to expected:        " << (expectedResults == optimized::multithresholdSIMD<24>(inputs)) << "\n";
+    std::cout << std::boolalpha << "B4 Optimized SIMD equal to expected:     " << (expectedResults2 == optimized::multithresholdSIMD<24>(inputs2)) << "\n";
+
+    auto edgeInputs = edgeCaseInputs(4096);
+    auto edgeReference = referenceOuter<24>(edgeInputs);
+    std::cout << std::boolalpha << "Optimized SoA equal to expected:         " << (expectedResults == optimized::multithresholdSoA<24>(inputs)) << "\n";
+    std::cout << std::boolalpha << "B4 Optimized SoA equal to expected:      " << (expectedResults2 == optimized::multithresholdSoA<24>(inputs2)) << "\n";
+
+    const optimized::SortedIndex sortedIndex(thresholds.data(), 24, 255);
+    const optimized::ThresholdIndex eytzingerIndex(thresholds.data(), 24, 255);
+    std::cout << std::boolalpha << "Optimized Eytzinger equal to expected:   " << (expectedResults == optimized::multithreshold<24>(inputs, eytzingerIndex)) << "\n";
+    std::cout << std::boolalpha << "B4 Optimized LE Eytzinger equal to exp.: " << (expectedResults2 == optimized::multithresholdLE<24>(inputs2, eytzingerIndex)) << "\n";
+
+    std::cout << std::boolalpha << "Edge Optimized SIMD equal to reference:  " << (edgeReference == optimized::multithresholdSIMD<24>(edgeInputs)) << "\n";
+    std::cout << std::boolalpha << "Edge Optimized SoA equal to reference:   " << (edgeReference == optimized::multithresholdSoA<24>(edgeInputs)) << "\n";
+    std::cout << std::boolalpha << "Edge Sorted index equal to reference:    " << (edgeReference == optimized::multithreshold<24>(edgeInputs, sortedIndex)) << "\n";
+    std::cout << std::boolalpha << "Edge Eytzinger equal to reference:       " << (edgeReference == optimized::multithreshold<24>(edgeInputs, eytzingerIndex)) << "\n";
+    const optimized::ScanIndex scanIndex(thresholds.data(), 24, 255);
+    std::cout << std::boolalpha << "Edge Scan index equal to reference:      " << (edgeReference == optimized::multithreshold<24>(edgeInputs, scanIndex)) << "\n";
+    const optimized::AutoIndex autoIndex(thresholds.data(), 24, 255);
+    std::cout << std::boolalpha << "Edge Auto index equal to reference:      " << (edgeReference == optimized::multithreshold<24>(edgeInputs, autoIndex)) << " (scan: " << autoIndex.scans() << ")\n";
+    std::vector<float> shortThresholds;
+    for (size_t c = 0; c < 24; ++c) {
+        for (size_t k = 0; k < 15; ++k) {
+            shortThresholds.emplace_back(thresholds[c * 255 + 17 * k + 8]);
+        }
+    }
+    const optimized::SortedIndex shortSorted(shortThresholds.data(), 24, 15);
+    std::cout << std::boolalpha << "Edge 15 Eytzinger equal to sorted:       " << (optimized::multithreshold<24>(edgeInputs, shortSorted) == optimized::multithreshold<24>(edgeInputs, optimized::ThresholdIndex(shortThresholds.data(), 24, 15))) << "\n";
+    std::cout << std::boolalpha << "Edge 15 Scan equal to sorted:            " << (optimized::multithreshold<24>(edgeInputs, shortSorted) == optimized::multithreshold<24>(edgeInputs, optimized::ScanIndex(shortThresholds.data(), 24, 15))) << "\n";
+    std::cout << std::boolalpha << "Edge LinearPC equal to reference:        " << (edgeReference == optimized::multithresholdLinearPerChannel<24>(edgeInputs)) << "\n";
+    std::cout << std::boolalpha << "Edge 15 Linear equal to sorted:          " << (optimized::multithreshold<24>(edgeInputs, shortSorted) == optimized::multithreshold<24>(edgeInputs, optimized::LinearIndex(shortThresholds.data(), 24, 15))) << "\n";
+    const optimized::LinearIndex linearIndex(thresholds.data(), 24, 255);
+    std::cout << std::boolalpha << "Linear channel 0 uses closed form:       " << linearIndex.linear(0) << "\n";
+    // cubed thresholds are far from uniform, every channel has to fall back to the search
+    std::vector<float> skewedThresholds(thresholds.begin(), thresholds.end());
+    for (auto&& t : skewedThresholds) {
+        t = t * t * t;
+    }
+    const optimized::LinearIndex skewedLinear(skewedThresholds.data(), 24, 255);
+    std::cout << std::boolalpha << "Edge Linear fallback equal to sorted:    " << (!skewedLinear.linear(0) && optimized::multithreshold<24>(edgeInputs, skewedLinear) == optimized::multithreshold<24>(edgeInputs, optimized::SortedIndex(skewedThresholds.data(), 24, 255))) << "\n";
+    // even channels uniform, odd channels skewed, the linear lanes stay on the closed form
+    std::vector<float> mixedThresholds(thresholds.begin(), thresholds.end());
+    for (size_t c = 1; c < 24; c += 2) {
+        std::copy_n(skewedThresholds.begin() + c * 255, 255, mixedThresholds.begin() + c * 255);
+    }
+    const optimized::LinearIndex mixedLinear(mixedThresholds.data(), 24, 255);
+    std::cout << std::boolalpha << "Edge LinearPC mixed equal to sorted:     " << (mixedLinear.linear(0) && !mixedLinear.linear(1)
+        && optimized::multithresholdLinearPerChannel<24>(edgeInputs, mixedLinear) == optimized::multithreshold<24>(edgeInputs, optimized::SortedIndex(mixedThresholds.data(), 24, 255))) << "\n";
+    std::cout << std::boolalpha << "Edge LE Eytzinger equal to reference:    " << (edgeReference == optimized::multithresholdLE<24>(edgeInputs, eytzingerIndex)) << "\n";
+    const optimized::RadixIndex radixIndex(thresholds.data(), 24, 255);
+    std::cout << std::boolalpha << "Edge Radix equal to reference:           " << (edgeReference == optimized::multithreshold<24>(edgeInputs, radixIndex)) << " (" << radixIndex.bytes() / 24 << " bytes per channel, max fixup " << radixIndex.maxFixup() << ")\n";
+    std::cout << std::boolalpha << "Edge Radix 4 bits equal to reference:    " << (edgeReference == optimized::multithreshold<24>(edgeInputs, optimized::RadixIndex(thresholds.data(), 24, 255, 4))) << "\n";
+    bool radixBitThrows = false;
+    try {
+        optimized::RadixIndex(thresholds.data(), 24, 255, 1);
+    }
+    catch (const std::invalid_argument&) {
+        radixBitThrows = true;
+    }
+    std::cout << std::boolalpha << "Radix 1 bit across zero rejected:        " << (radixBitThrows && *std::min_element(thresholds.begin(), thresholds.end()) < 0.0f && *std::max_element(thresholds.begin(), thresholds.end()) > 0.0f) << "\n";
+    std::cout << std::boolalpha << "Edge Radix skewed/15 equal to sorted:    " << (optimized::multithreshold<24>(edgeInputs, optimized::RadixIndex(skewedThresholds.data(), 24, 255)) == optimized::multithreshold<24>(edgeInputs, optimized::SortedIndex(skewedThresholds.data(), 24, 255))
+        && optimized::multithreshold<24>(edgeInputs, shortSorted) == optimized::multithreshold<24>(edgeInputs, optimized::RadixIndex(shortThresholds.data(), 24, 15))) << "\n";
+
+    const auto table = FinnUtils::ThresholdTable::fromNpy(THRESHOLDS_NPY);
+    // thresholds.h was printed with fewer digits, so the tables only agree approximately
+    std::cout << std::boolalpha << "Npy table close to compiled in:          " << (table.channels() == 24 && table.count() == 255 && std::equal(thresholds.begin(), thresholds.end(), table.data(), [](float a, float b) { return std::abs(a - b) < 1e-6f; })) << "\n";
+    auto npyReference = referenceOuter(table, edgeInputs);
+    std::cout << std::boolalpha << "Npy Naive equal to expected:             " << (expectedResults2 == multithreshold(table, inputs2)) << "\n";
+    std::cout << std::boolalpha << "Npy Optimized equal to expected:         " << (expectedResults2 == optimized::multithreshold(table, inputs2)) << "\n";
+    std::cout << std::boolalpha << "Npy Optimized LE equal to expected:      " << (expectedResults2 == optimized::multithresholdLE(table, inputs2)) << "\n";
+    std::cout << std::boolalpha << "Npy Optimized LEMT equal to expected:    " << (expectedResults2 == optimized::multithresholdLEMT(table, inputs2)) << "\n";
+    std::cout << std::boolalpha << "Npy Optimized LinearPT equal to expected:" << (expectedResults2 == optimized::multithresholdLinearPerTensor(table, inputs2)) << "\n";
+    std::cout << std::boolalpha << "Npy Optimized SIMD equal to reference:   " << (npyReference == optimized::multithresholdSIMD(table, edgeInputs)) << "\n";
+    std::cout << std::boolalpha << "Npy Optimized SoA equal to reference:    " << (npyReference == optimized::multithresholdSoA(optimized::InterleavedTable(table), edgeInputs)) << "\n";
+    std::cout << std::boolalpha << "Npy Eytzinger equal to reference:        " << (npyReference == optimized::multithreshold<24>(edgeInputs, optimized::ThresholdIndex(table))) << "\n";
+    std::cout << std::boolalpha << "Npy Radix equal to reference:            " << (npyReference == optimized::multithreshold<24>(edgeInputs, optimized::RadixIndex(table))) << "\n";
+    lossy::LossyThresholdLookup<float, int8_t, 255> tableLossy(table.channel(0), 5);
+    lossy::LossyThresholdLookup<float, int8_t, 255> arrayLossy(first_thresholds, 5);
+    bool lossyEqual = true;
+    for (auto&& x : edgeInputs) {
+        lossyEqual &= std::isnan(x) || tableLossy.threshold(x) == arrayLossy.threshold(x);
+    }
+    std::cout << std::boolalpha << "Npy Lossy equal to compiled in lossy:    " << lossyEqual << "\n";
+    // SIMD gather lookup on tables from _create_lookup_table, a large one and one that fits a register
+    constexpr float firstMin = *std::min_element(first_thresholds.begin(), first_thresholds.end());
+    constexpr float firstRange = *std::max_element(first_thresholds.begin(), first_thresholds.end()) - firstMin;
+    constexpr auto gatherTable = lossy::_create_lookup_table<int8_t, float, 255, 1000, lossy::_get_shift(1000, firstMin), lossy::_get_max_scale(1000, firstRange)>(first_thresholds);
+    constexpr auto permuteTable = lossy::_create_lookup_table<int8_t, float, 255, 8, lossy::_get_shift(8, firstMin), lossy::_get_max_scale(8, firstRange)>(first_thresholds);
+    const std::vector<float> oddLength(edgeInputs.begin(), edgeInputs.begin() + 1003);
+    bool gatherEqual = permuteTable.size() <= 64;
+    for (auto&& [lookupTable, lookupScale, lookupShift] : { std::tuple<std::span<const int8_t>, float, float>{ gatherTable, 1000.0f, lossy::_get_shift(1000, firstMin) }, { permuteTable, 8.0f, lossy::_get_shift(8, firstMin) } }) {
+        const lossy::GatherLookup<int8_t> lookup(lookupTable, lookupScale, lookupShift);
+        for (const std::vector<float>* values : std::initializer_list<const std::vector<float>*>{ &edgeInputs, &oddLength }) {
+            const auto result = lookup.thresholds(*values);
+            for (size_t i = 0; i < values->size(); ++i) {
+                const float x = (*values)[i];
+                const float index = std::fma(x, lookupScale, lookupShift);
+                const int8_t expected = (std::isnan(x) || index < 0.0f) ? lookupTable.front() : (index >= static_cast<float>(lookupTable.size() - 1)) ? lookupTable.back() : lookupTable[static_cast<size_t>(index)];
+                gatherEqual &= result[i] == expected;
+            }
+        }
+    }
+    std::cout << std::boolalpha << "Gather lookup equal to scalar lookup:    " << gatherEqual << "\n";
+
+    // per-channel lossy tables, identical channels share a table, distinct ones share the budget
+    std::vector<float> scaledThresholds(thresholds.begin(), thresholds.end());
+    for (size_t i = 0; i < scaledThresholds.size(); ++i) {
+        scaledThresholds[i] *= 1.0f + static_cast<float>(i / 255) / 8.0f;
+    }
+    const FinnUtils::ThresholdTable scaledTable(scaledThresholds.data(), 24, 255);
+    const lossy::MultiChannelLossyLookup<int8_t> sharedLossy(FinnUtils::ThresholdTable(thresholds.data(), 24, 255));
+    const lossy::MultiChannelLossyLookup<int8_t> budgetLossy(scaledTable, 1 << 13);
+    const auto scaledReference = referenceOuter(scaledTable, edgeInputs);
+    const auto budgetOut = budgetLossy.thresholds(edgeInputs);
+    bool lossyBounded = sharedLossy.uniqueTables() == 1 && budgetLossy.uniqueTables() == 24 && budgetLossy.bytes() <= (1 << 13);
+    for (size_t i = 0; i < edgeInputs.size(); ++i) {
+        const int error = scaledReference[i] - budgetOut[i];
+        lossyBounded &= error >= 0 && error <= static_cast<int>(budgetLossy.maxError(i % 24));
+    }
+    std::cout << std::boolalpha << "Multi-channel lossy within error bound:  " << lossyBounded << " (" << budgetLossy.bytes() << " bytes, channel 0: " << budgetLossy.precisionDigits(0) << " digits max error " << budgetLossy.maxError(0)
+        << ", channel 23: " << budgetLossy.precisionDigits(23) << " digits max error " << budgetLossy.maxError(23) << ")\n";
+    // precision picked for an accuracy target on a calibration sample
+    std::vector<float> calibration(24 * 1024);
+    std::mt19937 calibrationEngine{ 3 };
+    std::uniform_real_distribution<float> calibrationDist{ -4.0f, 4.0f };
+    std::generate(calibration.begin(), calibration.end(), [&]() { return calibrationDist(calibrationEngine); });
+    const auto calibrationReference = referenceOuter(scaledTable, calibration);
+    auto mismatches = [&](const std::vector<int8_t>& values) {
+        return std::inner_product(values.begin(), values.end(), calibrationReference.begin(), size_t{ 0 }, std::plus<>(), std::not_equal_to<>());
+    };
+    using Scaling = lossy::MultiChannelLossyLookup<int8_t>::Scaling;
+    // a zero target needs slots narrower than the closest sample to a threshold, keep that sample short
+    const std::vector<float> shortCalibration(calibration.begin(), calibration.begin() + 24 * 32);
+    const auto shortCalibrationReference = referenceOuter(scaledTable, shortCalibration);
+    const lossy::MultiChannelLossyLookup<int8_t> exactLossy(scaledTable, shortCalibration, 0.0, Scaling::Binary, 1 << 22);
+    const lossy::MultiChannelLossyLookup<int8_t> rateLossy(scaledTable, calibration, 0.01, Scaling::Binary);
+    const lossy::MultiChannelLossyLookup<int8_t> decimalLossy(scaledTable, calibration, 0.1, Scaling::Decimal);
+    bool budgetThrows = false;
+    try {
+        lossy::MultiChannelLossyLookup<int8_t>(scaledTable, shortCalibration, 0.0, Scaling::Binary, 1024);
+    }
+    catch (const std::invalid_argument&) {
+        budgetThrows = true;
+    }
+    std::cout << std::boolalpha << "Auto precision lossy meets target:       " << (exactLossy.thresholds(shortCalibration) == shortCalibrationReference && mismatches(rateLossy.thresholds(calibration)) <= calibration.size() / 100 && rateLossy.bytes() < exactLossy.bytes() && budgetThrows
+        && mismatches(decimalLossy.thresholds(calibration)) <= calibration.size() / 10 && std::pow(10.0f, static_cast<float>(decimalLossy.precisionDigits(5))) == decimalLossy.scale(5))
+        << " (zero: " << exactLossy.bytes() << " bytes, scale " << exactLossy.scale(0) << "; 1%: " << rateLossy.bytes() << " bytes, scale " << rateLossy.scale(0) << ")\n";
+
+    // short tables in the other supported dtypes
+    const auto directory = std::filesystem::temp_directory_path();
+    std::vector<uint16_t> halfs = { 0xBC00, 0x0000, 0x3C00, 0x4000, 0xC000, 0xBC00, 0x0001, 0x7C00 }; // -1 0 1 2 | -2 -1 subnormal inf
+    writeNpy((directory / "fmt_f2.npy").string(), "<f2", 2, 4, halfs.data(), halfs.size() * 2);
+    const auto halfTable = FinnUtils::ThresholdTable::fromNpy((directory / "fmt_f2.npy").string());
+    std::cout << std::boolalpha << "Npy float16 loads:                       " << (halfTable.channels() == 2 && halfTable(0, 0) == -1.0f && halfTable(0, 3) == 2.0f && halfTable(1, 2) > 0.0f && std::isinf(halfTable(1, 3))) << "\n";
+    std::vector<int32_t> integers = { -5, -1, 3, 7, 0, 0, 1, 100 };
+    writeNpy((directory / "fmt_i4.npy").string(), "<i4", 2, 4, integers.data(), integers.size() * 4);
+    const auto intTable = FinnUtils::ThresholdTable::fromNpy((directory / "fmt_i4.npy").string());
+    std::cout << std::boolalpha << "Npy int32 loads:                         " << (intTable.count() == 4 && intTable(0, 0) == -5.0f && intTable(1, 3) == 100.0f && referenceOuter(intTable, { 3.5f, 0.0f }) == std::vector<int8_t>{ -125, -128 }) << "\n";
+    std::vector<float> intInputs = { -6.0f, 0.0f, -1.0f, 1.0f, 3.0f, 100.0f, 7.5f, 0.5f, std::numeric_limits<float>::quiet_NaN(), -0.0f };
+    std::cout << std::boolalpha << "Npy int32 SIMD equal to reference:       " << (referenceOuter(intTable, intInputs) == optimized::multithresholdSIMD(intTable, intInputs)) << "\n";
+    // integer accumulators and thresholds, compared with the float kernels on the same (exactly representable) values
+    std::vector<float> accumulatorThresholds(scaledThresholds.size());
+    std::transform(scaledThresholds.begin(), scaledThresholds.end(), accumulatorThresholds.begin(), [](float t) { return std::floor(t * 1000.0f); });
+    const std::vector<int16_t> accumulatorThresholds16(accumulatorThresholds.begin(), accumulatorThresholds.end());
+    const std::vector<int32_t> accumulatorThresholds32(accumulatorThresholds.begin(), accumulatorThresholds.end());
+    writeNpy((directory / "fmt_i2.npy").string(), "<i2", 24, 255, accumulatorThresholds16.data(), accumulatorThresholds16.size() * 2);
+    writeNpy((directory / "fmt_acc_i4.npy").string(), "<i4", 24, 255, accumulatorThresholds32.data(), accumulatorThresholds32.size() * 4);
+    const auto table16 = FinnUtils::IntegerThresholdTable<int16_t>::fromNpy((directory / "fmt_i2.npy").string());
+    const auto table32 = FinnUtils::IntegerThresholdTable<int32_t>::fromNpy((directory / "fmt_acc_i4.npy").string());
+    const auto widened32 = FinnUtils::IntegerThresholdTable<int32_t>::fromNpy((directory / "fmt_i2.npy").string());
+    std::vector<int16_t> accumulators16(24 * 301);
+    for (size_t i = 0; i < accumulators16.size(); ++i) {
+        accumulators16[i] = static_cast<int16_t>(static_cast<int>((i * 7919 + i / 24) % 12001) - 6000);
+    }
+    accumulators16[0] = std::numeric_limits<int16_t>::min();
+    accumulators16[1] = std::numeric_limits<int16_t>::max();
+    accumulators16[2] = static_cast<int16_t>(accumulatorThresholds[2 * 255 + 17]);
+    const std::vector<int32_t> accumulators32(accumulators16.begin(), accumulators16.end());
+    const std::vector<float> accumulatorFloats(accumulators16.begin(), accumulators16.end());
+    const auto accumulatorReference = referenceOuter(FinnUtils::ThresholdTable(accumulatorThresholds.data(), 24, 255), accumulatorFloats);
+    // the scan and the search kernel directly, multithresholdInteger picks one of them by threshold count
+    const auto integerEqual = [](const auto& integerTable, const auto& values, const std::vector<int8_t>& expected) {
+        using T = std::remove_cvref_t<decltype(values[0])>;
+        const optimized::IntegerInterleavedTable<T> interleaved(integerTable);
+        std::vector<int8_t> scanned(values.size());
+        std::vector<int8_t> searched(values.size());
+        optimized::multithresholdIntegerScan<T>(interleaved, values, scanned);
+        optimized::multithresholdIntegerSearch<T>(interleaved, values, searched);
+        return expected == optimized::multithresholdInteger(interleaved, values) && expected == scanned && expected == searched;
+    };
+    std::cout << std::boolalpha << "Npy int16 accumulators equal to ref.:    " << integerEqual(table16, accumulators16, accumulatorReference) << "\n";
+    std::cout << std::boolalpha << "Npy int32 accumulators equal to ref.:    " << (integerEqual(table32, accumulators32, accumulatorReference) && integerEqual(widened32, accumulators32, accumulatorReference)) << "\n";
+    // float thresholds round down, exact for integer inputs
+    const auto flooredTable = FinnUtils::IntegerThresholdTable<int16_t>::fromNpy(THRESHOLDS_NPY);
+    std::vector<int16_t> smallAccumulators;
+    for (int row = 0; row < 9; ++row) {
+        for (int c = 0; c < 24; ++c) {
+            smallAccumulators.emplace_back(static_cast<int16_t>(row - 4));
+        }
+    }
+    const std::vector<float> smallFloats(smallAccumulators.begin(), smallAccumulators.end());
+    std::vector<float> huge = { -1.0f, 1e6f };
+    writeNpy((directory / "fmt_huge.npy").string(), "<f4", 1, 2, huge.data(), huge.size() * 4);
+    bool hugeRejected = false;
+    try {
+        FinnUtils::IntegerThresholdTable<int16_t>::fromNpy((directory / "fmt_huge.npy").string());
+    }
+    catch (const std::runtime_error&) {
+        hugeRejected = true;
+    }
+    std::cout << std::boolalpha << "Npy float as int16 equal to reference:   " << (integerEqual(flooredTable, smallAccumulators, referenceOuter(table, smallFloats)) && hugeRejected) << "\n";
+    // fused MatMul + MultiThreshold, full and partial row tiles and output blocks, an odd input width for the int8 pairs
+    std::mt19937 mvauEngine{ 7 };
+    std::uniform_real_distribution<float> mvauValues{ -1.0f, 1.0f };
+    std::uniform_int_distribution<int> mvauWeights{ -8, 8 };
+    std::uniform_int_distribution<int> mvauInputs{ -128, 127 };
+    constexpr size_t mvauIn = 37;
+    constexpr size_t mvauRows = 2 * optimized::MVAU<float>::rowTile + 5;
+    bool mvauEqual = true;
+    for (size_t mvauOut : { size_t{ 24 }, size_t{ 21 } }) {
+        std::vector<float> floatWeights(mvauIn * mvauOut);
+        std::vector<float> floatInputs(mvauRows * mvauIn);
+        std::generate(floatWeights.begin(), floatWeights.end(), [&]() { return 0.3f * mvauValues(mvauEngine); });
+        std::generate(floatInputs.begin(), floatInputs.end(), [&]() { return mvauValues(mvauEngine); });
+        std::vector<int8_t> intWeights(mvauIn * mvauOut);
+        std::vector<int8_t> intInputs(mvauRows * mvauIn);
+        std::generate(intWeights.begin(), intWeights.end(), [&]() { return static_cast<int8_t>(mvauWeights(mvauEngine)); });
+        std::generate(intInputs.begin(), intInputs.end(), [&]() { return static_cast<int8_t>(mvauInputs(mvauEngine)); });
+        std::vector<float> floatProduct(mvauRows * mvauOut);
+        std::vector<int32_t> intProduct(mvauRows * mvauOut);
+        for (size_t row = 0; row < mvauRows; ++row) {
+            for (size_t n = 0; n < mvauOut; ++n) {
+                float acc = 0.0f;
+                int32_t intAcc = 0;
+                for (size_t k = 0; k < mvauIn; ++k) {
+                    acc = std::fma(floatInputs[row * mvauIn + k], floatWeights[k * mvauOut + n], acc);
+                    intAcc += intInputs[row * mvauIn + k] * intWeights[k * mvauOut + n];
+                }
+                floatProduct[row * mvauOut + n] = acc;
+                intProduct[row * mvauOut + n] = intAcc;
+            }
+        }
+        const FinnUtils::ThresholdTable mvauTable(thresholds.data(), mvauOut, 255);
+        const optimized::MVAU<float> floatMVAU(floatWeights, mvauIn, mvauOut, mvauTable);
+        std::vector<float> floatAccumulators(floatProduct.size());
+        floatMVAU.accumulate(floatInputs, floatAccumulators);
+        mvauEqual &= floatMVAU(floatInputs) == referenceOuter(mvauTable, floatProduct) && floatAccumulators == floatProduct;
+
+        const FinnUtils::IntegerThresholdTable<int32_t> intMVAUTable(accumulatorThresholds32.data(), mvauOut, 255);
+        const optimized::MVAU<int8_t> intMVAU(intWeights, mvauIn, mvauOut, intMVAUTable);
+        std::vector<int32_t> intAccumulators(intProduct.size());
+        intMVAU.accumulate(intInputs, intAccumulators);
+        mvauEqual &= intMVAU(intInputs) == referenceOuter(FinnUtils::ThresholdTable(accumulatorThresholds.data(), mvauOut, 255), std::vector<float>(intProduct.begin(), intProduct.end())) && intAccumulators == intProduct;
+    }
+    bool mvauRejected = false;
+    try {
+        optimized::MVAU<float>(std::vector<float>(mvauIn * 24), mvauIn, 24, FinnUtils::ThresholdTable(thresholds.data(), 23, 255));
+    }
+    catch (const std::invalid_argument&) {
+        mvauRejected = true;
+    }
+    std::cout << std::boolalpha << "Fused MVAU equal to MatMul + reference:  " << (mvauEqual && mvauRejected) << "\n";
+    // threshold + max pool in both orders against threshold then a naive pool, overlapping and strided windows
+    const auto poolReference = [](const optimized::PoolShape& shape, const std::vector<int8_t>& activations) {
+        std::vector<int8_t> pooled;
+        for (size_t n = 0; n < activations.size() / shape.inputSize(); ++n) {
+            for (size_t oy = 0; oy < shape.outHeight(); ++oy) {
+                for (size_t ox = 0; ox < shape.outWidth(); ++ox) {
+                    for (size_t c = 0; c < shape.channels; ++c) {
+                        int8_t best = -128;
+                        for (size_t ky = 0; ky < shape.kernel; ++ky) {
+                            for (size_t kx = 0; kx < shape.kernel; ++kx) {
+                                best = std::max(best, activations[n * shape.inputSize() + ((oy * shape.stride + ky) * shape.width + ox * shape.stride + kx) * shape.channels + c]);
+                            }
+                        }
+                        pooled.emplace_back(best);
+                    }
+                }
+            }
+        }
+        return pooled;
+    };
+    bool poolEqual = true;
+    for (const optimized::PoolShape poolShape : { optimized::PoolShape{ 7, 9, 24, 2, 2 }, optimized::PoolShape{ 6, 5, 24, 3, 1 } }) {
+        std::vector<float> poolInputs(3 * poolShape.inputSize());
+        std::generate(poolInputs.begin(), poolInputs.end(), [&]() { return 2.0f * mvauValues(mvauEngine); });
+        poolInputs[5] = std::numeric_limits<float>::quiet_NaN();
+        poolInputs[poolShape.channels + 5] = std::numeric_limits<float>::quiet_NaN();
+        const FinnUtils::ThresholdTable poolTable(thresholds.data(), 24, 255);
+        const auto expected = poolReference(poolShape, referenceOuter(poolTable, poolInputs));
+        std::vector<int16_t> poolAccumulators(poolInputs.size());
+        std::transform(poolInputs.begin(), poolInputs.end(), poolAccumulators.begin(), [](float x) { return static_cast<int16_t>(std::isnan(x) ? 0.0f : std::floor(x * 1000.0f)); });
+        const auto accumulatorExpected = poolReference(poolShape, referenceOuter(FinnUtils::ThresholdTable(accumulatorThresholds.data(), 24, 255), std::vector<float>(poolAccumulators.begin(), poolAccumulators.end())));
+        const std::vector<int32_t> poolAccumulators32(poolAccumulators.begin(), poolAccumulators.end());
+        for (const auto order : { optimized::PoolOrder::PoolFirst, optimized::PoolOrder::ThresholdFirst, optimized::PoolOrder::Auto }) {
+            poolEqual &= optimized::ThresholdMaxPool<float>(poolTable, poolShape, order)(poolInputs) == expected;
+            poolEqual &= optimized::ThresholdMaxPool<int16_t>(table16, poolShape, order)(poolAccumulators) == accumulatorExpected;
+            poolEqual &= optimized::ThresholdMaxPool<int32_t>(table32, poolShape, order)(poolAccumulators32) == accumulatorExpected;
+        }
+    }
+    bool poolRejected = false;
+    try {
+        optimized::ThresholdMaxPool<float>(FinnUtils::ThresholdTable(thresholds.data(), 24, 255), optimized::PoolShape{ 1, 4, 24, 2, 2 });
+    }
+    catch (const std::invalid_argument&) {
+        poolRejected = true;
+    }
+    std::cout << std::boolalpha << "Threshold + max pool equal to reference: " << (poolEqual && poolRejected) << "\n";
+    // out_scale / out_bias epilogues in registers (count kernels and lookups) and behind the int8 kernels (fused),
+    // against a separate pass, one channel saturates int16
+    std::vector<float> outScales(24);
+    std::vector<float> outBiases(24);
+    for (size_t c = 0; c < 24; ++c) {
+        outScales[c] = 0.0173f * static_cast<float>(c + 1);
+        outBiases[c] = -1.37f * static_cast<float>(c) + 0.5f;
+    }
+    outScales[7] = 300.0f;
+    const FinnUtils::ThresholdTable epilogueTable(thresholds.data(), 24, 255);
+    const auto epilogueCounts = referenceOuter(epilogueTable, edgeInputs);
+    const lossy::GatherLookup<int8_t> epilogueGather(gatherTable, 1000.0f, lossy::_get_shift(1000, firstMin));
+    const lossy::KeyThresholdLookup<int8_t> epilogueKeys(std::span<const float>(thresholds.data(), 255), 12, -128);
+    const auto epilogueEqual = [&]<typename Out>(const optimized::Epilogue<Out>& epilogue) {
+        std::vector<Out> expected(edgeInputs.size());
+        for (size_t i = 0; i < expected.size(); ++i) {
+            const size_t c = i % epilogue.channels();
+            const float value = std::fma(epilogue.channels() == 1 ? 0.5f : outScales[c], static_cast<float>(epilogueCounts[i] + 128), epilogue.channels() == 1 ? -64.0f : outBiases[c]);
+            if constexpr (std::is_same_v<Out, float>) {
+                expected[i] = value;
+            }
+            else if constexpr (std::is_same_v<Out, int16_t>) {
+                expected[i] = static_cast<int16_t>(std::clamp(std::nearbyint(value), -32768.0f, 32767.0f));
+            }
+            else {
+                expected[i] = FinnUtils::BFloat16::fromFloat(value);
+            }
+        }
+        const std::span<const float> inp(edgeInputs);
+        const auto run = [&](auto&& kernel) {
+            std::vector<Out> ret(edgeInputs.size());
+            kernel(std::span<Out>(ret));
+            return ret;
+        };
+        const auto le = epilogue.apply(optimized::multithresholdLE(epilogueTable, edgeInputs));
+        const auto fusedBlocked = run([&](std::span<Out> ret) { epilogue.fused([&](std::span<const float> in, std::span<int8_t> out) { optimized::multithresholdLEBlocked(epilogueTable, in, out); }, inp, ret, 24, 5); });
+        return optimized::multithresholdSIMD(epilogueTable, edgeInputs, epilogue) == expected && fusedBlocked == le
+            && run([&](std::span<Out> ret) { optimized::multithresholdLE(epilogueTable, inp, ret, epilogue); }) == le
+            && run([&](std::span<Out> ret) { optimized::multithresholdLEMT(epilogueTable, inp, ret, epilogue, optimized::LESearch::Gallop); }) == le
+            && run([&](std::span<Out> ret) { optimized::multithresholdLinearPerTensor(epilogueTable, inp, ret, epilogue); }) == epilogue.apply(optimized::multithresholdLinearPerTensor(epilogueTable, edgeInputs))
+            && run([&](std::span<Out> ret) { optimized::lookupThresholds(sharedLossy, inp, ret, epilogue); }) == epilogue.apply(sharedLossy.thresholds(edgeInputs))
+            && run([&](std::span<Out> ret) { optimized::lookupThresholds(epilogueGather, inp, ret, epilogue); }) == epilogue.apply(epilogueGather.thresholds(edgeInputs))
+            && run([&](std::span<Out> ret) { optimized::lookupThresholds(epilogueKeys, inp, ret, epilogue); }) == epilogue.apply(epilogueKeys.thresholds(edgeInputs));
+    };
+    const bool bfloatRounds = FinnUtils::BFloat16::fromFloat(1.0f).bits == 0x3f80 && FinnUtils::BFloat16::fromFloat(std::bit_cast<float>(0x3f808000u)).bits == 0x3f80
+        && FinnUtils::BFloat16::fromFloat(std::bit_cast<float>(0x3f818000u)).bits == 0x3f82 && std::isnan(FinnUtils::BFloat16::fromFloat(std::numeric_limits<float>::quiet_NaN()).toFloat());
+    bool epilogueRejected = false;
+    try {
+        optimized::Epilogue<float>(std::vector<float>(24, 1.0f), std::vector<float>(23, 0.0f));
+    }
+    catch (const std::invalid_argument&) {
+        epilogueRejected = true;
+    }
+    std::cout << std::boolalpha << "Epilogues equal to scale * count + bias: " << (epilogueEqual(optimized::Epilogue<float>(outScales, outBiases)) && epilogueEqual(optimized::Epilogue<int16_t>(outScales, outBiases))
+        && epilogueEqual(optimized::Epilogue<FinnUtils::BFloat16>(outScales, outBiases)) && epilogueEqual(optimized::Epilogue<float>(0.5f, -64.0f))
+        && epilogueEqual(optimized::Epilogue<int16_t>(0.5f, -64.0f)) && bfloatRounds && epilogueRejected) << "\n";
+    std::vector<float> unsorted = { 1.0f, 0.0f, 2.0f };
+    writeNpy((directory / "fmt_unsorted.npy").string(), "<f4", 1, 3, unsorted.data(), unsorted.size() * 4);
+    bool rejected = false;
+    try {
+        FinnUtils::ThresholdTable::fromNpy((directory / "fmt_unsorted.npy").string());
+    }
+    catch (const std::runtime_error&) {
+        rejected = true;
+    }
+    std::cout << std::boolalpha << "Npy non ascending rejected:              " << rejected << "\n";
+
+    // generic engine, fixed and runtime shapes
+    constexpr optimized::MultiThreshold<24, 255> generic(thresholds);
+    std::cout << std::boolalpha << "Generic 24x255 equal to expected:        " << (expectedResults2 == generic(inputs2)) << "\n";
+    std::cout << std::boolalpha << "Edge Generic 24x255 equal to reference:  " << (edgeReference == generic(edgeInputs)) << "\n";
+    std::cout << std::boolalpha << "Edge Dynamic 24x255 equal to reference:  " << (edgeReference == optimized::DynamicMultiThreshold<float, int8_t>(thresholds.data(), 24, 255)(edgeInputs)) << "\n";
+    std::array<float, 24 * 15> shortArray;
+    std::copy(shortThresholds.begin(), shortThresholds.end(), shortArray.begin());
+    const FinnUtils::ThresholdTable shortTable(shortThresholds.data(), 24, 15);
+    auto shortReference = referenceOuter(shortTable, edgeInputs);
+    // 4 bit activations, unsigned 0..15 and signed -8..7
+    std::vector<uint8_t> shortUnsigned;
+    std::vector<int8_t> shortSigned;
+    for (auto&& r : shortReference) {
+        shortUnsigned.emplace_back(r + 128);
+        shortSigned.emplace_back(r + 120);
+    }
+    std::cout << std::boolalpha << "Edge Generic 24x15 equal to reference:   " << (shortUnsigned == optimized::MultiThreshold<24, 15, float, uint8_t, 0>(shortArray)(edgeInputs)) << "\n";
+    std::cout << std::boolalpha << "Edge Dynamic 24x15 equal to reference:   " << (shortSigned == optimized::DynamicMultiThreshold<float, int8_t>(shortTable, -8)(edgeInputs)) << "\n";
+    std::array<int16_t, 2 * 3> ternary = { -10, 0, 10, -1, 5, 5 };
+    std::vector<int16_t> ternaryInputs = { -11, 0, 0, 5, 11, 6, -10, -2, 32767, -32768 };
+    std::vector<int16_t> ternaryExpected = { -1, 0, 0, 0, 2, 2, -1, -1, 2, -1 };
+    std::cout << std::boolalpha << "Generic 2x3 int16 equal to expected:     " << (ternaryExpected == optimized::MultiThreshold<2, 3, int16_t, int16_t, -1>(ternary)(ternaryInputs)) << "\n";
+    std::cout << std::boolalpha << "Dynamic 2x3 int16 equal to expected:     " << (ternaryExpected == optimized::DynamicMultiThreshold<int16_t, int16_t>(ternary.data(), 2, 3, -1)(ternaryInputs)) << "\n";
+
+    // packed sub-byte output
+    std::array<float, 24> binaryArray;
+    std::array<float, 24 * 3> ternaryArray;
+    for (size_t c = 0; c < 24; ++c) {
+        binaryArray[c] = thresholds[c * 255 + 127];
+        for (size_t k = 0; k < 3; ++k) {
+            ternaryArray[c * 3 + k] = thresholds[c * 255 + 64 * k + 63];
+        }
+    }
+    const optimized::MultiThreshold<24, 1, float, int8_t, 0> binaryEngine(binaryArray);
+    const optimized::MultiThreshold<24, 3, float, int8_t, -2> ternaryEngine(ternaryArray);
+    const optimized::MultiThreshold<24, 15, float, uint8_t, 0> nibbleEngine(shortArray);
+    std::cout << std::boolalpha << "Edge Packed 1 bit equal to unpacked:     " << (binaryEngine.bits == 1 && packReference(binaryEngine(edgeInputs), 1) == binaryEngine.packed(edgeInputs)) << "\n";
+    std::cout << std::boolalpha << "Edge Packed 2 bit equal to unpacked:     " << (ternaryEngine.bits == 2 && packReference(ternaryEngine(edgeInputs), 2) == ternaryEngine.packed(edgeInputs)) << "\n";
+    std::cout << std::boolalpha << "Edge Packed 4 bit equal to unpacked:     " << (nibbleEngine.bits == 4 && packReference(nibbleEngine(edgeInputs), 4) == nibbleEngine.packed(edgeInputs)) << "\n";
+    std::cout << std::boolalpha << "Edge Packed 8 bit equal to unpacked:     " << (generic.bits == 8 && packReference(edgeReference, 8) == generic.packed(edgeInputs)) << "\n";
+    const optimized::DynamicMultiThreshold<float, int8_t> oddEngine(ternaryArray.data(), 3, 3, -2);
+    const std::vector<float> oddInputs(edgeInputs.begin(), edgeInputs.begin() + 1037);
+    std::cout << std::boolalpha << "Odd Dynamic packed 2 bit equal:          " << (packReference(oddEngine(oddInputs), 2) == oddEngine.packed(oddInputs)) << "\n";
+
+    // caller provided buffers, reused across calls and larger than needed
+    std::vector<int8_t> spanBuffer(edgeInputs.size() + 7, 0);
+    const std::span<int8_t> spanOut(spanBuffer.data(), edgeInputs.size());
+    optimized::multithresholdSIMD<24>(edgeInputs, spanBuffer);
+    std::cout << std::boolalpha << "Span SIMD equal to reference:            " << std::equal(edgeReference.begin(), edgeReference.end(), spanOut.begin()) << "\n";
+    optimized::multithresholdLE<24>(edgeInputs, spanBuffer, eytzingerIndex);
+    std::cout << std::boolalpha << "Span LE Eytzinger equal to reference:    " << std::equal(edgeReference.begin(), edgeReference.end(), spanOut.begin()) << "\n";
+    generic(std::span<const float>(edgeInputs), spanOut);
+    std::cout << std::boolalpha << "Span Generic equal to reference:         " << std::equal(edgeReference.begin(), edgeReference.end(), spanOut.begin()) << "\n";
+    std::vector<int8_t> spanLEMT(inputs2.size());
+    optimized::multithresholdLEMT<24>(inputs2, spanLEMT);
+    optimized::multithresholdLEMT<24>(inputs2, spanLEMT);
+    std::cout << std::boolalpha << "Span LEMT reused equal to expected:      " << (expectedResults2 == spanLEMT) << "\n";
+    FinnUtils::ScratchArena arena;
+    optimized::multithresholdLinearPerTensor(inputs2, spanLEMT, arena);
+    std::cout << std::boolalpha << "Span LinearPT arena equal to expected:   " << (expectedResults2 == spanLEMT) << "\n";
+    std::vector<uint8_t> packedBuffer(generic.packed(edgeInputs).size());
+    generic.packed(std::span<const float>(edgeInputs), packedBuffer);
+    std::cout << std::boolalpha << "Span Packed 8 bit equal to unpacked:     " << (packReference(edgeReference, 8) == packedBuffer) << "\n";
+    bool tooSmall = false;
+    try {
+        optimized::multithreshold<24>(edgeInputs, std::span<int8_t>(spanBuffer.data(), 24));
+    }
+    catch (const std::invalid_argument&) {
+        tooSmall = true;
+    }
+    std::cout << std::boolalpha << "Span too small output rejected:          " << tooSmall << "\n";
+
+    // persistent thread pool, more threads than rows per part so several parts run
+    optimized::MultiThresholdEngine engine(4, false, 16);
+    std::vector<int8_t> engineOut(edgeInputs.size());
+    engine.multithresholdSIMD<24>(edgeInputs, engineOut);
+    std::cout << std::boolalpha << "Engine SIMD equal to reference:          " << (edgeReference == engineOut) << "\n";
+    engine.multithreshold<24>(edgeInputs, engineOut, eytzingerIndex);
+    std::cout << std::boolalpha << "Engine Eytzinger equal to reference:     " << (edgeReference == engineOut) << "\n";
+    engine.multithresholdLEMT<24>(edgeInputs, engineOut);
+    std::cout << std::boolalpha << "Engine LEMT equal to LE:                 " << (optimized::multithresholdLE(FinnUtils::ThresholdTable(thresholds.data(), 24, 255), edgeInputs) == engineOut) << "\n";
+    engine.multithresholdLEMT<24>(inputs2, engineOut);
+    std::cout << std::boolalpha << "Engine B4 LEMT equal to expected:        " << std::equal(expectedResults2.begin(), expectedResults2.end(), engineOut.begin()) << "\n";
+    engine.multithresholdLinearPerTensor(edgeInputs, engineOut);
+    std::cout << std::boolalpha << "Engine LinearPT equal to LinearPT:       " << (optimized::multithresholdLinearPerTensor(edgeInputs) == engineOut) << "\n";
+
+    // batch x channel tiled LEMT, also with a long batch so several row blocks get their own warm start
+    const FinnUtils::ThresholdTable compiledTable(thresholds.data(), 24, 255);
+    std::vector<float> longInputs;
+    for (int repeat = 0; repeat < 8; ++repeat) {
+        longInputs.insert(longInputs.end(), edgeInputs.begin(), edgeInputs.end());
+    }
+    std::vector<int8_t> tiledOut(longInputs.size());
+    optimized::multithresholdLEMTTiled(compiledTable, longInputs, tiledOut, 5);
+    std::cout << std::boolalpha << "Tiled LEMT equal to upper bound:         " << (optimized::multithreshold(compiledTable, longInputs) == tiledOut) << "\n";
+    std::cout << std::boolalpha << "Edge LE equal to upper bound:            " << (optimized::multithreshold(compiledTable, edgeInputs) == optimized::multithresholdLE(compiledTable, edgeInputs)) << "\n";
+    std::cout << std::boolalpha << "B4 Tiled LEMT equal to expected:         " << (expectedResults2 == optimized::multithresholdLEMTTiled(compiledTable, inputs2)) << "\n";
+    engine.multithresholdLEMT(compiledTable, longInputs, tiledOut);
+    std::cout << std::boolalpha << "Engine tiled LEMT equal to upper bound:  " << (optimized::multithreshold(compiledTable, longInputs) == tiledOut) << "\n";
+
+    std::cout << std::boolalpha << "Blocked LE equal to LE:                  " << (optimized::multithresholdLE(compiledTable, longInputs) == optimized::multithresholdLEBlocked(compiledTable, longInputs)) << "\n";
+    std::cout << std::boolalpha << "B4 Blocked LE equal to expected:         " << (expectedResults2 == optimized::multithresholdLEBlocked(compiledTable, inputs2)) << "\n";
+    const std::vector<float> ragged(edgeInputs.begin(), edgeInputs.begin() + 24 * 100 + 5);
+    std::cout << std::boolalpha << "Ragged Blocked LE equal to LE:           " << (optimized::multithresholdLE(compiledTable, ragged) == optimized::multithresholdLEBlocked(compiledTable, ragged)) << "\n";
+
+    // galloping LE search on uniform, sorted and random walk inputs
+    std::vector<float> sortedInputs(edgeInputs);
+    for (size_t c = 0; c < 24; ++c) {
+        std::vector<float> column;
+        for (size_t r = 0; r < sortedInputs.size() / 24; ++r) {
+            column.emplace_back(sortedInputs[r * 24 + c]);
+        }
+        // NaN breaks strict weak ordering, keep it out of the sort
+        std::stable_partition(column.begin(), column.end(), [](float x) { return !std::isnan(x); });
+        std::sort(column.begin(), std::find_if(column.begin(), column.end(), [](float x) { return std::isnan(x); }));
+        for (size_t r = 0; r < column.size(); ++r) {
+            sortedInputs[r * 24 + c] = column[r];
+        }
+    }
+    std::vector<float> walkInputs(24 * 4096);
+    std::mt19937 walkEngine{ 7 };
+    std::normal_distribution<float> walkStep{ 0.0f, 0.05f };
+    for (size_t i = 0; i < walkInputs.size(); ++i) {
+        walkInputs[i] = (i < 24) ? 0.0f : std::clamp(walkInputs[i - 24] + walkStep(walkEngine), -4.0f, 4.0f);
+    }
+    bool gallopEqual = true;
+    for (auto* values : { &edgeInputs, &sortedInputs, &walkInputs }) {
+        std::vector<int8_t> gallop(values->size());
+        optimized::multithresholdLE<24>(*values, gallop, optimized::LESearch::Gallop);
+        gallopEqual &= optimized::multithreshold(compiledTable, *values) == gallop;
+        optimized::multithresholdLEBlocked(compiledTable, *values, gallop, optimized::LESearch::Gallop);
+        gallopEqual &= optimized::multithreshold(compiledTable, *values) == gallop;
+    }
+    std::cout << std::boolalpha << "Gallop LE equal to upper bound:          " << gallopEqual << "\n";
+    std::cout << std::boolalpha << "Walk LE equal to upper bound:            " << (optimized::multithreshold<24>(walkInputs) == optimized::multithresholdLE<24>(walkInputs) && optimized::multithreshold<24>(walkInputs) == optimized::multithresholdLEMT<24>(walkInputs)) << "\n";
+
+    // sort-and-merge and the automatic choice between it and LE
+    bool sortMergeEqual = true;
+    for (const std::vector<float>* values : std::initializer_list<const std::vector<float>*>{ &edgeInputs, &sortedInputs, &walkInputs }) {
+        sortMergeEqual &= optimized::multithreshold(compiledTable, *values) == optimized::multithresholdSortMerge(compiledTable, *values);
+    }
+    sortMergeEqual &= optimized::multithresholdLE(compiledTable, ragged) == optimized::multithresholdSortMerge(compiledTable, ragged);
+    std::cout << std::boolalpha << "SortMerge equal to upper bound:          " << sortMergeEqual << "\n";
+    std::cout << std::boolalpha << "B4 SortMerge equal to expected:          " << (expectedResults2 == optimized::multithresholdSortMerge(compiledTable, inputs2)) << "\n";
+    const optimized::AutoLE autoLE(compiledTable);
+    std::cout << std::boolalpha << "Auto LE equal to upper bound:            " << (optimized::multithreshold(compiledTable, longInputs) == autoLE(longInputs) && expectedResults2 == autoLE(inputs2)) << " (sort from " << autoLE.threshold() << " rows)\n";
+
+    // integer key domain
+    const float inf = std::numeric_limits<float>::infinity();
+    const bool keysOrdered = FinnUtils::floatKey(-0.0f) == FinnUtils::floatKey(0.0f) && FinnUtils::floatKey(std::numeric_limits<float>::quiet_NaN()) == std::numeric_limits<int32_t>::min()
+        && FinnUtils::floatKey(-inf) < FinnUtils::floatKey(std::numeric_limits<float>::lowest()) && FinnUtils::floatKey(-1.0f) < FinnUtils::floatKey(-std::numeric_limits<float>::denorm_min())
+        && FinnUtils::floatKey(std::numeric_limits<float>::denorm_min()) > FinnUtils::floatKey(0.0f) && FinnUtils::floatKey(std::numeric_limits<float>::max()) < FinnUtils::floatKey(inf);
+    std::cout << std::boolalpha << "Float keys ordered:                      " << keysOrdered << "\n";
+    std::cout << std::boolalpha << "Edge Keys equal to reference:            " << (edgeReference == optimized::multithresholdKeys(optimized::KeyTable(compiledTable), edgeInputs)) << "\n";
+    std::cout << std::boolalpha << "Npy Keys equal to reference:             " << (npyReference == optimized::multithresholdKeys(optimized::KeyTable(table), edgeInputs)) << "\n";
+    // 5 channels do not divide the vector widths, the lane offsets wrap inside every vector
+    const FinnUtils::ThresholdTable fiveTable(thresholds.data(), 5, 255);
+    const std::vector<float> fiveInputs(edgeInputs.begin(), edgeInputs.begin() + edgeInputs.size() / 5 * 5);
+    std::cout << std::boolalpha << "Edge 5 channel SIMD/Keys equal to ref:   " << (referenceOuter(fiveTable, fiveInputs) == optimized::multithresholdSIMD(fiveTable, fiveInputs)
+        && referenceOuter(fiveTable, fiveInputs) == optimized::multithresholdKeys(optimized::KeyTable(fiveTable), fiveInputs)) << "\n";
+    const std::span<const float> channel0(thresholds.data(), 255);
+    const lossy::KeyThresholdLookup<int8_t> keyLookup(channel0, 12, -128);
+    std::vector<int8_t> keyLookupOut(edgeInputs.size());
+    keyLookup.thresholds(edgeInputs, keyLookupOut);
+    bool keyLookupBounded = keyLookup.threshold(-inf) == -128 && keyLookup.threshold(inf) == 127 && keyLookup.threshold(std::numeric_limits<float>::quiet_NaN()) == -128;
+    for (size_t i = 0; i < edgeInputs.size(); ++i) {
+        const int exact = std::isnan(edgeInputs[i]) ? -128 : static_cast<int>(std::distance(channel0.begin(), std::lower_bound(channel0.begin(), channel0.end(), edgeInputs[i]))) - 128;
+        keyLookupBounded &= keyLookupOut[i] == keyLookup.threshold(edgeInputs[i]) && keyLookupOut[i] <= exact && exact - keyLookupOut[i] <= static_cast<int>(keyLookup.maxError());
+    }
+    std::cout << std::boolalpha << "Key lookup within error bound:           " << keyLookupBounded << " (" << keyLookup.size() << " entries, max error " << keyLookup.maxError() << ")\n";
+
+    // int8 inputs requantized through per-channel maps, one scale through the thresholds and one landing on them
+    std::vector<int8_t> quantizedInputs(24 * 257);
+    for (size_t i = 0; i < quantizedInputs.size(); ++i) {
+        quantizedInputs[i] = static_cast<int8_t>((i * 7 + i / 24) % 256 - 128);
+    }
+    bool quantizedEqual = true;
+    for (const auto& [quantizedScale, zeroPoint] : { std::pair{ (thresholds[254] - thresholds[0]) / 200.0f, -3 }, std::pair{ thresholds[140], 0 }, std::pair{ -0.5f, 20 } }) {
+        for (const FinnUtils::ThresholdTable* quantizedSource : { &compiledTable, &scaledTable }) {
+            const FinnUtils::QuantizedTable quantizedTable(*quantizedSource, quantizedScale, zeroPoint);
+            std::vector<float> dequantized(quantizedInputs.size());
+            std::transform(quantizedInputs.begin(), quantizedInputs.end(), dequantized.begin(), [&](int8_t q) { return quantizedTable.dequantize(q); });
+            quantizedEqual &= quantizedTable.uniform == (quantizedSource == &compiledTable) && referenceOuter(*quantizedSource, dequantized) == optimized::multithresholdQuantized(quantizedTable, quantizedInputs);
+        }
+    }
+    std::cout << std::boolalpha << "Quantized maps equal to reference:       " << quantizedEqual << "\n";
+    const FinnUtils::QuantizedTable uniformQuantized(compiledTable, (thresholds[254] - thresholds[0]) / 200.0f, -3);
+
+    // one prepared table for every variant, the layout does not depend on the instruction set
+    const FinnUtils::IntegerInterleavedTable<int16_t> interleaved16(table16);
+    const FinnUtils::IntegerInterleavedTable<int32_t> interleaved32(table32);
+    // every kernel variant this cpu supports gives the results of the header kernels
+    bool variantsEqual = true;
+    std::string variantNames;
+    for (dispatch::Isa isa : { dispatch::Isa::Scalar, dispatch::Isa::AVX2, dispatch::Isa::AVX512, dispatch::Isa::AVX512VBMI }) {
+        if (!dispatch::supported(isa)) {
+            continue;
+        }
+        const dispatch::Kernels& variant = dispatch::kernels(isa);
+        variantNames += std::string(" ") + variant.name;
+        auto run = [&](dispatch::Kernel kernel, const std::vector<float>& values) {
+            std::vector<int8_t> ret(values.size(), 0);
+            kernel(compiledTable, values, ret);
+            return ret;
+        };
+        variantsEqual &= variant.isa == isa && run(variant.multithresholdSIMD, edgeInputs) == edgeReference
+            && run(variant.multithreshold, edgeInputs) == optimized::multithreshold(compiledTable, edgeInputs)
+            && run(variant.multithresholdLE, walkInputs) == optimized::multithresholdLE(compiledTable, walkInputs)
+            && run(variant.multithresholdLEBlocked, edgeInputs) == optimized::multithresholdLEBlocked(compiledTable, edgeInputs)
+            && run(variant.multithresholdLinearPerTensor, edgeInputs) == optimized::multithresholdLinearPerTensor(compiledTable, edgeInputs)
+            && run(variant.multithresholdSortMerge, edgeInputs) == optimized::multithresholdSortMerge(compiledTable, edgeInputs);
+        std::vector<int8_t> quantizedOut(quantizedInputs.size());
+        variant.multithresholdQuantized(uniformQuantized, quantizedInputs, quantizedOut);
+        variantsEqual &= quantizedOut == optimized::multithresholdQuantized(uniformQuantized, quantizedInputs);
+        std::vector<int8_t> integerOut16(accumulators16.size());
+        std::vector<int8_t> integerOut32(accumulators32.size());
+        variant.multithresholdInteger16(interleaved16, accumulators16, integerOut16);
+        variant.multithresholdInteger32(interleaved32, accumulators32, integerOut32);
+        variantsEqual &= integerOut16 == accumulatorReference && integerOut32 == accumulatorReference;
+    }
+    const dispatch::Isa detected = dispatch::kernels().isa;
+    variantsEqual &= dispatch::select(dispatch::Isa::Scalar).isa == dispatch::Isa::Scalar && dispatch::kernels().isa == dispatch::Isa::Scalar;
+    dispatch::select(detected);
+    std::cout << std::boolalpha << "Dispatch variants equal to kernels:      " << variantsEqual << " (" << variantNames.substr(1) << ", active " << dispatch::kernels().name << ")\n";
+
+    // the prepared kernels of every variant give the results of the header objects
+    const FinnUtils::ThresholdTable mixedTable(mixedThresholds.data(), 24, 255);
+    std::vector<float> familyWeights(mvauIn * 24);
+    std::vector<float> familyRows(mvauRows * mvauIn);
+    std::generate(familyWeights.begin(), familyWeights.end(), [&]() { return 0.3f * mvauValues(mvauEngine); });
+    std::generate(familyRows.begin(), familyRows.end(), [&]() { return mvauValues(mvauEngine); });
+    std::vector<int8_t> familyIntWeights(mvauIn * 24);
+    std::vector<int8_t> familyIntRows(mvauRows * mvauIn);
+    std::generate(familyIntWeights.begin(), familyIntWeights.end(), [&]() { return static_cast<int8_t>(mvauWeights(mvauEngine)); });
+    std::generate(familyIntRows.begin(), familyIntRows.end(), [&]() { return static_cast<int8_t>(mvauInputs(mvauEngine)); });
+    const FinnUtils::IntegerThresholdTable<int32_t> familyIntTable(accumulatorThresholds32.data(), 24, 255);
+    const optimized::PoolShape familyShape{ 7, 9, 24, 2, 2 };
+    std::vector<float> familyMaps(3 * familyShape.inputSize());
+    std::generate(familyMaps.begin(), familyMaps.end(), [&]() { return 2.0f * mvauValues(mvauEngine); });
+    std::vector<int16_t> familyAccumulators(familyMaps.size());
+    std::transform(familyMaps.begin(), familyMaps.end(), familyAccumulators.begin(), [](float x) { return static_cast<int16_t>(std::floor(x * 1000.0f)); });
+    const std::vector<int32_t> familyAccumulators32(familyAccumulators.begin(), familyAccumulators.end());
+    const optimized::Epilogue<float> familyEpilogue(outScales, outBiases);
+    const optimized::Epilogue<int16_t> familyEpilogue16(outScales, outBiases);
+    const optimized::Epilogue<FinnUtils::BFloat16> familyEpilogueBF16(outScales, outBiases);
+    const auto epilogueRuns = [&]<typename Out>(const dispatch::EpilogueKernels<Out>& kernels, const optimized::Epilogue<Out>& epilogue) {
+        const auto run = [&](auto kernel) {
+            std::vector<Out> ret(edgeInputs.size());
+            (kernels.*kernel)(compiledTable, edgeInputs, ret);
+            return ret;
+        };
+        std::vector<Out> applied(edgeInputs.size());
+        kernels.apply(optimized::multithresholdSIMD(compiledTable, edgeInputs), applied);
+        const auto le = epilogue.apply(optimized::multithresholdLE(compiledTable, edgeInputs));
+        return applied == epilogue.apply(optimized::multithresholdSIMD(compiledTable, edgeInputs)) && run(&dispatch::EpilogueKernels<Out>::multithresholdSIMD) == optimized::multithresholdSIMD(compiledTable, edgeInputs, epilogue)
+            && run(&dispatch::EpilogueKernels<Out>::multithresholdLE) == le && run(&dispatch::EpilogueKernels<Out>::multithresholdLEMT) == le
+            && run(&dispatch::EpilogueKernels<Out>::multithresholdLinearPerTensor) == epilogue.apply(optimized::multithresholdLinearPerTensor(compiledTable, edgeInputs));
+    };
+    bool familiesEqual = true;
+    for (dispatch::Isa isa : { dispatch::Isa::Scalar, dispatch::Isa::AVX2, dispatch::Isa::AVX512, dispatch::Isa::AVX512VBMI }) {
+        if (!dispatch::supported(isa)) {
+            continue;
+        }
+        const dispatch::Kernels& variant = dispatch::kernels(isa);
+        familiesEqual &= (*variant.soa(compiledTable))(edgeInputs) == optimized::multithresholdSoA(optimized::InterleavedTable(compiledTable), edgeInputs)
+            && (*variant.keys(compiledTable))(edgeInputs) == optimized::multithresholdKeys(optimized::KeyTable(compiledTable), edgeInputs)
+            && (*variant.linearPerChannel(mixedTable))(edgeInputs) == optimized::multithresholdLinearPerChannel(optimized::LinearChannelTable(mixedTable), edgeInputs)
+            && (*variant.linearPerChannel(compiledTable))(edgeInputs) == optimized::multithresholdLinearPerChannel<24>(edgeInputs);
+        for (dispatch::IndexKind kind : { dispatch::IndexKind::Sorted, dispatch::IndexKind::Threshold, dispatch::IndexKind::Scan, dispatch::IndexKind::Linear, dispatch::IndexKind::Radix, dispatch::IndexKind::Auto }) {
+            familiesEqual &= (*variant.searchIndex(mixedTable, kind))(edgeInputs) == optimized::multithreshold(optimized::SortedIndex(mixedTable), edgeInputs);
+        }
+        familiesEqual &= (*variant.gatherLookup(gatherTable, 1000.0f, lossy::_get_shift(1000, firstMin)))(edgeInputs) == epilogueGather.thresholds(edgeInputs)
+            && (*variant.keyLookup(std::span<const float>(thresholds.data(), 255), 12, -128))(edgeInputs) == epilogueKeys.thresholds(edgeInputs)
+            && (*variant.lossyLookup(compiledTable, 1 << 20, -128, 6))(edgeInputs) == sharedLossy.thresholds(edgeInputs)
+            && (*variant.multiThreshold(compiledTable, -128))(edgeInputs) == edgeReference
+            && (*variant.multiThresholdPacked(shortTable, -8))(edgeInputs) == optimized::DynamicMultiThreshold<float, int8_t>(shortTable, -8).packed(edgeInputs);
+        familiesEqual &= (*variant.mvauFloat(familyWeights, mvauIn, 24, compiledTable))(familyRows) == optimized::MVAU<float>(familyWeights, mvauIn, 24, compiledTable)(familyRows)
+            && (*variant.mvauInt8(familyIntWeights, mvauIn, 24, familyIntTable))(familyIntRows) == optimized::MVAU<int8_t>(familyIntWeights, mvauIn, 24, familyIntTable)(familyIntRows);
+        familiesEqual &= (*variant.thresholdMaxPool(compiledTable, familyShape, optimized::PoolOrder::Auto))(familyMaps) == optimized::ThresholdMaxPool<float>(compiledTable, familyShape, optimized::PoolOrder::PoolFirst)(familyMaps)
+            && (*variant.thresholdMaxPool16(table16, familyShape, optimized::PoolOrder::ThresholdFirst))(familyAccumulators) == optimized::ThresholdMaxPool<int16_t>(table16, familyShape, optimized::PoolOrder::PoolFirst)(familyAccumulators)
+            && (*variant.thresholdMaxPool32(table32, familyShape, optimized::PoolOrder::ThresholdFirst))(familyAccumulators32) == optimized::ThresholdMaxPool<int32_t>(table32, familyShape, optimized::PoolOrder::PoolFirst)(familyAccumulators32);
+        const auto familyEngine = variant.engine(2, false, 16);
+        std::vector<int8_t> engineSIMD(edgeInputs.size());
+        std::vector<int8_t> engineLEMT(edgeInputs.size());
+        std::vector<int8_t> engineLinear(edgeInputs.size());
+        familyEngine->multithresholdSIMD(compiledTable, edgeInputs, engineSIMD);
+        familyEngine->multithresholdLEMT(compiledTable, edgeInputs, engineLEMT);
+        familyEngine->multithresholdLinearPerTensor(edgeInputs, engineLinear);
+        familiesEqual &= familyEngine->threads() == 2 && engineSIMD == edgeReference && engineLEMT == optimized::multithresholdLE(compiledTable, edgeInputs)
+            && engineLinear == optimized::multithresholdLinearPerTensor(edgeInputs);
+        familiesEqual &= epilogueRuns(*variant.epilogueFloat(outScales, outBiases), familyEpilogue) && epilogueRuns(*variant.epilogueInt16(outScales, outBiases), familyEpilogue16)
+            && epilogueRuns(*variant.epilogueBFloat16(outScales, outBiases), familyEpilogueBF16);
+    }
+    std::cout << std::boolalpha << "Dispatch families equal to kernels:      " << familiesEqual << "\n";
 
     std::vector<int> out(data.begin(), data.end());
     std::cout << "OptimizedLEMT Out:" << join(out, ",") << "\n";
@@ -0,0 +1,144 @@
+#ifndef THREAD_POOL
+#define THREAD_POOL
+
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <algorithm>
+#include <utility>
+#include <memory>
+#include <type_traits>
+#include <cstdint>
+#include <pthread.h>
+#include <sched.h>
+#include <immintrin.h>
+
+namespace FinnUtils {
+
+    /**
+     * Fixed team of worker threads, started once and reused for every call. A call wakes the team by bumping a
+     * generation word (call counter in the high half, number of parts in the low half); idle workers spin on it for a
+     * while and only then park in a futex wait, so back to back calls never pay for a thread wakeup. The calling
+     * thread always takes part 0 of the work itself.
+     * Jobs must not throw, check arguments before handing work to the pool.
+     */
+    class ThreadPool {
+        private:
+        static constexpr int spinIterations = 1 << 14;
+
+        std::vector<std::thread> workers;
+        std::atomic<uint64_t> generation{ 0 };
+        std::atomic<std::size_t> pending{ 0 };
+        std::atomic<bool> stopping{ false };
+        std::mutex submit;
+        // written before generation is bumped, only read by workers taking part in that generation
+        void (*invoke)(void*, std::size_t) = nullptr;
+        void* job = nullptr;
+
+        void work(std::size_t part) {
+            uint64_t seen = 0;
+            while (true) {
+                uint64_t current = generation.load(std::memory_order_acquire);
+                for (int spin = 0; current == seen && spin < spinIterations; ++spin) {
+                    _mm_pause();
+                    current = generation.load(std::memory_order_acquire);
+                }
+                if (current == seen) {
+                    generation.wait(seen, std::memory_order_acquire);
+                    current = generation.load(std::memory_order_acquire);
+                }
+                seen = current;
+                if (stopping.load(std::memory_order_acquire)) {
+                    return;
+                }
+                // a worker not taking part may lag a generation behind, the part count travels with the word
+                if (part < (current & 0xFFFFFFFFu)) {
+                    invoke(job, part);
+                    pending.fetch_sub(1, std::memory_order_release);
+                }
+            }
+        }
+
+        static void pin(std::thread::native_handle_type thread, std::size_t cpu) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(cpu % CPU_SETSIZE, &set);
+            pthread_setaffinity_np(thread, sizeof(set), &set);
+        }
+
+        public:
+        /**
+         * threads: Team size including the calling thread
+         * pinned: Pin worker i to cpu i (the caller keeps its own affinity, it is usually on cpu 0)
+         */
+        explicit ThreadPool(std::size_t threads = std::thread::hardware_concurrency(), bool pinned = true) {
+            threads = std::max<std::size_t>(threads, 1);
+            const std::size_t cpus = std::max<std::size_t>(std::thread::hardware_concurrency(), 1);
+            for (std::size_t part = 1; part < threads; ++part) {
+                workers.emplace_back([this, part]() { work(part); });
+                if (pinned) {
+                    pin(workers.back().native_handle(), part % cpus);
+                }
+            }
+        }
+
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+
+        ~ThreadPool() {
+            stopping.store(true, std::memory_order_release);
+            generation.fetch_add(uint64_t{ 1 } << 32, std::memory_order_release);
+            generation.notify_all();
+            for (auto&& worker : workers) {
+                worker.join();
+            }
+        }
+
+        std::size_t size() const { return workers.size() + 1; }
+
+        /**
+         * Calls fn(part) for part in [0, parts) with parts capped to size(), part 0 on the calling thread.
+         * Returns once all parts are done. A single part runs inline without touching the team.
+         */
+        template<typename F>
+        void run(std::size_t parts, F&& fn) {
+            parts = std::min(parts, size());
+            if (parts <= 1) {
+                if (parts == 1) {
+                    fn(std::size_t{ 0 });
+                }
+                return;
+            }
+            std::lock_guard<std::mutex> lock(submit);
+            invoke = [](void* context, std::size_t part) { (*static_cast<std::remove_reference_t<F>*>(context))(part); };
+            job = const_cast<void*>(static_cast<const void*>(std::addressof(fn)));
+            pending.store(parts - 1, std::memory_order_relaxed);
+            const uint64_t previous = generation.load(std::memory_order_relaxed);
+            generation.store(((previous >> 32) + 1) << 32 | parts, std::memory_order_release);
+            generation.notify_all();
+            fn(std::size_t{ 0 });
+            for (int spin = 0; pending.load(std::memory_order_acquire) != 0; ++spin) {
+                // yield once the workers take long, they may be sharing this core
+                if (spin < spinIterations) {
+                    _mm_pause();
+                }
+                else {
+                    std::this_thread::yield();
+                }
+            }
+        }
+
+        /**
+         * Bounds of part out of parts for n items, as even as possible, each boundary a multiple of align
+         */
+        static std::pair<std::size_t, std::size_t> split(std::size_t n, std::size_t parts, std::size_t part, std::size_t align = 1) {
+            const std::size_t units = (n + align - 1) / align;
+            const std::size_t begin = std::min(units * part / parts * align, n);
+            const std::size_t end = std::min(units * (part + 1) / parts * align, n);
+            return { begin, end };
+        }
+    };
+}
+
+#endif // THREAD_POOL
@@ -0,0 +1,407 @@
+#ifndef THRESHOLD_INDEX
+#define THRESHOLD_INDEX
+
+#include <vector>
+#include <cstdint>
+#include <cstdlib>
+#include <algorithm>
+#include <bit>
+#include <limits>
+#include <chrono>
+#include <random>
+#include <cmath>
+#include <concepts>
+#include <immintrin.h>
+#include "threshold_table.h"
+#include "utils.h"
+
+/**
+ * Search backends for the per-channel threshold lookup. A backend answers search(channel, value) with the number of
+ * thresholds of that channel that are strictly smaller than value, which is exactly what referenceInner counts.
+ */
+namespace optimized::inline FINN_ISA {
+
+    template<typename Index>
+    concept SearchIndex = requires(const Index& index, std::size_t channel, float value) {
+        { index.search(channel, value) } -> std::convertible_to<std::size_t>;
+    };
+
+    /**
+     * Channel-major sorted thresholds, searched with a binary search. This is the layout of thresholds.h.
+     */
+    class SortedIndex {
+        private:
+        std::size_t channelCount;
+        std::size_t thresholdCount;
+        FinnUtils::AlignedVector<float> table;
+
+        public:
+        SortedIndex(const float* data, std::size_t channels, std::size_t count) : channelCount(channels), thresholdCount(count), table(data, data + channels * count) {}
+        explicit SortedIndex(const FinnUtils::ThresholdTable& table) : SortedIndex(table.data(), table.channels(), table.count()) {}
+
+        std::size_t channels() const { return channelCount; }
+        std::size_t count() const { return thresholdCount; }
+
+        std::size_t search(std::size_t channel, float value) const {
+            const float* begin = table.data() + channel * thresholdCount;
+            return std::distance(begin, std::lower_bound(begin, begin + thresholdCount, value));
+        }
+    };
+
+    /**
+     * Per-channel Eytzinger (BFS order) layout. Every channel is padded with +inf to a perfect tree of 2^depth - 1 nodes
+     * stored 1-based in a cache line aligned block of 2^depth floats, so node k has its children at 2k and 2k + 1.
+     * With a perfect tree the search runs exactly depth branchless steps and the final node index minus 2^depth is the
+     * number of thresholds smaller than the input. The 16 descendants four levels below node k are the cache line at
+     * 16k, which is prefetched while the current levels are compared.
+     */
+    class ThresholdIndex {
+        private:
+        std::size_t channelCount;
+        std::size_t thresholdCount;
+        unsigned int depth;
+        std::size_t nodes;
+        std::size_t block;
+        FinnUtils::AlignedVector<float> tree;
+
+        // Writes the sorted range into BFS order, returns the next in-order position
+        std::size_t build(const float* sorted, float* out, std::size_t i, std::size_t k) {
+            if (k < nodes) {
+                i = build(sorted, out, i, 2 * k);
+                out[k] = (i < thresholdCount) ? sorted[i] : std::numeric_limits<float>::infinity();
+                i = build(sorted, out, i + 1, 2 * k + 1);
+            }
+            return i;
+        }
+
+        public:
+        static constexpr std::size_t lineFloats = 64 / sizeof(float);
+
+        ThresholdIndex(const float* data, std::size_t channels, std::size_t count) : channelCount(channels), thresholdCount(count) {
+            depth = std::bit_width(count);
+            nodes = std::size_t{ 1 } << depth;
+            block = std::max(nodes, lineFloats);
+            tree = FinnUtils::AlignedVector<float>(channels * block, std::numeric_limits<float>::infinity());
+            for (std::size_t c = 0; c < channels; ++c) {
+                build(data + c * count, tree.data() + c * block, 0, 1);
+            }
+        }
+        explicit ThresholdIndex(const FinnUtils::ThresholdTable& table) : ThresholdIndex(table.data(), table.channels(), table.count()) {}
+
+        std::size_t channels() const { return channelCount; }
+        std::size_t count() const { return thresholdCount; }
+
+        std::size_t search(std::size_t channel, float value) const {
+            const float* base = tree.data() + channel * block;
+            std::size_t k = 1;
+            for (unsigned int level = 0; level < depth; ++level) {
+                if (lineFloats * k < nodes) {
+                    _mm_prefetch(reinterpret_cast<const char*>(base + lineFloats * k), _MM_HINT_T0);
+                }
+                k = 2 * k + (base[k] < value);
+            }
+            return k - nodes;
+        }
+    };
+
+    /**
+     * Branch-free full scan. The input is broadcast and compared against a whole register of thresholds at a time,
+     * the compare masks are popcounted and summed over the channel. Channels are padded with +inf to full cache lines.
+     * Does more work than a search, but has no dependent loads, which wins for short threshold lists.
+     */
+    class ScanIndex {
+        private:
+        std::size_t channelCount;
+        std::size_t thresholdCount;
+        std::size_t block;
+        FinnUtils::AlignedVector<float> table;
+
+        public:
+        static constexpr std::size_t lineFloats = 64 / sizeof(float);
+
+        ScanIndex(const float* data, std::size_t channels, std::size_t count) : channelCount(channels), thresholdCount(count) {
+            block = (count + lineFloats - 1) / lineFloats * lineFloats;
+            table = FinnUtils::AlignedVector<float>(channels * block, std::numeric_limits<float>::infinity());
+            for (std::size_t c = 0; c < channels; ++c) {
+                std::copy(data + c * count, data + (c + 1) * count, table.begin() + c * block);
+            }
+        }
+        explicit ScanIndex(const FinnUtils::ThresholdTable& table) : ScanIndex(table.data(), table.channels(), table.count()) {}
+
+        std::size_t channels() const { return channelCount; }
+        std::size_t count() const { return thresholdCount; }
+
+        std::size_t search(std::size_t channel, float value) const {
+            const float* base = table.data() + channel * block;
+            std::size_t result = 0;
+#if defined(__AVX512F__)
+            const __m512 x = _mm512_set1_ps(value);
+            for (std::size_t k = 0; k < block; k += 16) {
+                result += std::popcount(static_cast<unsigned int>(_mm512_cmp_ps_mask(_mm512_load_ps(base + k), x, _CMP_LT_OQ)));
+            }
+#elif defined(__AVX2__)
+            const __m256 x = _mm256_set1_ps(value);
+            for (std::size_t k = 0; k < block; k += 8) {
+                result += std::popcount(static_cast<unsigned int>(_mm256_movemask_ps(_mm256_cmp_ps(_mm256_load_ps(base + k), x, _CMP_LT_OQ))));
+            }
+#else
+            for (std::size_t k = 0; k < block; ++k) {
+                result += base[k] < value;
+            }
+#endif
+            return result;
+        }
+    };
+
+    /**
+     * Exact per-channel linear interpolation. For nearly uniform channels the candidate ceil((x - t0) / step) is at most
+     * one slot off, and two neighbour compares fix it up. Every channel is checked at construction: the candidate is
+     * monotone in x and the exact count is constant between thresholds, so checking both ends of every interval proves
+     * the one slot bound for all inputs. Channels that fail the check fall back to a binary search.
+     * Each channel is stored as NaN, t[0..count), NaN, the NaN sentinels never compare true.
+     */
+    class LinearIndex {
+        private:
+        struct Channel {
+            float origin;
+            float inverseStep;
+            bool linear;
+        };
+
+        std::size_t channelCount;
+        std::size_t thresholdCount;
+        std::size_t block;
+        std::vector<Channel> params;
+        FinnUtils::AlignedVector<float> table;
+
+        std::size_t candidate(const Channel& channel, float value) const {
+            const float f = std::ceil((value - channel.origin) * channel.inverseStep);
+            // written so NaN ends up at 0
+            return (f > 0.0f) ? ((f < static_cast<float>(thresholdCount)) ? static_cast<std::size_t>(f) : thresholdCount) : 0;
+        }
+
+        bool qualifies(std::size_t c) const {
+            const float* t = table.data() + c * block + 1;
+            auto fits = [&](float x) {
+                const std::size_t exact = std::distance(t, std::lower_bound(t, t + thresholdCount, x));
+                const std::size_t guess = candidate(params[c], x);
+                return guess + 1 >= exact && guess <= exact + 1;
+            };
+            for (std::size_t k = 0; k < thresholdCount; ++k) {
+                if (!fits(t[k]) || !fits(std::nextafter(t[k], std::numeric_limits<float>::infinity()))) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        public:
+        LinearIndex(const float* data, std::size_t channels, std::size_t count) : channelCount(channels), thresholdCount(count), block(count + 2), params(channels) {
+            table = FinnUtils::AlignedVector<float>(channels * block, std::numeric_limits<float>::quiet_NaN());
+            for (std::size_t c = 0; c < channels; ++c) {
+                const float* t = data + c * count;
+                std::copy(t, t + count, table.begin() + c * block + 1);
+                const float range = t[count - 1] - t[0];
+                params[c] = { t[0], (count > 1 && range > 0.0f) ? static_cast<float>(count - 1) / range : 0.0f, false };
+                params[c].linear = params[c].inverseStep > 0.0f && std::isfinite(params[c].inverseStep) && qualifies(c);
+            }
+        }
+        explicit LinearIndex(const FinnUtils::ThresholdTable& table) : LinearIndex(table.data(), table.channels(), table.count()) {}
+
+        std::size_t channels() const { return channelCount; }
+        std::size_t count() const { return thresholdCount; }
+        bool linear(std::size_t channel) const { return params[channel].linear; }
+        float origin(std::size_t channel) const { return params[channel].origin; }
+        float inverseStep(std::size_t channel) const { return params[channel].inverseStep; }
+        // t[-1..count], the first and last entry are the NaN sentinels
+        const float* padded(std::size_t channel) const { return table.data() + channel * block; }
+
+        std::size_t search(std::size_t channel, float value) const {
+            const Channel& p = params[channel];
+            const float* padded = table.data() + channel * block;
+            if (p.linear) {
+                const std::size_t j = candidate(p, value);
+                // padded[j] is t[j - 1], padded[j + 1] is t[j]
+                return j + (padded[j + 1] < value) - (value <= padded[j]);
+            }
+            return std::distance(padded + 1, std::lower_bound(padded + 1, padded + 1 + thresholdCount, value));
+        }
+    };
+
+    /**
+     * Exact radix lookup on FinnUtils::floatKey. The top level is indexed with the high bits of the input key relative
+     * to the first threshold of the channel (at most 2^bits buckets per channel) and stores how many thresholds lie
+     * below the bucket, so bucket b can only hit the threshold indices [start(b), start(b + 1)). Uniform thresholds
+     * crowd the widest binades in key space, so a bucket holding more than two thresholds instead points to a second
+     * level of 2^subBits buckets over its key range. The few keys of the final range are compared one by one.
+     * Unlike the lossy tables the result never differs from referenceInner, including -0.0, infinities and NaN.
+     */
+    class RadixIndex {
+        private:
+        static constexpr unsigned int subBits = 5;
+        static constexpr std::size_t subSize = (std::size_t{ 1 } << subBits) + 1;
+        // top level entries with this bit set hold a second level id instead of a start
+        static constexpr uint16_t nested = 0x8000;
+
+        struct Channel {
+            int32_t first;
+            uint32_t limit;
+            uint32_t shift;
+            std::size_t top;
+        };
+
+        std::size_t channelCount;
+        std::size_t thresholdCount;
+        std::vector<Channel> params;
+        FinnUtils::AlignedVector<uint16_t> tops;
+        // second levels, subSize starts each, the last one is the start of the next bucket
+        FinnUtils::AlignedVector<uint16_t> subs;
+        // every channel is followed by sentinels, so the fixup always runs maxFixup() compares without a bounds check
+        FinnUtils::AlignedVector<int32_t> keys;
+        std::size_t block;
+        std::size_t widest = 0;
+
+        uint16_t start(uint16_t entry) const {
+            return (entry & nested) ? subs[(entry & ~nested) * subSize] : entry;
+        }
+
+        public:
+        RadixIndex(const float* data, std::size_t channels, std::size_t count, unsigned int bits = 10) : channelCount(channels), thresholdCount(count), params(channels) {
+            if (count == 0 || count >= nested) {
+                throw std::invalid_argument("RadixIndex needs between 1 and 32767 thresholds per channel");
+            }
+            // a single bit would need a shift of 32 for key ranges of 2^31 and more, e.g. thresholds on both sides of zero
+            if (bits < 2 || bits > 24) {
+                throw std::invalid_argument("RadixIndex bits must be in [2, 24]");
+            }
+            std::vector<int32_t> sorted(channels * count);
+            std::transform(data, data + channels * count, sorted.begin(), FinnUtils::floatKey);
+            for (std::size_t c = 0; c < channels; ++c) {
+                const int32_t* k = sorted.data() + c * count;
+                Channel& p = params[c];
+                p.first = k[0];
+                const uint64_t range = static_cast<uint32_t>(k[count - 1]) - static_cast<uint32_t>(p.first);
+                p.shift = 0;
+                while ((range >> p.shift) + 2 > (uint64_t{ 1 } << bits)) {
+                    ++p.shift;
+                }
+                p.limit = static_cast<uint32_t>(std::min<uint64_t>(((range >> p.shift) + 1) << p.shift, std::numeric_limits<uint32_t>::max()));
+                p.top = tops.size();
+                // number of thresholds with an offset below the given one
+                auto below = [&](uint64_t offset) {
+                    return static_cast<uint16_t>(std::distance(k, std::partition_point(k, k + count, [&](int32_t key) { return static_cast<uint32_t>(key) - static_cast<uint32_t>(p.first) < offset; })));
+                };
+                // one entry more than buckets, the last one only terminates the final bucket
+                const std::size_t buckets = (range >> p.shift) + 2;
+                for (std::size_t b = 0; b <= buckets; ++b) {
+                    const uint64_t lower = uint64_t{ b } << p.shift;
+                    const uint16_t first = below(lower);
+                    if (b == buckets || below(lower + (uint64_t{ 1 } << p.shift)) - first <= 2 || p.shift == 0) {
+                        tops.push_back(first);
+                        continue;
+                    }
+                    const unsigned int subShift = p.shift - std::min(p.shift, subBits);
+                    const std::size_t id = subs.size() / subSize;
+                    if (id >= nested) {
+                        throw std::invalid_argument("RadixIndex table too large, use fewer bits");
+                    }
+                    tops.push_back(static_cast<uint16_t>(id | nested));
+                    for (std::size_t i = 0; i < subSize; ++i) {
+                        subs.push_back(below(lower + (uint64_t{ i } << subShift)));
+                    }
+                }
+                for (std::size_t b = 0; b < buckets; ++b) {
+                    const uint16_t entry = tops[p.top + b];
+                    if (entry & nested) {
+                        const uint16_t* sub = subs.data() + (entry & ~nested) * subSize;
+                        for (std::size_t i = 0; i + 1 < subSize; ++i) {
+                            widest = std::max<std::size_t>(widest, sub[i + 1] - sub[i]);
+                        }
+                    }
+                    else {
+                        widest = std::max<std::size_t>(widest, start(tops[p.top + b + 1]) - entry);
+                    }
+                }
+            }
+            block = count + widest;
+            keys = FinnUtils::AlignedVector<int32_t>(channels * block, std::numeric_limits<int32_t>::max());
+            for (std::size_t c = 0; c < channels; ++c) {
+                std::copy(sorted.begin() + c * count, sorted.begin() + (c + 1) * count, keys.begin() + c * block);
+            }
+        }
+        explicit RadixIndex(const FinnUtils::ThresholdTable& table, unsigned int bits = 10) : RadixIndex(table.data(), table.channels(), table.count(), bits) {}
+
+        std::size_t channels() const { return channelCount; }
+        std::size_t count() const { return thresholdCount; }
+        // Largest number of thresholds sharing one final range, i.e. the most compares a search needs
+        std::size_t maxFixup() const { return widest; }
+        std::size_t bytes() const { return (tops.size() + subs.size()) * sizeof(uint16_t) + keys.size() * sizeof(int32_t); }
+
+        std::size_t search(std::size_t channel, float value) const {
+            const Channel& p = params[channel];
+            const int32_t key = FinnUtils::floatKey(value);
+            const uint32_t offset = std::min(static_cast<uint32_t>(std::max(key, p.first)) - static_cast<uint32_t>(p.first), p.limit);
+            const uint16_t entry = tops[p.top + (offset >> p.shift)];
+            const uint32_t inner = (offset & ((uint32_t{ 1 } << p.shift) - 1)) >> (p.shift - std::min(p.shift, subBits));
+            std::size_t j = (entry & nested) ? subs[(entry & ~nested) * subSize + inner] : entry;
+            // keys past the range are larger than the input, past the channel they are sentinels
+            const int32_t* k = keys.data() + channel * block;
+            for (std::size_t i = 0; i < widest; ++i) {
+                j += k[j] < key;
+            }
+            return j;
+        }
+    };
+
+    /**
+     * Holds a ThresholdIndex and a ScanIndex for the same table and decides once, at construction, which one is faster
+     * for this threshold count by timing both on a calibration sample spread over the threshold range.
+     */
+    class AutoIndex {
+        private:
+        ThresholdIndex searchIndex;
+        ScanIndex scanIndex;
+        bool useScan;
+
+        template<typename Index>
+        static std::chrono::nanoseconds time(const Index& index, const std::vector<float>& sample) {
+            std::size_t sink = 0;
+            const auto start = std::chrono::steady_clock::now();
+            for (int repeat = 0; repeat < 4; ++repeat) {
+                for (std::size_t i = 0; i < sample.size(); ++i) {
+                    sink += index.search(i % index.channels(), sample[i]);
+                }
+            }
+            const auto stop = std::chrono::steady_clock::now();
+            // keep the searches from being optimized away
+            volatile std::size_t keep = sink;
+            (void)keep;
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start);
+        }
+
+        public:
+        AutoIndex(const float* data, std::size_t channels, std::size_t count) : searchIndex(data, channels, count), scanIndex(data, channels, count) {
+            const auto [lowest, highest] = std::minmax_element(data, data + channels * count);
+            const float margin = (*highest - *lowest) * 0.1f;
+            std::mt19937 engine{ 42 };
+            std::uniform_real_distribution<float> dist{ *lowest - margin, *highest + margin };
+            std::vector<float> sample(std::max<std::size_t>(channels, 1) * 64);
+            std::generate(sample.begin(), sample.end(), [&]() { return dist(engine); });
+            // the first round only warms the caches
+            time(searchIndex, sample);
+            time(scanIndex, sample);
+            useScan = time(scanIndex, sample) < time(searchIndex, sample);
+        }
+        explicit AutoIndex(const FinnUtils::ThresholdTable& table) : AutoIndex(table.data(), table.channels(), table.count()) {}
+
+        std::size_t channels() const { return searchIndex.channels(); }
+        std::size_t count() const { return searchIndex.count(); }
+        bool scans() const { return useScan; }
+
+        std::size_t search(std::size_t channel, float value) const {
+            return useScan ? scanIndex.search(channel, value) : searchIndex.search(channel, value);
+        }
+    };
+};
+
+#endif // THRESHOLD_INDEX
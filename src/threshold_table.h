@@ -0,0 +1,501 @@
+#ifndef THRESHOLD_TABLE
+#define THRESHOLD_TABLE
+
+#include <vector>
+#include <algorithm>
+#include <string>
+#include <memory>
+#include <new>
+#include <cstdlib>
+#include <span>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <bit>
+#include <limits>
+#include <type_traits>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace FinnUtils {
+
+    /**
+     * Read-only memory mapping of a whole file, unmapped when the last owner goes away
+     */
+    class MappedFile {
+        private:
+        void* address = MAP_FAILED;
+        std::size_t length = 0;
+
+        public:
+        explicit MappedFile(const std::string& path) {
+            const int fd = ::open(path.c_str(), O_RDONLY);
+            if (fd < 0) {
+                throw std::runtime_error("Cannot open " + path);
+            }
+            struct stat info;
+            if (::fstat(fd, &info) != 0 || info.st_size == 0) {
+                ::close(fd);
+                throw std::runtime_error("Cannot stat or empty file " + path);
+            }
+            length = static_cast<std::size_t>(info.st_size);
+            address = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            ::close(fd);
+            if (address == MAP_FAILED) {
+                throw std::runtime_error("Cannot map " + path);
+            }
+        }
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        ~MappedFile() {
+            if (address != MAP_FAILED) {
+                ::munmap(address, length);
+            }
+        }
+
+        const uint8_t* data() const { return static_cast<const uint8_t*>(address); }
+        std::size_t size() const { return length; }
+    };
+
+    /**
+     * IEEE half to single precision, including subnormals, infinities and NaN
+     */
+    inline float halfToFloat(uint16_t half) {
+        const uint32_t sign = static_cast<uint32_t>(half & 0x8000u) << 16;
+        const uint32_t exponent = (half >> 10) & 0x1Fu;
+        uint32_t mantissa = half & 0x3FFu;
+        uint32_t bits;
+        if (exponent == 0x1Fu) {
+            bits = sign | 0x7F800000u | (mantissa << 13);
+        }
+        else if (exponent != 0) {
+            bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+        }
+        else if (mantissa == 0) {
+            bits = sign;
+        }
+        else {
+            // subnormal, normalize the mantissa
+            uint32_t shift = 0;
+            while ((mantissa & 0x400u) == 0) {
+                mantissa <<= 1;
+                ++shift;
+            }
+            bits = sign | ((113 - shift) << 23) | ((mantissa & 0x3FFu) << 13);
+        }
+        float ret;
+        std::memcpy(&ret, &bits, sizeof(ret));
+        return ret;
+    }
+
+    /**
+     * bfloat16 storage, the upper half of a float. Conversion rounds to nearest even and keeps NaN quiet.
+     */
+    struct BFloat16 {
+        uint16_t bits;
+
+        static BFloat16 fromFloat(float value) {
+            const uint32_t word = std::bit_cast<uint32_t>(value);
+            if (std::isnan(value)) {
+                return { static_cast<uint16_t>((word >> 16) | 0x40u) };
+            }
+            return { static_cast<uint16_t>((word + 0x7fffu + ((word >> 16) & 1u)) >> 16) };
+        }
+
+        float toFloat() const { return std::bit_cast<float>(uint32_t{ bits } << 16); }
+
+        bool operator==(const BFloat16&) const = default;
+    };
+
+    enum class NpyType { Float32, Float16, Int32, Int16 };
+
+    inline std::size_t npyWidth(NpyType type) {
+        return (type == NpyType::Float16 || type == NpyType::Int16) ? 2 : 4;
+    }
+
+    /**
+     * Element i of raw .npy data, every supported dtype fits a double exactly
+     */
+    inline double npyElement(const uint8_t* raw, std::size_t i, NpyType type) {
+        switch (type) {
+            case NpyType::Float16: {
+                uint16_t half;
+                std::memcpy(&half, raw + i * 2, 2);
+                return halfToFloat(half);
+            }
+            case NpyType::Int16: {
+                int16_t integer;
+                std::memcpy(&integer, raw + i * 2, 2);
+                return integer;
+            }
+            case NpyType::Int32: {
+                int32_t integer;
+                std::memcpy(&integer, raw + i * 4, 4);
+                return integer;
+            }
+            default: {
+                float value;
+                std::memcpy(&value, raw + i * 4, 4);
+                return value;
+            }
+        }
+    }
+
+    /**
+     * Parsed header of a .npy file (format versions 1 to 3)
+     */
+    struct NpyHeader {
+        NpyType type;
+        std::vector<std::size_t> shape;
+        std::size_t offset;
+
+        static NpyHeader parse(const uint8_t* file, std::size_t size) {
+            if (size < 10 || std::memcmp(file, "\x93NUMPY", 6) != 0) {
+                throw std::runtime_error("Not a .npy file");
+            }
+            const uint8_t major = file[6];
+            std::size_t headerLength;
+            std::size_t start;
+            if (major == 1) {
+                headerLength = file[8] | (file[9] << 8);
+                start = 10;
+            }
+            else if ((major == 2 || major == 3) && size >= 12) {
+                headerLength = file[8] | (file[9] << 8) | (file[10] << 16) | (static_cast<std::size_t>(file[11]) << 24);
+                start = 12;
+            }
+            else {
+                throw std::runtime_error("Unsupported .npy version " + std::to_string(major));
+            }
+            if (start + headerLength > size) {
+                throw std::runtime_error("Truncated .npy header");
+            }
+            const std::string dict(reinterpret_cast<const char*>(file + start), headerLength);
+
+            NpyHeader ret;
+            ret.offset = start + headerLength;
+
+            const auto value = [&dict](const std::string& key) {
+                const auto pos = dict.find("'" + key + "'");
+                if (pos == std::string::npos) {
+                    throw std::runtime_error("Missing '" + key + "' in .npy header");
+                }
+                return dict.substr(dict.find(':', pos) + 1);
+            };
+
+            const std::string descr = value("descr");
+            const auto quote = descr.find('\'');
+            const std::string dtype = descr.substr(quote + 1, descr.find('\'', quote + 1) - quote - 1);
+            if (dtype == "<f4") {
+                ret.type = NpyType::Float32;
+            }
+            else if (dtype == "<f2") {
+                ret.type = NpyType::Float16;
+            }
+            else if (dtype == "<i4") {
+                ret.type = NpyType::Int32;
+            }
+            else if (dtype == "<i2") {
+                ret.type = NpyType::Int16;
+            }
+            else {
+                throw std::runtime_error("Unsupported .npy dtype " + dtype);
+            }
+
+            const std::string order = value("fortran_order");
+            if (order.compare(order.find_first_not_of(' '), 5, "False") != 0) {
+                throw std::runtime_error("Only C-order .npy files are supported");
+            }
+
+            const std::string shape = value("shape");
+            const std::string dims = shape.substr(shape.find('(') + 1, shape.find(')') - shape.find('(') - 1);
+            std::size_t pos = 0;
+            while (pos < dims.size()) {
+                const auto next = dims.find(',', pos);
+                const std::string dim = dims.substr(pos, next == std::string::npos ? std::string::npos : next - pos);
+                if (dim.find_first_of("0123456789") != std::string::npos) {
+                    ret.shape.emplace_back(std::stoull(dim));
+                }
+                if (next == std::string::npos) {
+                    break;
+                }
+                pos = next + 1;
+            }
+            return ret;
+        }
+    };
+
+    /**
+     * A [channels, count] table of per-channel ascending thresholds. Either a view on existing memory (like the compiled
+     * in thresholds) or loaded at runtime from a .npy file. Float32 files are used in place from the memory mapping,
+     * float16, int16 and int32 files are widened to float once at load time.
+     */
+    class ThresholdTable {
+        private:
+        std::shared_ptr<const void> storage;
+        const float* values = nullptr;
+        std::size_t channelCount = 0;
+        std::size_t thresholdCount = 0;
+
+        public:
+        ThresholdTable() {}
+        ThresholdTable(const float* data, std::size_t channels, std::size_t count) : values(data), channelCount(channels), thresholdCount(count) {}
+        ThresholdTable(std::vector<float> data, std::size_t channels, std::size_t count) : channelCount(channels), thresholdCount(count) {
+            auto owned = std::make_shared<const std::vector<float>>(std::move(data));
+            values = owned->data();
+            storage = std::move(owned);
+        }
+
+        static ThresholdTable fromNpy(const std::string& path) {
+            auto file = std::make_shared<const MappedFile>(path);
+            const NpyHeader header = NpyHeader::parse(file->data(), file->size());
+            if (header.shape.empty() || header.shape.size() > 2) {
+                throw std::runtime_error("Expected a [channels, thresholds] array in " + path);
+            }
+            const std::size_t channels = (header.shape.size() == 2) ? header.shape[0] : 1;
+            const std::size_t count = header.shape.back();
+            const std::size_t elements = channels * count;
+            if (elements == 0 || header.offset + elements * npyWidth(header.type) > file->size()) {
+                throw std::runtime_error("Empty or truncated .npy data in " + path);
+            }
+
+            const uint8_t* raw = file->data() + header.offset;
+            ThresholdTable ret;
+            if (header.type == NpyType::Float32 && reinterpret_cast<std::uintptr_t>(raw) % alignof(float) == 0) {
+                ret = ThresholdTable(reinterpret_cast<const float*>(raw), channels, count);
+                ret.storage = std::move(file);
+            }
+            else {
+                std::vector<float> converted(elements);
+                for (std::size_t i = 0; i < elements; ++i) {
+                    converted[i] = static_cast<float>(npyElement(raw, i, header.type));
+                }
+                ret = ThresholdTable(std::move(converted), channels, count);
+            }
+            ret.validate();
+            return ret;
+        }
+
+        /**
+         * Throws if a channel contains NaN or is not ascending, all search kernels rely on both
+         */
+        void validate() const {
+            for (std::size_t c = 0; c < channelCount; ++c) {
+                const float* t = values + c * thresholdCount;
+                for (std::size_t k = 0; k < thresholdCount; ++k) {
+                    if (std::isnan(t[k])) {
+                        throw std::runtime_error("NaN threshold in channel " + std::to_string(c));
+                    }
+                    if (k > 0 && t[k] < t[k - 1]) {
+                        throw std::runtime_error("Thresholds of channel " + std::to_string(c) + " are not ascending at index " + std::to_string(k));
+                    }
+                }
+            }
+        }
+
+        std::size_t channels() const { return channelCount; }
+        std::size_t count() const { return thresholdCount; }
+        std::size_t size() const { return channelCount * thresholdCount; }
+        const float* data() const { return values; }
+
+        std::span<const float> channel(std::size_t c) const {
+            return std::span<const float>(values + c * thresholdCount, thresholdCount);
+        }
+
+        float operator()(std::size_t c, std::size_t k) const {
+            return values[c * thresholdCount + k];
+        }
+    };
+
+    /**
+     * A [channels, count] table of ascending integer thresholds for integer inputs (MVAU accumulators), T is int16_t or
+     * int32_t. .npy files of the same dtype are used in place, other integer files are converted with a range check.
+     * Float thresholds are rounded down, which is exact for integer inputs: t < x if and only if floor(t) < x.
+     */
+    template<typename T>
+    class IntegerThresholdTable {
+        static_assert(std::is_same_v<T, int16_t> || std::is_same_v<T, int32_t>, "Integer thresholds are int16_t or int32_t");
+
+        private:
+        std::shared_ptr<const void> storage;
+        const T* values = nullptr;
+        std::size_t channelCount = 0;
+        std::size_t thresholdCount = 0;
+
+        public:
+        IntegerThresholdTable() {}
+        IntegerThresholdTable(const T* data, std::size_t channels, std::size_t count) : values(data), channelCount(channels), thresholdCount(count) {}
+        IntegerThresholdTable(std::vector<T> data, std::size_t channels, std::size_t count) : channelCount(channels), thresholdCount(count) {
+            auto owned = std::make_shared<const std::vector<T>>(std::move(data));
+            values = owned->data();
+            storage = std::move(owned);
+        }
+
+        static IntegerThresholdTable fromNpy(const std::string& path) {
+            auto file = std::make_shared<const MappedFile>(path);
+            const NpyHeader header = NpyHeader::parse(file->data(), file->size());
+            if (header.shape.empty() || header.shape.size() > 2) {
+                throw std::runtime_error("Expected a [channels, thresholds] array in " + path);
+            }
+            const std::size_t channels = (header.shape.size() == 2) ? header.shape[0] : 1;
+            const std::size_t count = header.shape.back();
+            const std::size_t elements = channels * count;
+            if (elements == 0 || header.offset + elements * npyWidth(header.type) > file->size()) {
+                throw std::runtime_error("Empty or truncated .npy data in " + path);
+            }
+
+            const uint8_t* raw = file->data() + header.offset;
+            constexpr NpyType native = std::is_same_v<T, int16_t> ? NpyType::Int16 : NpyType::Int32;
+            IntegerThresholdTable ret;
+            if (header.type == native && reinterpret_cast<std::uintptr_t>(raw) % alignof(T) == 0) {
+                ret = IntegerThresholdTable(reinterpret_cast<const T*>(raw), channels, count);
+                ret.storage = std::move(file);
+            }
+            else {
+                std::vector<T> converted(elements);
+                for (std::size_t i = 0; i < elements; ++i) {
+                    const double value = std::floor(npyElement(raw, i, header.type));
+                    if (!(value >= std::numeric_limits<T>::min() && value <= std::numeric_limits<T>::max())) {
+                        throw std::runtime_error("Threshold " + std::to_string(i) + " of " + path + " does not fit the integer type");
+                    }
+                    converted[i] = static_cast<T>(value);
+                }
+                ret = IntegerThresholdTable(std::move(converted), channels, count);
+            }
+            ret.validate();
+            return ret;
+        }
+
+        /**
+         * Throws if a channel is not ascending
+         */
+        void validate() const {
+            for (std::size_t c = 0; c < channelCount; ++c) {
+                const std::span<const T> t = channel(c);
+                const auto unsorted = std::is_sorted_until(t.begin(), t.end());
+                if (unsorted != t.end()) {
+                    throw std::runtime_error("Thresholds of channel " + std::to_string(c) + " are not ascending at index " + std::to_string(unsorted - t.begin()));
+                }
+            }
+        }
+
+        std::size_t channels() const { return channelCount; }
+        std::size_t count() const { return thresholdCount; }
+        std::size_t size() const { return channelCount * thresholdCount; }
+        const T* data() const { return values; }
+
+        std::span<const T> channel(std::size_t c) const {
+            return std::span<const T>(values + c * thresholdCount, thresholdCount);
+        }
+
+        T operator()(std::size_t c, std::size_t k) const {
+            return values[c * thresholdCount + k];
+        }
+    };
+
+    /**
+     * Channel-interleaved layout of an IntegerThresholdTable for the integer kernels: every group of width channels (one
+     * 64 byte vector of T) stores threshold k of all its channels next to each other, padded with the largest T, which
+     * never counts as smaller than an input. The group width is that of the widest kernel variant, narrower variants
+     * cover a group with several vectors, so one prepared table serves every dispatch variant. One more group of
+     * padding keeps the 32 bit gathers of the search kernel on int16 inside the table.
+     */
+    template<typename T>
+    struct IntegerInterleavedTable {
+        static constexpr std::size_t width = 64 / sizeof(T);
+
+        std::size_t channels;
+        std::size_t count;
+        // 64 byte aligned, shared between copies
+        std::shared_ptr<const T[]> values;
+        // Offset of the first threshold of every position of a row, repeated so a 16 lane load at any position works
+        std::vector<int> offsets;
+
+        explicit IntegerInterleavedTable(const IntegerThresholdTable<T>& table) : channels(table.channels()), count(table.count()), offsets(table.channels() + 16) {
+            const std::size_t size = (channels + width - 1) / width * width * count + width;
+            T* interleaved = static_cast<T*>(std::aligned_alloc(64, (size * sizeof(T) + 63) / 64 * 64));
+            if (interleaved == nullptr) {
+                throw std::bad_alloc();
+            }
+            values = std::shared_ptr<const T[]>(interleaved, [](const T* ptr) { std::free(const_cast<T*>(ptr)); });
+            std::fill_n(interleaved, size, std::numeric_limits<T>::max());
+            for (std::size_t c = 0; c < channels; ++c) {
+                for (std::size_t k = 0; k < count; ++k) {
+                    interleaved[(c / width) * count * width + k * width + c % width] = table(c, k);
+                }
+            }
+            for (std::size_t k = 0; k < offsets.size(); ++k) {
+                const std::size_t c = k % channels;
+                offsets[k] = static_cast<int>((c / width) * count * width + c % width);
+            }
+        }
+    };
+
+    /**
+     * The whole multithreshold of an 8 bit quantized input, as one 256 entry int8 -> int8 map per channel. Entry q of a
+     * channel holds referenceOuter of dequantize(q), so the lookup is bit exact to thresholding the dequantized floats.
+     * Maps are indexed by the two's complement byte of q.
+     */
+    struct QuantizedTable {
+        std::size_t channels;
+        float scale;
+        int zeroPoint;
+        // all channels share one map, so the lookup does not depend on the element position
+        bool uniform;
+        std::vector<int8_t> maps;
+
+        QuantizedTable(const ThresholdTable& table, float scale, int zeroPoint) : channels(table.channels()), scale(scale), zeroPoint(zeroPoint), uniform(true), maps(table.channels() * 256) {
+            if (!std::isfinite(scale)) {
+                throw std::invalid_argument("Input scale has to be finite");
+            }
+            for (std::size_t c = 0; c < channels; ++c) {
+                const std::span<const float> channel = table.channel(c);
+                for (int q = -128; q < 128; ++q) {
+                    const std::size_t below = std::lower_bound(channel.begin(), channel.end(), dequantize(static_cast<int8_t>(q))) - channel.begin();
+                    maps[c * 256 + static_cast<uint8_t>(q)] = static_cast<int8_t>(std::min<std::size_t>(below, 255) - 128);
+                }
+                uniform = uniform && std::equal(maps.begin(), maps.begin() + 256, maps.begin() + c * 256);
+            }
+        }
+
+        float dequantize(int8_t q) const {
+            return static_cast<float>(q - zeroPoint) * scale;
+        }
+
+        const int8_t* map(std::size_t c) const {
+            return maps.data() + c * 256;
+        }
+    };
+
+    /**
+     * Geometry of a k x k max pool with stride s over NHWC feature maps, without padding
+     */
+    struct PoolShape {
+        size_t height;
+        size_t width;
+        size_t channels;
+        size_t kernel;
+        size_t stride;
+
+        size_t outHeight() const { return (height - kernel) / stride + 1; }
+        size_t outWidth() const { return (width - kernel) / stride + 1; }
+        size_t inputSize() const { return height * width * channels; }
+        size_t outputSize() const { return outHeight() * outWidth() * channels; }
+
+        void validate() const {
+            if (channels == 0 || kernel == 0 || stride == 0 || kernel > height || kernel > width) {
+                throw std::invalid_argument("Invalid pool of " + std::to_string(kernel) + "x" + std::to_string(kernel) + " stride " + std::to_string(stride) + " over " +
+                    std::to_string(height) + "x" + std::to_string(width) + "x" + std::to_string(channels));
+            }
+        }
+    };
+
+    enum class PoolOrder { Auto, PoolFirst, ThresholdFirst };
+}
+
+#endif // THRESHOLD_TABLE
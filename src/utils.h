@@ -0,0 +1,143 @@
+#ifndef FINN_UTILS
+#define FINN_UTILS
+
+#include <vector>
+#include <span>
+#include <cstdlib>
+#include <cstddef>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <cstdint>
+#include <cmath>
+#include <bit>
+#include <limits>
+#include <immintrin.h>
+
+/**
+ * Code whose machine code depends on the instruction set lives in an inline namespace named after it, so dispatch.h
+ * can link several variants of the same kernels into one binary. Plain builds only see FINN_ISA native.
+ */
+#ifndef FINN_ISA
+#define FINN_ISA native
+#endif
+
+namespace FinnUtils::inline FINN_ISA {
+    /**
+     * Minimal allocator handing out Alignment-aligned storage, so a vector can back cache line or SIMD aligned tables.
+     */
+    template<typename T, std::size_t Alignment = 64>
+    struct AlignedAllocator {
+        using value_type = T;
+
+        template<typename U>
+        struct rebind {
+            using other = AlignedAllocator<U, Alignment>;
+        };
+
+        AlignedAllocator() noexcept = default;
+        template<typename U>
+        AlignedAllocator(const AlignedAllocator<U, Alignment>&) noexcept {}
+
+        T* allocate(std::size_t n) {
+            // aligned_alloc requires the size to be a multiple of the alignment
+            const std::size_t bytes = (n * sizeof(T) + Alignment - 1) / Alignment * Alignment;
+            void* ptr = std::aligned_alloc(Alignment, bytes);
+            if (ptr == nullptr) {
+                throw std::bad_alloc();
+            }
+            return static_cast<T*>(ptr);
+        }
+
+        void deallocate(T* ptr, std::size_t) noexcept {
+            std::free(ptr);
+        }
+
+        template<typename U>
+        bool operator==(const AlignedAllocator<U, Alignment>&) const noexcept { return true; }
+        template<typename U>
+        bool operator!=(const AlignedAllocator<U, Alignment>&) const noexcept { return false; }
+    };
+
+    template<typename T, std::size_t Alignment = 64>
+    using AlignedVector = std::vector<T, AlignedAllocator<T, Alignment>>;
+
+    /**
+     * Maps a float to an unsigned key with the same order (for everything but NaN), so floats can be radix sorted.
+     * Negative values get all bits flipped, positive values only the sign bit.
+     */
+    inline uint32_t orderedKey(float value) {
+        const uint32_t bits = std::bit_cast<uint32_t>(value);
+        return bits ^ ((bits & 0x80000000u) ? 0xFFFFFFFFu : 0x80000000u);
+    }
+
+    inline float fromOrderedKey(uint32_t key) {
+        return std::bit_cast<float>(key ^ ((key & 0x80000000u) ? 0x80000000u : 0xFFFFFFFFu));
+    }
+
+    /**
+     * Order-preserving signed key of a float for integer compares: negative floats get their magnitude bits flipped,
+     * so signed int32 order is float order. Unlike orderedKey, -0.0 is folded into +0.0 (by adding +0.0f) and NaN maps
+     * to INT32_MIN, below the key of every threshold, so a strict key compare counts exactly the thresholds a strict
+     * float compare counts.
+     */
+    inline int32_t floatKey(float value) {
+        if (std::isnan(value)) {
+            return std::numeric_limits<int32_t>::min();
+        }
+        const int32_t bits = std::bit_cast<int32_t>(value + 0.0f);
+        return bits ^ ((bits >> 31) & 0x7FFFFFFF);
+    }
+
+#if defined(__AVX512F__)
+    inline __m512i floatKeys(__m512 x) {
+        const __m512i bits = _mm512_castps_si512(_mm512_add_ps(x, _mm512_setzero_ps()));
+        const __m512i key = _mm512_xor_si512(bits, _mm512_and_si512(_mm512_srai_epi32(bits, 31), _mm512_set1_epi32(0x7FFFFFFF)));
+        return _mm512_mask_mov_epi32(key, _mm512_cmp_ps_mask(x, x, _CMP_UNORD_Q), _mm512_set1_epi32(std::numeric_limits<int32_t>::min()));
+    }
+#endif
+#if defined(__AVX2__)
+    inline __m256i floatKeys(__m256 x) {
+        const __m256i bits = _mm256_castps_si256(_mm256_add_ps(x, _mm256_setzero_ps()));
+        const __m256i key = _mm256_xor_si256(bits, _mm256_and_si256(_mm256_srai_epi32(bits, 31), _mm256_set1_epi32(0x7FFFFFFF)));
+        return _mm256_blendv_epi8(key, _mm256_set1_epi32(std::numeric_limits<int32_t>::min()), _mm256_castps_si256(_mm256_cmp_ps(x, x, _CMP_UNORD_Q)));
+    }
+#endif
+
+    /**
+     * Reusable scratch memory for kernels that need a temporary buffer. The buffer only ever grows, so after the first
+     * call of a given size no more allocations happen. A span from get is valid until the next call to get.
+     */
+    class ScratchArena {
+        private:
+        AlignedVector<std::byte> buffer;
+
+        public:
+        template<typename T>
+        std::span<T> get(std::size_t n) {
+            if (buffer.size() < n * sizeof(T)) {
+                buffer.resize(n * sizeof(T));
+            }
+            return std::span<T>(reinterpret_cast<T*>(buffer.data()), n);
+        }
+    };
+
+    // Arena used by the kernels when the caller does not pass one
+    inline ScratchArena& threadScratch() {
+        thread_local ScratchArena arena;
+        return arena;
+    }
+
+    /**
+     * Checks a caller provided output buffer and returns the part of it that corresponds to the input
+     */
+    template<typename In, typename Out>
+    std::span<Out> outputFor(std::span<In> inp, std::span<Out> out) {
+        if (out.size() < inp.size()) {
+            throw std::invalid_argument("Output buffer holds " + std::to_string(out.size()) + " elements, " + std::to_string(inp.size()) + " needed");
+        }
+        return out.first(inp.size());
+    }
+}
+
+#endif // FINN_UTILS